@@ -0,0 +1,155 @@
+/*!
+    \file
+    Stress benchmark of stack allocators: many threads create, fill and destroy stacks.
+    Every allocator is run in its own process, so peak RSS of each one is measured separately
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "stack.h"
+#include "stack_alloc.h"
+
+/// @brief Allocators that are compared
+enum BenchAllocMode
+{
+    BENCH_MALLOC = 0,
+    BENCH_POOL   = 1,
+    BENCH_ARENA  = 2,
+};
+
+/// @brief Names of allocators (indexed by BenchAllocMode)
+static const char* const MODE_NAMES[] = {"malloc", "pool", "arena"};
+
+/// @brief Number of stacks that live at the same time in one thread
+static const int STACKS_PER_BATCH = 64;
+
+/// @brief Number of batches every thread creates
+static const int BATCHES_PER_THREAD = 2000;
+
+/// @brief Maximum number of elements put to one stack
+static const int MAX_ELEMS_PER_STACK = 300;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void ThreadWork(BenchAllocMode mode, unsigned int seed, long long* ops)
+{
+    size_t stacks[STACKS_PER_BATCH] = {};
+    StackElem_t value = 0;
+    long long thread_ops = 0;
+
+    for (int batch = 0; batch < BATCHES_PER_THREAD; batch++)
+    {
+        StackArena* arena = NULL;
+        StackAllocator arena_allocator = {};
+
+        StackConfig config = StackDefaultConfig();
+        if (mode == BENCH_POOL)
+            config.allocator = StackPoolAllocator();
+        else if (mode == BENCH_ARENA)
+        {
+            arena = StackArenaCreate(0);
+            arena_allocator = StackArenaAllocator(arena);
+            config.allocator = &arena_allocator;
+        }
+
+        for (int i = 0; i < STACKS_PER_BATCH; i++)
+        {
+            stacks[i] = 0;
+            CREATE_STACK_EX(&stacks[i], &config);
+        }
+
+        for (int i = 0; i < STACKS_PER_BATCH; i++)
+        {
+            int number_of_elems = rand_r(&seed) % MAX_ELEMS_PER_STACK + 1;
+            for (int j = 0; j < number_of_elems; j++)
+                StackPush(stacks[i], j);
+            for (int j = 0; j < number_of_elems / 2; j++)
+                StackPop(stacks[i], &value);
+
+            thread_ops += number_of_elems + number_of_elems / 2;
+        }
+
+        if (mode == BENCH_ARENA)
+            StackArenaDestroy(arena);
+        else
+            for (int i = 0; i < STACKS_PER_BATCH; i++)
+                StackDtor(&stacks[i]);
+    }
+
+    *ops = thread_ops;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void RunMode(BenchAllocMode mode, int number_of_threads)
+{
+    // The first stack sets up the key of pointers before threads start
+    size_t first_stk = 0;
+    CREATE_STACK(&first_stk);
+    StackDtor(&first_stk);
+
+    std::vector<std::thread> threads;
+    std::vector<long long> ops(number_of_threads, 0);
+
+    double start = NowSec();
+    for (int i = 0; i < number_of_threads; i++)
+        threads.emplace_back(ThreadWork, mode, (unsigned int) i + 1, &ops[i]);
+    for (std::thread& thread : threads)
+        thread.join();
+    double elapsed = NowSec() - start;
+
+    long long total_ops = 0;
+    for (long long thread_ops : ops)
+        total_ops += thread_ops;
+
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%-8s threads=%-3d %8.2f Mops/s  %10.0f stacks/s  peak RSS %7ld KB\n", MODE_NAMES[mode], number_of_threads,
+           (double) total_ops / elapsed / 1E6,
+           (double) STACKS_PER_BATCH * BATCHES_PER_THREAD * number_of_threads / elapsed, usage.ru_maxrss);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int) std::thread::hardware_concurrency();
+    if (max_threads <= 0)
+        max_threads = 1;
+
+    for (int number_of_threads = 1; number_of_threads <= max_threads; number_of_threads *= 2)
+        for (int mode = BENCH_MALLOC; mode <= BENCH_ARENA; mode++)
+        {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                RunMode((BenchAllocMode) mode, number_of_threads);
+                fflush(stdout);
+                _exit(0);
+            }
+
+            waitpid(pid, NULL, 0);
+        }
+
+    return 0;
+}
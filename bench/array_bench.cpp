@@ -0,0 +1,141 @@
+/*!
+    \file
+    Many small stacks benchmark: every stack gets one element per round and then loses one per round,
+    stacks are separate ones, stack array with single operations and stack array with batch operations
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "stack.h"
+#include "stack_array.h"
+
+/// @brief Number of elements that every stack gets (and then loses) in one pass
+static const int ROUNDS = 64;
+
+/// @brief Number of passes (stacks are grown by the first one only)
+static const int PASSES = 8;
+
+/// @brief How stacks are stored and changed
+enum BenchMode
+{
+    MODE_SEPARATE_STACKS = 0,
+    MODE_ARRAY_SINGLE    = 1,
+    MODE_ARRAY_BATCH     = 2,
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void RunSeparate(size_t number_of_stacks, const StackConfig* config, StackElem_t* vars)
+{
+    std::vector<size_t> stks(number_of_stacks, 0);
+    for (size_t& stk : stks)
+        CREATE_STACK_EX(&stk, config);
+
+    for (int pass = 0; pass < PASSES; pass++)
+    {
+        for (int round = 0; round < ROUNDS; round++)
+            for (size_t i = 0; i < number_of_stacks; i++)
+                StackPush(stks[i], (StackElem_t) (i + (size_t) round));
+
+        for (int round = 0; round < ROUNDS; round++)
+            for (size_t i = 0; i < number_of_stacks; i++)
+                StackPop(stks[i], &vars[i]);
+    }
+
+    for (size_t& stk : stks)
+        StackDtor(&stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void RunArray(size_t number_of_stacks, const StackConfig* config, StackElem_t* vars, bool batch)
+{
+    size_t arr = 0;
+    StackArrayInit(&arr, number_of_stacks, config);
+
+    std::vector<StackElem_t> values(number_of_stacks, 0);
+
+    for (int pass = 0; pass < PASSES; pass++)
+    {
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            if (batch)
+            {
+                for (size_t i = 0; i < number_of_stacks; i++)
+                    values[i] = (StackElem_t) (i + (size_t) round);
+                StackArrayPushAll(arr, values.data());
+            }
+            else
+                for (size_t i = 0; i < number_of_stacks; i++)
+                    StackArrayPush(arr, i, (StackElem_t) (i + (size_t) round));
+        }
+
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            if (batch)
+                StackArrayPopAll(arr, vars, NULL);
+            else
+                for (size_t i = 0; i < number_of_stacks; i++)
+                    StackArrayPop(arr, i, &vars[i]);
+        }
+    }
+
+    StackArrayDtor(&arr);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void Run(BenchMode mode, size_t number_of_stacks)
+{
+    StackConfig config = StackDefaultConfig();
+    config.protection = STK_PROTECT_NONE;
+    config.growth.min_capacity = 4;
+
+    std::vector<StackElem_t> vars(number_of_stacks, 0);
+
+    double start = NowSec();
+    if (mode == MODE_SEPARATE_STACKS)
+        RunSeparate(number_of_stacks, &config, vars.data());
+    else
+        RunArray(number_of_stacks, &config, vars.data(), mode == MODE_ARRAY_BATCH);
+    double elapsed = NowSec() - start;
+
+    long long check = 0;
+    for (StackElem_t var : vars)
+        check += var;
+
+    static const char* const mode_names[] = {"separate", "array single", "array batch"};
+    printf("%-13s stacks=%-8zu %8.3f s  %6.2f ns/op  (check %lld)\n", mode_names[mode], number_of_stacks, elapsed,
+           elapsed * 1E9 / (2.0 * PASSES * ROUNDS * (double) number_of_stacks), check);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    size_t max_stacks = argc > 1 ? (size_t) atoll(argv[1]) : 100000;
+    if (max_stacks == 0)
+        max_stacks = 1;
+
+    for (size_t number_of_stacks = 1000; number_of_stacks <= max_stacks; number_of_stacks *= 10)
+    {
+        Run(MODE_SEPARATE_STACKS, number_of_stacks);
+        Run(MODE_ARRAY_SINGLE, number_of_stacks);
+        Run(MODE_ARRAY_BATCH, number_of_stacks);
+    }
+
+    return 0;
+}
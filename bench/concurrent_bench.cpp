@@ -0,0 +1,128 @@
+/*!
+    \file
+    Throughput of stack shared by several threads: C stack under mutex against lock-free concurrent stack
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stack.h"
+#include "stack_concurrent.h"
+
+/// @brief Number of push-pop pairs every thread makes
+static const long long PAIRS_PER_THREAD = 2000000;
+
+/// @brief Number of elements that are put to stack before measurement (pops never find it empty)
+static const int BASE_ELEMS = 1000;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void MutexWork(size_t stk, std::mutex* stk_mutex, long long* checksum)
+{
+    StackElem_t value = 0;
+    long long sum = 0;
+
+    for (long long i = 0; i < PAIRS_PER_THREAD; i++)
+    {
+        {
+            std::lock_guard<std::mutex> lock(*stk_mutex);
+            StackPush(stk, i);
+        }
+        {
+            std::lock_guard<std::mutex> lock(*stk_mutex);
+            StackPop(stk, &value);
+        }
+        sum += value;
+    }
+
+    *checksum = sum;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void ConcWork(size_t stk, long long* checksum)
+{
+    StackElem_t value = 0;
+    long long sum = 0;
+
+    for (long long i = 0; i < PAIRS_PER_THREAD; i++)
+    {
+        StackConcPush(stk, i);
+        StackConcPop(stk, &value);
+        sum += value;
+    }
+
+    *checksum = sum;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void Report(const char* name, int number_of_threads, double elapsed)
+{
+    printf("%-10s threads=%-3d %8.2f Mops/s\n", name, number_of_threads,
+           (double) PAIRS_PER_THREAD * 2 * number_of_threads / elapsed / 1E6);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int) std::thread::hardware_concurrency();
+    if (max_threads <= 0)
+        max_threads = 1;
+
+    for (int number_of_threads = 1; number_of_threads <= max_threads; number_of_threads *= 2)
+    {
+        std::vector<long long> checksums(number_of_threads, 0);
+        std::vector<std::thread> threads;
+
+        StackConfig config = StackDefaultConfig();
+        config.protection = STK_PROTECT_NONE;
+
+        size_t stk = 0;
+        CREATE_STACK_EX(&stk, &config);
+        for (int i = 0; i < BASE_ELEMS; i++)
+            StackPush(stk, i);
+
+        std::mutex stk_mutex;
+        double start = NowSec();
+        for (int i = 0; i < number_of_threads; i++)
+            threads.emplace_back(MutexWork, stk, &stk_mutex, &checksums[i]);
+        for (std::thread& thread : threads)
+            thread.join();
+        Report("mutex", number_of_threads, NowSec() - start);
+
+        StackDtor(&stk);
+        threads.clear();
+
+        size_t conc_stk = 0;
+        StackConcInit(&conc_stk);
+        for (int i = 0; i < BASE_ELEMS; i++)
+            StackConcPush(conc_stk, i);
+
+        start = NowSec();
+        for (int i = 0; i < number_of_threads; i++)
+            threads.emplace_back(ConcWork, conc_stk, &checksums[i]);
+        for (std::thread& thread : threads)
+            thread.join();
+        Report("lock-free", number_of_threads, NowSec() - start);
+
+        StackConcDtor(&conc_stk);
+    }
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*!
+    \file
+    Task scheduler benchmark: binary tree of tasks (leaves compute fib) is run by thread pool
+    with one global locked stack and with work-stealing deques
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stack.h"
+#include "stack_deque.h"
+
+/// @brief Depth of task tree (2^TREE_DEPTH leaves)
+static const int TREE_DEPTH = 16;
+
+/// @brief Argument of fib that every leaf computes
+static const int LEAF_FIB = 20;
+
+/// @brief Scheduler that runs tasks
+enum BenchScheduler
+{
+    SCHED_GLOBAL_STACK = 0,
+    SCHED_WORK_STEALING = 1,
+};
+
+/// @brief Shared state of thread pool
+struct BenchPool
+{
+    BenchScheduler scheduler;
+    int number_of_threads;
+
+    size_t global_stk;
+    std::mutex global_mutex;
+
+    std::vector<size_t> deques;
+
+    std::atomic<long long> pending;
+    std::atomic<long long> result;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static long long Fib(int n)
+{
+    return n < 2 ? n : Fib(n - 1) + Fib(n - 2);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void PutTask(BenchPool* pool, int worker, StackElem_t task)
+{
+    if (pool->scheduler == SCHED_GLOBAL_STACK)
+    {
+        std::lock_guard<std::mutex> lock(pool->global_mutex);
+        StackPush(pool->global_stk, task);
+    }
+    else
+        StackDequePush(pool->deques[worker], task);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool GetTask(BenchPool* pool, int worker, unsigned int* seed, StackElem_t* task)
+{
+    if (pool->scheduler == SCHED_GLOBAL_STACK)
+    {
+        std::lock_guard<std::mutex> lock(pool->global_mutex);
+        return StackPop(pool->global_stk, task) == STK_NO_ERROR;
+    }
+
+    if (StackDequePop(pool->deques[worker], task) == STK_NO_ERROR)
+        return true;
+
+    int victim = rand_r(seed) % pool->number_of_threads;
+    return victim != worker && StackDequeSteal(pool->deques[victim], task) == STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void Worker(BenchPool* pool, int worker)
+{
+    unsigned int seed = (unsigned int) worker + 1;
+    long long sum = 0;
+    StackElem_t task = 0;
+
+    while (pool->pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!GetTask(pool, worker, &seed, &task))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Task is depth of the node in tree
+        if (task < TREE_DEPTH)
+        {
+            pool->pending.fetch_add(2, std::memory_order_relaxed);
+            PutTask(pool, worker, task + 1);
+            PutTask(pool, worker, task + 1);
+        }
+        else
+            sum += Fib(LEAF_FIB);
+
+        pool->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    pool->result.fetch_add(sum, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void RunPool(BenchScheduler scheduler, int number_of_threads)
+{
+    BenchPool pool;
+    pool.scheduler = scheduler;
+    pool.number_of_threads = number_of_threads;
+    pool.global_stk = 0;
+    pool.pending.store(1);
+    pool.result.store(0);
+
+    StackConfig config = StackDefaultConfig();
+    config.protection = STK_PROTECT_NONE;
+
+    CREATE_STACK_EX(&pool.global_stk, &config);
+    pool.deques.assign(number_of_threads, 0);
+    for (size_t& deq : pool.deques)
+        StackDequeInit(&deq, &config);
+
+    PutTask(&pool, 0, 0);
+
+    double start = NowSec();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < number_of_threads; i++)
+        threads.emplace_back(Worker, &pool, i);
+    for (std::thread& thread : threads)
+        thread.join();
+    double elapsed = NowSec() - start;
+
+    printf("%-14s threads=%-3d %8.3f s  %10.0f tasks/s  (result %lld)\n",
+           scheduler == SCHED_GLOBAL_STACK ? "global stack" : "work stealing", number_of_threads, elapsed,
+           (double) ((2ll << TREE_DEPTH) - 1) / elapsed, pool.result.load());
+
+    for (size_t& deq : pool.deques)
+        StackDequeDtor(&deq);
+    StackDtor(&pool.global_stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int) std::thread::hardware_concurrency();
+    if (max_threads <= 0)
+        max_threads = 1;
+
+    for (int number_of_threads = 1; number_of_threads <= max_threads; number_of_threads *= 2)
+    {
+        RunPool(SCHED_GLOBAL_STACK, number_of_threads);
+        RunPool(SCHED_WORK_STEALING, number_of_threads);
+    }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*!
+    \file
+    Micro-benchmark of hash algorithms (prints GB/s for every algorithm and block size)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stack_utils.h"
+
+/// @brief Total number of bytes hashed for every (algorithm, size) pair
+static const size_t BYTES_PER_RUN = 1ull << 30;
+
+/// @brief Sizes of buffers that are hashed
+static const size_t BUFFER_SIZES[] = {16, 64, 256, 4096, 65536, 1ull << 20, 64ull << 20};
+
+/// @brief Names of algorithms (indexed by HashAlgo)
+static const char* const ALGO_NAMES[] = {"djb2", "scalar", "crc32c", "avx2"};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main()
+{
+    const size_t max_size = BUFFER_SIZES[sizeof(BUFFER_SIZES) / sizeof(BUFFER_SIZES[0]) - 1];
+
+    unsigned char* buffer = (unsigned char*) malloc(max_size);
+    if (buffer == NULL)
+        return 1;
+
+    for (size_t i = 0; i < max_size; i++)
+        buffer[i] = (unsigned char) (i * 131 + 7);
+
+    printf("MyHash uses: %s\n", ALGO_NAMES[MyHashAlgo()]);
+    printf("%-8s %12s %10s\n", "algo", "bytes", "GB/s");
+
+    for (int algo = HASH_ALGO_DJB2; algo <= HASH_ALGO_AVX2; algo++)
+    {
+        if (!MyHashAlgoSupported((HashAlgo) algo))
+        {
+            printf("%-8s %12s %10s\n", ALGO_NAMES[algo], "-", "unsupported");
+            continue;
+        }
+
+        for (size_t size : BUFFER_SIZES)
+        {
+            size_t iterations = BYTES_PER_RUN / size;
+            if (algo == HASH_ALGO_DJB2)
+                iterations /= 8;
+
+            volatile unsigned long sink = 0;
+            double start = NowSec();
+            for (size_t i = 0; i < iterations; i++)
+                sink = sink + MyHashWith((HashAlgo) algo, buffer + (i & 7), size - (i & 7));
+            double elapsed = NowSec() - start;
+
+            printf("%-8s %12zu %10.2f\n", ALGO_NAMES[algo], size,
+                   (double) (iterations * size) / elapsed / 1E9);
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
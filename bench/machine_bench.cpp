@@ -0,0 +1,192 @@
+/*!
+    \file
+    Bytecode interpreter benchmark: the same program is run by interpreter that does every instruction
+    by fused stack machine operation and by one that composes it of StackPop and StackPush
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <initializer_list>
+
+#include "stack.h"
+
+/// @brief Instructions of interpreter
+enum BenchOpcode
+{
+    OP_PUSH = 0,
+    OP_DUP  = 1,
+    OP_OVER = 2,
+    OP_SWAP = 3,
+    OP_ROT  = 4,
+    OP_ADD  = 5,
+    OP_MUL  = 6,
+    OP_MOD  = 7,
+    OP_XOR  = 8,
+    OP_INC  = 9,
+};
+
+/// @brief Instruction with its argument (OP_PUSH only)
+struct BenchInstr
+{
+    BenchOpcode opcode;
+    StackElem_t arg;
+};
+
+/// @brief Program that takes x from the top of stack and leaves ((2x ^ 5x % 3) + 1) % 1000003 instead of it
+static const BenchInstr PROGRAM[] =
+{
+    {OP_DUP, 0}, {OP_PUSH, 5}, {OP_MUL, 0}, {OP_OVER, 0}, {OP_ROT, 0}, {OP_ADD, 0}, {OP_SWAP, 0},
+    {OP_PUSH, 3}, {OP_MOD, 0}, {OP_XOR, 0}, {OP_INC, 0}, {OP_PUSH, 1000003}, {OP_MOD, 0},
+};
+
+/// @brief Number of instructions in program
+static const size_t PROGRAM_SIZE = sizeof(PROGRAM) / sizeof(PROGRAM[0]);
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError Increment(StackElem_t value, StackElem_t* result, void* ctx)
+{
+    (void) ctx;
+    *result = value + 1;
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StepFused(size_t stk, const BenchInstr* instr)
+{
+    switch (instr->opcode)
+    {
+        case OP_PUSH:  return StackPush(stk, instr->arg);
+        case OP_DUP:   return StackDup(stk);
+        case OP_OVER:  return StackOver(stk);
+        case OP_SWAP:  return StackSwap(stk);
+        case OP_ROT:   return StackRot(stk);
+        case OP_ADD:   return StackBinaryOp(stk, STK_OP_ADD);
+        case OP_MUL:   return StackBinaryOp(stk, STK_OP_MUL);
+        case OP_MOD:   return StackBinaryOp(stk, STK_OP_MOD);
+        case OP_XOR:   return StackBinaryOp(stk, STK_OP_XOR);
+        case OP_INC:   return StackModifyTop(stk, Increment, NULL);
+        default:       return STACK_BAD_OPERAND_ERR;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StepComposed(size_t stk, const BenchInstr* instr)
+{
+    StackElem_t a = 0, b = 0, c = 0;
+    unsigned int code_err = STK_NO_ERROR;
+
+    switch (instr->opcode)
+    {
+        case OP_PUSH:
+            return StackPush(stk, instr->arg);
+        case OP_DUP:
+            code_err |= StackPop (stk, &a);
+            code_err |= StackPush(stk, a);
+            code_err |= StackPush(stk, a);
+            return (StackError) code_err;
+        case OP_OVER:
+            code_err |= StackPop (stk, &b);
+            code_err |= StackPop (stk, &a);
+            code_err |= StackPush(stk, a);
+            code_err |= StackPush(stk, b);
+            code_err |= StackPush(stk, a);
+            return (StackError) code_err;
+        case OP_SWAP:
+            code_err |= StackPop (stk, &b);
+            code_err |= StackPop (stk, &a);
+            code_err |= StackPush(stk, b);
+            code_err |= StackPush(stk, a);
+            return (StackError) code_err;
+        case OP_ROT:
+            code_err |= StackPop (stk, &c);
+            code_err |= StackPop (stk, &b);
+            code_err |= StackPop (stk, &a);
+            code_err |= StackPush(stk, b);
+            code_err |= StackPush(stk, c);
+            code_err |= StackPush(stk, a);
+            return (StackError) code_err;
+        case OP_INC:
+            code_err |= StackPop (stk, &a);
+            code_err |= StackPush(stk, a + 1);
+            return (StackError) code_err;
+        default:
+            break;
+    }
+
+    code_err |= StackPop(stk, &b);
+    code_err |= StackPop(stk, &a);
+    if (code_err != STK_NO_ERROR)
+        return (StackError) code_err;
+
+    switch (instr->opcode)
+    {
+        case OP_ADD:  return StackPush(stk, a + b);
+        case OP_MUL:  return StackPush(stk, a * b);
+        case OP_MOD:  return b != 0 ? StackPush(stk, a % b) : STACK_BAD_OPERAND_ERR;
+        case OP_XOR:  return StackPush(stk, a ^ b);
+        default:      return STACK_BAD_OPERAND_ERR;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void Run(bool fused, StackProtection protection, size_t base_depth, long long iterations)
+{
+    StackConfig config = StackDefaultConfig();
+    config.protection = protection;
+
+    size_t stk = 0;
+    CREATE_STACK_EX(&stk, &config);
+
+    // Program works on top of base elements (as interpreter does on top of its locals)
+    for (size_t i = 0; i <= base_depth; i++)
+        StackPush(stk, (StackElem_t) i);
+
+    unsigned int errors = 0;
+    double start = NowSec();
+
+    for (long long iteration = 0; iteration < iterations; iteration++)
+        for (size_t pc = 0; pc < PROGRAM_SIZE; pc++)
+            errors |= fused ? StepFused(stk, &PROGRAM[pc]) : StepComposed(stk, &PROGRAM[pc]);
+
+    double elapsed = NowSec() - start;
+
+    StackElem_t result = 0;
+    StackPop(stk, &result);
+    StackDtor(&stk);
+
+    double number_of_instrs = (double) iterations * (double) PROGRAM_SIZE;
+    printf("%-8s protection=%d %8.3f s  %8.2f M instr/s  %7.2f ns/instr  (result %lld, errors %u)\n",
+           fused ? "fused" : "composed", (int) protection, elapsed, number_of_instrs / elapsed * 1E-6,
+           elapsed * 1E9 / number_of_instrs, result, errors);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    long long iterations = argc > 1 ? atoll(argv[1]) : 200000;
+    size_t base_depth = argc > 2 ? (size_t) atoll(argv[2]) : 100;
+
+    for (StackProtection protection : {STK_PROTECT_NONE, STK_PROTECT_SCRUBBED, STK_PROTECT_FULL})
+    {
+        Run(false, protection, base_depth, iterations);
+        Run(true,  protection, base_depth, iterations);
+    }
+
+    return 0;
+}
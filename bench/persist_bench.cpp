@@ -0,0 +1,156 @@
+/*!
+    \file
+    Backtracking search benchmark: full binary tree of choices is searched by DFS, state stack is forked
+    at every branch point by StackFork and by copying of ordinary stack (pop everything and push it twice)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "stack.h"
+#include "stack_alloc.h"
+#include "stack_persist.h"
+
+/// @brief Depth of tree of choices (2^TREE_DEPTH leaves)
+static const int TREE_DEPTH = 14;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static long long DfsFork(size_t state, int depth)
+{
+    StackElem_t value = 0;
+
+    // Leaf looks at the last choices only
+    if (depth == TREE_DEPTH)
+    {
+        long long sum = 0;
+        for (int i = 0; i < TREE_DEPTH && StackPersistPop(state, &value) == STK_NO_ERROR; i++)
+            sum += value;
+        return sum;
+    }
+
+    long long sum = 0;
+    for (StackElem_t choice = 0; choice < 2; choice++)
+    {
+        size_t child = 0;
+        StackFork(state, &child);
+        StackPersistPush(child, choice + depth);
+        sum += DfsFork(child, depth + 1);
+        StackPersistDtor(&child);
+    }
+
+    return sum;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void CopyStack(size_t src, size_t dst, std::vector<StackElem_t>* buffer)
+{
+    StackElem_t value = 0;
+    buffer->clear();
+    while (StackPop(src, &value) == STK_NO_ERROR)
+        buffer->push_back(value);
+
+    for (size_t i = buffer->size(); i > 0; i--)
+    {
+        StackPush(src, (*buffer)[i - 1]);
+        StackPush(dst, (*buffer)[i - 1]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static long long DfsCopy(size_t state, int depth, const StackConfig* config, std::vector<StackElem_t>* buffer)
+{
+    StackElem_t value = 0;
+
+    if (depth == TREE_DEPTH)
+    {
+        long long sum = 0;
+        for (int i = 0; i < TREE_DEPTH && StackPop(state, &value) == STK_NO_ERROR; i++)
+            sum += value;
+        return sum;
+    }
+
+    long long sum = 0;
+    for (StackElem_t choice = 0; choice < 2; choice++)
+    {
+        size_t child = 0;
+        CREATE_STACK_EX(&child, config);
+        CopyStack(state, child, buffer);
+        StackPush(child, choice + depth);
+        sum += DfsCopy(child, depth + 1, config, buffer);
+        StackDtor(&child);
+    }
+
+    return sum;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void Run(bool fork, size_t base_size, StackProtection protection)
+{
+    StackConfig config = StackDefaultConfig();
+    config.protection = protection;
+    config.allocator = StackPoolAllocator();
+
+    double start = NowSec();
+    long long result = 0;
+
+    if (fork)
+    {
+        size_t state = 0;
+        StackPersistInit(&state, &config);
+        for (size_t i = 0; i < base_size; i++)
+            StackPersistPush(state, (StackElem_t) i);
+
+        result = DfsFork(state, 0);
+        StackPersistDtor(&state);
+    }
+    else
+    {
+        std::vector<StackElem_t> buffer;
+        size_t state = 0;
+        CREATE_STACK_EX(&state, &config);
+        for (size_t i = 0; i < base_size; i++)
+            StackPush(state, (StackElem_t) i);
+
+        result = DfsCopy(state, 0, &config, &buffer);
+        StackDtor(&state);
+    }
+
+    double elapsed = NowSec() - start;
+
+    printf("%-5s base=%-6zu protection=%d %8.3f s  %10.0f forks/s  (result %lld)\n", fork ? "fork" : "copy",
+           base_size, (int) protection, elapsed, (double) ((2ll << TREE_DEPTH) - 2) / elapsed, result);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    size_t max_base_size = argc > 1 ? (size_t) atoll(argv[1]) : 100;
+
+    for (size_t base_size = 10; base_size <= max_base_size; base_size *= 10)
+    {
+        for (StackProtection protection : {STK_PROTECT_NONE, STK_PROTECT_FULL})
+        {
+            Run(false, base_size, protection);
+            Run(true,  base_size, protection);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,401 @@
+/*!
+    \file
+    Benchmark of C stack for one build mode: throughput, latency percentiles and peak RSS of several
+    workloads. It is compiled once for every combination of NDEBUG, NCANARIES_MODE and NHASH_MODE
+    (see stack_bench target), every result is printed as one JSON line. Median overhead of the timer is
+    subtracted from latencies
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+#include "stack.h"
+
+/// @brief Workloads that are measured
+enum BenchWorkload
+{
+    BENCH_PUSH_ONLY   = 0,
+    BENCH_POP_ONLY    = 1,
+    BENCH_OSCILLATE   = 2,
+    BENCH_RANDOM_MIX  = 3,
+    BENCH_MANY_SMALL  = 4,
+};
+
+/// @brief Names of workloads (indexed by BenchWorkload)
+static const char* const WORKLOAD_NAMES[] = {"push_only", "pop_only", "oscillate", "random_mix", "many_small"};
+
+/// @brief Number of workloads
+static const int NUMBER_OF_WORKLOADS = sizeof(WORKLOAD_NAMES) / sizeof(WORKLOAD_NAMES[0]);
+
+/// @brief Number of measured operations of every workload
+static const long long OPS_PER_WORKLOAD = 1 << 22;
+
+/// @brief Number of elements that oscillating workload keeps (capacity of stack is equal to it,
+///        so every other push crosses the boundary where stack grows)
+static const long long OSCILLATE_BASE = 1 << 16;
+
+/// @brief Number of stacks that live at the same time in many_small workload
+static const int SMALL_STACKS = 1024;
+
+/// @brief Maximum number of elements in one small stack
+static const int MAX_SMALL_ELEMS = 16;
+
+/// @brief Number of empty measurements that overhead of timer is found from
+static const int TIMER_SAMPLES = 10001;
+
+#ifndef NDEBUG
+    #define BENCH_DEBUG_NAME_ "debug"
+#else
+    #define BENCH_DEBUG_NAME_ "release"
+#endif
+
+#ifndef NCANARIES_MODE
+    #define BENCH_CANARIES_NAME_ "+canaries"
+#else
+    #define BENCH_CANARIES_NAME_ ""
+#endif
+
+#ifndef NHASH_MODE
+    #define BENCH_HASH_NAME_ "+hash"
+#else
+    #define BENCH_HASH_NAME_ ""
+#endif
+
+/// @brief Name of build mode this benchmark is compiled in
+static const char* const VARIANT_NAME = BENCH_DEBUG_NAME_ BENCH_CANARIES_NAME_ BENCH_HASH_NAME_;
+
+/// @brief State of one measurement
+struct BenchRun
+{
+    StackProtection protection;
+    unsigned int* samples;       ///< Ticks of every operation (NULL if operations are not timed one by one)
+    long long ops;
+    unsigned int errors;
+    unsigned int seed;
+};
+
+/// @brief Runs stack operation, counts it and its errors and saves its duration if it is needed
+#define BENCH_OP_(run, op)                                                                          \
+    do                                                                                              \
+    {                                                                                               \
+        if ((run)->samples != NULL)                                                                 \
+        {                                                                                           \
+            unsigned long long start_ticks_ = BenchTicks();                                         \
+            (run)->errors |= (op);                                                                  \
+            unsigned long long op_ticks_ = BenchTicks() - start_ticks_;                             \
+            (run)->samples[(run)->ops] = op_ticks_ < UINT_MAX ? (unsigned int) op_ticks_            \
+                                                              : UINT_MAX;                           \
+        }                                                                                           \
+        else                                                                                        \
+            (run)->errors |= (op);                                                                  \
+        (run)->ops++;                                                                               \
+    } while(0)
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline unsigned long long BenchTicks()
+{
+    #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+    #else
+        timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (unsigned long long) now.tv_sec * 1000000000ull + (unsigned long long) now.tv_nsec;
+    #endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NsPerTick()
+{
+    double start = NowSec();
+    unsigned long long start_ticks = BenchTicks();
+    while (NowSec() - start < 0.05)
+        ;
+
+    return (NowSec() - start) * 1E9 / (double) (BenchTicks() - start_ticks);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double TimerOverheadTicks()
+{
+    static unsigned int samples[TIMER_SAMPLES] = {};
+    for (int i = 0; i < TIMER_SAMPLES; i++)
+    {
+        unsigned long long start_ticks = BenchTicks();
+        samples[i] = (unsigned int) (BenchTicks() - start_ticks);
+    }
+
+    std::nth_element(samples, samples + TIMER_SAMPLES / 2, samples + TIMER_SAMPLES);
+    return samples[TIMER_SAMPLES / 2];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t BenchCreateStack(BenchRun* run)
+{
+    StackConfig config = StackDefaultConfig();
+    config.protection = run->protection;
+
+    size_t stk = 0;
+    run->errors |= CREATE_STACK_EX(&stk, &config);
+
+    return stk;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void WorkloadPushOnly(BenchRun* run)
+{
+    size_t stk = BenchCreateStack(run);
+
+    for (long long i = 0; i < OPS_PER_WORKLOAD; i++)
+        BENCH_OP_(run, StackPush(stk, i));
+
+    run->errors |= StackDtor(&stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void WorkloadPopOnly(BenchRun* run)
+{
+    size_t stk = BenchCreateStack(run);
+    StackElem_t value = 0;
+
+    for (long long i = 0; i < OPS_PER_WORKLOAD; i++)
+        run->errors |= StackPush(stk, i);
+
+    for (long long i = 0; i < OPS_PER_WORKLOAD; i++)
+        BENCH_OP_(run, StackPop(stk, &value));
+
+    run->errors |= StackDtor(&stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void WorkloadOscillate(BenchRun* run)
+{
+    size_t stk = BenchCreateStack(run);
+    StackElem_t value = 0;
+
+    for (long long i = 0; i < OSCILLATE_BASE; i++)
+        run->errors |= StackPush(stk, i);
+
+    for (long long i = 0; i < OPS_PER_WORKLOAD / 2; i++)
+    {
+        BENCH_OP_(run, StackPush(stk, i));
+        BENCH_OP_(run, StackPop(stk, &value));
+    }
+
+    run->errors |= StackDtor(&stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void WorkloadRandomMix(BenchRun* run)
+{
+    size_t stk = BenchCreateStack(run);
+    StackElem_t value = 0;
+    long long size = 0;
+
+    for (long long i = 0; i < OPS_PER_WORKLOAD; i++)
+    {
+        if (size == 0 || rand_r(&run->seed) % 2 == 0)
+        {
+            BENCH_OP_(run, StackPush(stk, i));
+            size++;
+        }
+        else
+        {
+            BENCH_OP_(run, StackPop(stk, &value));
+            size--;
+        }
+    }
+
+    run->errors |= StackDtor(&stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void WorkloadManySmall(BenchRun* run)
+{
+    size_t stacks[SMALL_STACKS] = {};
+    int sizes[SMALL_STACKS] = {};
+    StackElem_t value = 0;
+
+    StackConfig config = StackDefaultConfig();
+    config.protection = run->protection;
+
+    while (run->ops < OPS_PER_WORKLOAD - SMALL_STACKS * (MAX_SMALL_ELEMS * 2 + 2))
+    {
+        for (int i = 0; i < SMALL_STACKS; i++)
+        {
+            stacks[i] = 0;
+            BENCH_OP_(run, CREATE_STACK_EX(&stacks[i], &config));
+        }
+
+        for (int i = 0; i < SMALL_STACKS; i++)
+        {
+            sizes[i] = rand_r(&run->seed) % (MAX_SMALL_ELEMS + 1);
+            for (int j = 0; j < sizes[i]; j++)
+                BENCH_OP_(run, StackPush(stacks[i], j));
+        }
+
+        for (int i = 0; i < SMALL_STACKS; i++)
+        {
+            for (int j = 0; j < sizes[i]; j++)
+                BENCH_OP_(run, StackPop(stacks[i], &value));
+
+            BENCH_OP_(run, StackDtor(&stacks[i]));
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void RunWorkload(BenchWorkload workload, BenchRun* run)
+{
+    switch (workload)
+    {
+        case BENCH_PUSH_ONLY:   WorkloadPushOnly (run); break;
+        case BENCH_POP_ONLY:    WorkloadPopOnly  (run); break;
+        case BENCH_OSCILLATE:   WorkloadOscillate(run); break;
+        case BENCH_RANDOM_MIX:  WorkloadRandomMix(run); break;
+        case BENCH_MANY_SMALL:
+        default:                WorkloadManySmall(run); break;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double Percentile(unsigned int* samples, long long number_of_samples, double fraction, double overhead)
+{
+    long long position = (long long) (fraction * (double) (number_of_samples - 1));
+    std::nth_element(samples, samples + position, samples + number_of_samples);
+
+    return samples[position] > overhead ? samples[position] - overhead : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void MeasureWorkload(BenchWorkload workload, StackProtection protection, FILE* out)
+{
+    // Throughput is measured without timers around every operation, peak RSS is taken before
+    // array of samples is allocated
+    BenchRun run = {protection, NULL, 0, 0, 1};
+
+    double start = NowSec();
+    RunWorkload(workload, &run);
+    double elapsed = NowSec() - start;
+
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+
+    long long number_of_ops = run.ops;
+    unsigned int* samples = (unsigned int*) calloc((size_t) number_of_ops, sizeof(unsigned int));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "stack_bench: not enough memory for samples\n");
+        return;
+    }
+
+    double ns_per_tick = NsPerTick();
+    double overhead = TimerOverheadTicks();
+
+    run = {protection, samples, 0, run.errors, 1};
+    RunWorkload(workload, &run);
+
+    fprintf(out, "{\"variant\": \"%s\", \"ndebug\": %d, \"ncanaries\": %d, \"nhash\": %d, \"protection\": %d, "
+                 "\"workload\": \"%s\", \"ops\": %lld, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+                 "\"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, \"timer_overhead_ns\": %.1f, "
+                 "\"peak_rss_kb\": %ld, \"errors\": %u}\n",
+            VARIANT_NAME,
+            #ifdef NDEBUG
+                1,
+            #else
+                0,
+            #endif
+            #ifdef NCANARIES_MODE
+                1,
+            #else
+                0,
+            #endif
+            #ifdef NHASH_MODE
+                1,
+            #else
+                0,
+            #endif
+            (int) protection, WORKLOAD_NAMES[workload], number_of_ops, elapsed, (double) number_of_ops / elapsed,
+            Percentile(samples, number_of_ops, 0.5,   overhead) * ns_per_tick,
+            Percentile(samples, number_of_ops, 0.99,  overhead) * ns_per_tick,
+            Percentile(samples, number_of_ops, 0.999, overhead) * ns_per_tick,
+            overhead * ns_per_tick, usage.ru_maxrss, run.errors);
+
+    free(samples);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    // Usage: stack_bench_<variant> [file that results are appended to] [protection levels, e.g. "034"]
+    FILE* out = argc > 1 ? fopen(argv[1], "a") : stdout;
+    if (out == NULL)
+    {
+        perror("stack_bench");
+        return 1;
+    }
+
+    const char* protections = argc > 2 ? argv[2] : "034";
+
+    for (const char* level = protections; *level >= '0' + STK_PROTECT_NONE && *level <= '0' + STK_PROTECT_SCRUBBED;
+         level++)
+        for (int workload = 0; workload < NUMBER_OF_WORKLOADS; workload++)
+        {
+            // Every workload is run in its own process, so peak RSS of each one is measured separately
+            fflush(out);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                // Scrubbed stacks are measured with the scrubber running at its default CPU budget
+                StackProtection protection = (StackProtection) (*level - '0');
+                if (protection == STK_PROTECT_SCRUBBED)
+                {
+                    StackScrubConfig scrub_config = StackScrubDefaultConfig();
+                    StackScrubStart(&scrub_config);
+                }
+
+                MeasureWorkload((BenchWorkload) workload, protection, out);
+                fflush(out);
+                _exit(0);
+            }
+
+            waitpid(pid, NULL, 0);
+        }
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
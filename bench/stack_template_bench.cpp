@@ -0,0 +1,171 @@
+/*!
+    \file
+    Benchmark of templated stack with different policies against plain array and C stack
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+#include "stack.h"
+#include "stack_template.h"
+
+/// @brief Number of elements pushed (and then popped) in one round
+static const long long ELEMS_PER_ROUND = 1 << 20;
+
+/// @brief Number of rounds
+static const int NUMBER_OF_ROUNDS = 20;
+
+/// @brief Number of elements that are put before timing, so stacks don't shrink (and don't page-fault) between rounds
+static const long long BASE_ELEMS = ELEMS_PER_ROUND;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static double NowSec()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void PrintResult(const char* name, double elapsed, long long checksum)
+{
+    double ops = 2.0 * ELEMS_PER_ROUND * NUMBER_OF_ROUNDS;
+    printf("%-22s %8.2f Mops/s  %6.2f ns/op  (checksum %lld)\n", name, ops / elapsed / 1E6, elapsed / ops * 1E9, checksum);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void BenchRawArray()
+{
+    long long* data = (long long*) malloc((BASE_ELEMS + ELEMS_PER_ROUND) * sizeof(long long));
+    long long checksum = 0;
+
+    for (long long i = 0; i < BASE_ELEMS; i++)
+        data[i] = i;
+
+    double start = NowSec();
+    for (int round = 0; round < NUMBER_OF_ROUNDS; round++)
+    {
+        long long index = BASE_ELEMS;
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+            data[index++] = i;
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+            checksum += data[--index];
+    }
+    PrintResult("raw array", NowSec() - start, checksum);
+
+    free(data);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void BenchVector()
+{
+    std::vector<long long> vec;
+    long long checksum = 0;
+
+    for (long long i = 0; i < BASE_ELEMS; i++)
+        vec.push_back(i);
+
+    double start = NowSec();
+    for (int round = 0; round < NUMBER_OF_ROUNDS; round++)
+    {
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+            vec.push_back(i);
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+        {
+            checksum += vec.back();
+            vec.pop_back();
+        }
+    }
+    PrintResult("std::vector", NowSec() - start, checksum);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+template <typename Policy>
+static void BenchTemplate(const char* name)
+{
+    Stack<long long, Policy> stk;
+    long long checksum = 0, value = 0;
+
+    for (long long i = 0; i < BASE_ELEMS; i++)
+        stk.Push(i);
+
+    double start = NowSec();
+    for (int round = 0; round < NUMBER_OF_ROUNDS; round++)
+    {
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+            stk.Push(i);
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+        {
+            stk.Pop(&value);
+            checksum += value;
+        }
+    }
+    PrintResult(name, NowSec() - start, checksum);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+template <bool IsInline>
+static void BenchCStack(StackProtection protection, const char* name)
+{
+    StackConfig config = StackDefaultConfig();
+    config.protection = protection;
+
+    size_t stk = 0;
+    if (CREATE_STACK_EX(&stk, &config) != STK_NO_ERROR)
+        return;
+
+    long long checksum = 0;
+    StackElem_t value = 0;
+
+    for (long long i = 0; i < BASE_ELEMS; i++)
+        StackPush(stk, i);
+
+    double start = NowSec();
+    for (int round = 0; round < NUMBER_OF_ROUNDS; round++)
+    {
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+        {
+            if (IsInline)
+                StackPushInline(stk, i);
+            else
+                StackPush(stk, i);
+        }
+        for (long long i = 0; i < ELEMS_PER_ROUND; i++)
+        {
+            if (IsInline)
+                StackPopInline(stk, &value);
+            else
+                StackPop(stk, &value);
+            checksum += value;
+        }
+    }
+    PrintResult(name, NowSec() - start, checksum);
+
+    StackDtor(&stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main()
+{
+    BenchRawArray();
+    BenchVector();
+    BenchTemplate<StackPolicyNone>    ("Stack<None>");
+    BenchTemplate<StackPolicyCanaries>("Stack<Canaries>");
+    BenchTemplate<StackPolicyFull>    ("Stack<Full>");
+    BenchCStack<false>(STK_PROTECT_NONE, "C stack (none)");
+    BenchCStack<true> (STK_PROTECT_NONE, "C stack (none, inline)");
+    BenchCStack<false>(STK_PROTECT_FULL, "C stack (full)");
+    BenchCStack<true> (STK_PROTECT_FULL, "C stack (full, inline)");
+
+    return 0;
+}
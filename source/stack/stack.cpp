@@ -1,30 +1,123 @@
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
 
 #include "stack.h"
+#include "stack_alloc.h"
+#include "stack_guard.h"
 #include "stack_utils.h"
 
 /// @brief Type of canaries on the stack sides
 typedef uint64_t canary_t;
 
-/// @brief Key to find real pointer using XOR
-static size_t key_for_ptr_dec = 0;
+/// @brief Type of indexes and capacities of stack (signed, so negative values of corrupted stack can be found)
+typedef long long stk_index_t;
+
+/// @brief Handle table of all stacks (it is in zeroed memory, so pages are given by system as slots are taken)
+StackHandleSlot stk_handle_slots[STACK_MAX_HANDLES];
+
+/// @brief Lock of free list of handle table (slots are read without it)
+static std::mutex stk_handle_mutex;
+
+/// @brief The first free slot of handle table + 1 (0 if there is no freed slot)
+static size_t stk_handle_free_head = 0;
+
+/// @brief Number of slots of handle table that were ever taken
+static size_t stk_handle_used = 0;
+
+#ifndef NSTATS_MODE
+    /// @brief The first of live stacks (their statistics are summed by StackGetGlobalStats)
+    static struct stack_t* live_stacks = NULL;
+
+    /// @brief Lock of the list of live stacks
+    static std::mutex live_stacks_mutex;
+#endif
+
+/// @brief The first of stacks with STK_PROTECT_SCRUBBED
+static struct stack_t* scrub_stacks = NULL;
+
+/// @brief Stack that scrubber goes to next (it is moved to the next one when this one is destructed)
+static struct stack_t* scrub_cursor = NULL;
+
+/// @brief Lock of the list of scrubbed stacks and its cursor
+static std::mutex scrub_stacks_mutex;
+
+/// @brief Stack whose memory scrubber reads now (its owner waits for scrubber before that memory is freed)
+static std::atomic<const struct stack_t*> scrub_target(NULL);
+
+/// @brief Lock that makes passes of scrubber thread and StackScrubNow go one by one
+static std::mutex scrub_pass_mutex;
+
+/// @brief Lock that makes StackScrubStart and StackScrubStop go one by one
+static std::mutex scrub_control_mutex;
+
+/// @brief Lock of sleep of scrubber thread
+static std::mutex scrub_thread_mutex;
+
+/// @brief Wakes scrubber thread when it should stop
+static std::condition_variable scrub_thread_wakeup;
+
+/// @brief State of scrubber thread
+static bool scrub_thread_running = false;
+static std::atomic<bool> scrub_thread_stop(false);
+static pthread_t scrub_thread;
+static StackScrubConfig scrub_thread_config;
 
 //----------------------------------------------------------------------------------------------------------------------
 
 /// @brief Default number of elements that can be put to stack
 static const size_t DEFAULT_STK_CAPACITY = 8;
 
-/// @brief Maximum length of string that is used to make dump beautiful
-static const int MAX_TEMP_DUMP_STR_LEN = 29;
+/// @brief Size of buffer that dump is written through
+static const size_t STK_DUMP_BUF_SIZE = (size_t) 1 << 16;
+
+/// @brief Maximum number of characters in number made by StackFormatNum
+static const size_t STK_NUM_TEXT_SIZE = sizeof("-9223372036854775808") - 1;
+
+/// @brief Width of index column of text dump
+static const size_t STK_DUMP_INDEX_WIDTH = 12;
+
+/// @brief Default coefficeint for upsizing stack
+static const double DEFAULT_GROWTH_FACTOR    = 2;
 
-/// @brief Coefficeint for upsizing stack
-static const int RESIZE_COEF      = 2;
+/// @brief Default ratio of capacity and number of elements when stack is downsized
+static const double DEFAULT_SHRINK_THRESHOLD = DEFAULT_GROWTH_FACTOR * 2;
 
-/// @brief Coefficient that sets ratio of minimum and maximum number of elements (except default capacity)
-static const int RESIZE_COEF_DOWN = RESIZE_COEF * 2;
+/// @brief Number of elements in one segment of segmented stack (segment with its header
+///        is 16 bytes larger than 32KB, so it fits one size class of pool allocator)
+static const size_t STK_SEGMENT_CAPACITY = 4094;
+
+/// @brief Number of elements that data hash takes by one block of hash algorithm (elements above the last
+///        full chunk are hashed one by one, so push and pop change hash of one element or one chunk)
+static const stk_index_t STK_HASH_CHUNK_CAPACITY = 16;
+
+/// @brief Default number of elements that address space of virtual stack is reserved for (32 GB)
+static const size_t DEFAULT_VIRTUAL_CAPACITY = (size_t) 1 << 32;
+
+/// @brief Size of transparent huge page (virtual stack is aligned by it and grows by such steps)
+static const size_t HUGE_PAGE_SIZE = (size_t) 2 << 20;
 
 /// @brief Canary value for securing stack structure
 static const canary_t STACK_CANARY_VALUE = 0xBAD57ACCBAD57ACC;
@@ -35,6 +128,70 @@ static const canary_t DATA_CANARY_VALUE  = 0xBADDA7A0BADDA7A0;
 /// @brief Size of all canaries
 static const size_t SIZE_OF_CANARY       = sizeof(canary_t);
 
+/// @brief Maximum capacity of any stack (size of data block with canaries fits ptrdiff_t)
+static const stk_index_t MAX_STK_CAPACITY = (stk_index_t) ((PTRDIFF_MAX - 2*SIZE_OF_CANARY) / sizeof(StackElem_t));
+
+/// @brief First bytes of stack file ("TOXSTACK")
+static const uint64_t STK_FILE_MAGIC   = 0x4B43415453584F54;
+
+/// @brief Version of stack file format
+static const uint32_t STK_FILE_VERSION = 2;
+
+/// @brief First bytes of stack snapshot ("TOXSNAPS")
+static const uint64_t STK_SNAPSHOT_MAGIC   = 0x5350414E53584F54;
+
+/// @brief Version of stack snapshot format
+static const uint32_t STK_SNAPSHOT_VERSION = 2;
+
+/// @brief Number of elements that are written or read by one system call (chunks of file stacks
+///        are given back to system after that, so snapshots can be larger than RAM)
+static const stk_index_t STK_SNAPSHOT_CHUNK_CAPACITY = (stk_index_t) 1 << 23;
+
+/// @brief Maximum number of buffers in one writev of snapshot (segments of segmented stack are gathered)
+static const size_t STK_SNAPSHOT_IOV_COUNT = 64;
+
+/// @brief Number of lower segments that one walk from the top segment finds when blocks of stack are iterated
+///        without memory for all of them
+static const size_t STK_BLOCKS_WINDOW = 256;
+
+/// @brief Default number of operations between full verifications (for STK_PROTECT_SAMPLED)
+static const unsigned int DEFAULT_VERIFY_PERIOD = 64;
+
+/// @brief Number of marks that place is allocated for by the first StackMark
+static const size_t DEFAULT_MARKS_CAPACITY = 16;
+
+/// @brief Maximum number of operands of stack machine operation (StackRot has 3)
+static const size_t STK_MACHINE_MAX_ARGS = 3;
+
+/// @brief Number of bits in element minus one (the biggest shift of StackBinaryOp)
+static const StackElem_t STK_ELEM_MAX_SHIFT = (StackElem_t) (sizeof(StackElem_t) * CHAR_BIT - 1);
+
+/// @brief Default pause between passes of scrubber (in milliseconds)
+static const unsigned int DEFAULT_SCRUB_INTERVAL_MS = 100;
+
+/// @brief Default part of one CPU that scrubber takes
+static const double DEFAULT_SCRUB_CPU_BUDGET = 0.05;
+
+/// @brief Default number of passes between rehashes of elements of unchanged stacks
+static const unsigned int DEFAULT_SCRUB_CLEAN_PERIOD = 16;
+
+/// @brief Default number of the top elements in dump of scrubber report
+static const size_t DEFAULT_SCRUB_DUMP_TOP_K = 16;
+
+/// @brief Number of elements that scrubber hashes between checks that stack was not changed
+static const stk_index_t SCRUB_CHUNK_CAPACITY = (stk_index_t) 1 << 14;
+
+/// @brief Time that scrubber works before it sleeps to keep its CPU budget (in seconds)
+static const double SCRUB_SLICE_TIME = 1E-3;
+
+#ifndef NDEBUG
+    /// @brief Protection level of stacks that are created without config
+    static const StackProtection DEFAULT_PROTECTION = STK_PROTECT_FULL;
+#else
+    /// @brief Protection level of stacks that are created without config
+    static const StackProtection DEFAULT_PROTECTION = STK_PROTECT_NONE;
+#endif
+
 //----------------------------------------------------------------------------------------------------------------------
 
 #ifndef NCANARIES_MODE
@@ -49,21 +206,145 @@ static const size_t SIZE_OF_CANARY       = sizeof(canary_t);
     /// @brief Sets up hash in stack structure or not depending on hash mode
     #define HASH_SET_UP(...) __VA_ARGS__
 
-    /// @brief Checks stack hash or not depending on debug mode
-    #define STACK_HASH(stk) StackHash(stk)
+    /// @brief Recalculates stack structure hash or not depending on hash mode and stack protection level
+    #define STACK_HASH(stk)                                                      \
+        do {                                                                     \
+            if (StackVerifiesHash(stk))                                          \
+                StackHashStruct(stk);                                            \
+        } while(0)
 #else
     /// @brief Sets up hash in stack structure depending on hash mode
     #define HASH_SET_UP(...)
 
-    /// @brief Checks stack hash or not depending on debug mode
+    /// @brief Recalculates stack structure hash or not depending on hash mode
     #define STACK_HASH(stk)
 #endif
 
+#ifndef NSTATS_MODE
+    /// @brief Sets up statistics of stack or not depending on statistics mode
+    #define STATS_SET_UP(...) __VA_ARGS__
+#else
+    /// @brief Sets up statistics of stack or not depending on statistics mode
+    #define STATS_SET_UP(...)
+#endif
+
+/// @brief Beginning of stack file (elements follow it, data canary follows them).
+///        Format doesn't depend on build: canaries are always written, hashes don't depend on CPU
+struct stack_file_header_t
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    int64_t  index;
+    int64_t  capacity;
+    uint64_t hash_data;
+    uint64_t hash_header;
+    uint64_t reserved;
+    canary_t left_canary;
+};
+
+static_assert(sizeof(stack_file_header_t) == 64, "Elements of stack file must be aligned by cache line");
+
+/// @brief Beginning of stack snapshot (elements follow it from the bottom one).
+///        Format doesn't depend on build, hashes don't depend on CPU
+struct stack_snapshot_header_t
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    int64_t  number_of_elems;
+    int64_t  capacity;
+    uint64_t hash_data;        ///< The same as data hash of contiguous stack with these elements
+    uint64_t hash_header;
+};
+
+/// @brief Data hash of elements that are taken by pieces (piece doesn't have to end on boundary of chunk)
+struct stack_hash_stream_t
+{
+    unsigned long hash;
+    stk_index_t   position;                        ///< Position of the first element of tail
+    stk_index_t   tail_size;
+    StackElem_t   tail[STK_HASH_CHUNK_CAPACITY];   ///< Elements of the last chunk that is not full yet
+};
+
+/// @brief Buffer that dump is written through (it is kept on the thread stack, so dump works without memory)
+struct stack_dump_buf_t
+{
+    int                     fd;
+    const StackDumpOptions* options;
+    bool                    is_first_run;  ///< No run was written yet (JSON needs commas between runs)
+    bool                    failed;        ///< Write failed, the rest of dump is dropped
+    size_t                  size;
+    char                    data[STK_DUMP_BUF_SIZE];
+};
+
+/// @brief Text that is made in fixed buffer without library formatting (report of SIGSEGV handler),
+///        text that doesn't fit is dropped
+struct stack_text_buf_t
+{
+    char*  data;
+    size_t capacity;
+    size_t size;
+};
+
+/// @brief State of one pass of scrubber over all scrubbed stacks
+struct stack_scrub_pass_t
+{
+    const StackScrubConfig* config;
+    bool                    is_background;  ///< Pass is done by scrubber thread (it stops when thread is stopped)
+    double                  slice_start;    ///< Time when scrubber woke up last time
+    unsigned int            found;          ///< Errors of all stacks of the pass
+
+    // Report of the last scrubbed stack, it is given to callback after scrubber leaves the stack
+    bool                    is_reported;
+    bool                    is_dumped;
+    size_t                  report_handle;
+    unsigned int            report_err;
+};
+
+/// @brief Mark of stack depth
+struct stack_mark_t
+{
+    size_t depth;
+    unsigned long long serial;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Fixed-size block of elements of segmented stack
+struct stack_segment_t
+{
+    stack_segment_t* prev;
+
+    // Hash of elements is saved here when segment stops being the top one
+    HASH_SET_UP(unsigned long hash_data);
+
+    CANARIES_SET_UP(canary_t left_canary);
+    StackElem_t data[STK_SEGMENT_CAPACITY];
+    CANARIES_SET_UP(canary_t right_canary);
+};
+
+#ifndef NCANARIES_MODE
+    static_assert(offsetof(stack_segment_t, data) == offsetof(stack_segment_t, left_canary) + SIZE_OF_CANARY &&
+                  offsetof(stack_segment_t, right_canary) ==
+                  offsetof(stack_segment_t, data) + sizeof(stack_segment_t::data),
+                  "Canaries of segment must be right next to its elements");
+#endif
+
 /// @brief Sructure with stack info
 struct stack_t
 {
     CANARIES_SET_UP(canary_t left_canary);
 
+    // Inline functions of stack.h work with these fields as StackFastView
+    StackElem_t* data;
+    stk_index_t index;
+    stk_index_t push_limit;
+    stk_index_t pop_limit;
+    unsigned long long inline_pushes;
+    unsigned long long inline_pops;
+    unsigned long long high_water_mark;
+
     ON_DEBUG(const char* stk_name);
     ON_DEBUG(const char* init_file);
     ON_DEBUG(int init_line);
@@ -73,11 +354,114 @@ struct stack_t
     HASH_SET_UP(unsigned long hash_data);
 
     unsigned int code_errors;
-    StackElem_t* data;
-    int index;
-    int capacity;
+    stk_index_t capacity;
+
+    double growth_factor;
+    double shrink_threshold;
+    stk_index_t min_capacity;
+    stk_index_t reserved_capacity;
+    bool shrink_disabled;
+    stk_index_t shrink_index;
+
+    // Segmented stack keeps index and capacity of its top segment, data points to its elements
+    StackStorage storage;
+    stack_segment_t* top_segment;
+    stack_segment_t* spare_segment;
+    size_t lower_size;
+
+    int file_fd;
+    char* file_map;
+    size_t file_size;
+
+    // Virtual stack commits the beginning of reserved address range, data points right after left canary
+    char* vm_base;
+    size_t vm_reserved_size;
+    size_t vm_committed_size;
+    size_t vm_commit_step;
+
+    StackProtection protection;
+    unsigned int verify_period;
+    unsigned int ops_since_verify;
+
+    // STK_PROTECT_FULL rehashes one chunk of elements per operation, when all whole chunks are rehashed,
+    // their hash together with hashes of elements above them is compared with data hash
+    HASH_SET_UP(stk_index_t checked_size);
+    HASH_SET_UP(unsigned long checked_hash);
+
+    // Live marks have increasing depths, so only pops below depth of the top one (mark_depth, 0 if there
+    // are no marks) make marks invalid
+    stack_mark_t* marks;
+    size_t marks_count;
+    size_t marks_capacity;
+    unsigned long long marks_serial;
+    size_t mark_depth;
+    bool keep_discarded;
+
+    StackAllocator allocator;
 
     CANARIES_SET_UP(canary_t right_canary);
+
+    // Elements are kept here until the first StackResizeUp, so small stacks need only one allocation
+    CANARIES_SET_UP(canary_t small_left_canary);
+    StackElem_t small_data[DEFAULT_STK_CAPACITY];
+    CANARIES_SET_UP(canary_t small_right_canary);
+
+    // Not covered by hashes: handle is given after the first verification, statistics change on failed
+    // verifications, links are changed by other stacks
+    size_t handle;
+    STATS_SET_UP(StackStats stats);
+    STATS_SET_UP(stack_t* live_prev);
+    STATS_SET_UP(stack_t* live_next);
+
+    // Scrubber reads stack while its owner changes it: scrub_seq is odd while stack is being changed
+    // (seqlock, its half is dirty epoch of stack), the fields below it are changed by scrubber only
+    unsigned long long scrub_seq;
+    unsigned long long scrub_seen_seq;   ///< scrub_seq of the last finished scrub
+    HASH_SET_UP(unsigned long scrub_hash_struct);
+    bool scrub_is_seen;                  ///< Stack was scrubbed at least once
+    unsigned int scrub_clean_passes;     ///< Passes since elements were rehashed last time
+    unsigned int scrub_reported;         ///< Errors that were reported last time
+    stack_t* scrub_prev;
+    stack_t* scrub_next;
+};
+
+#ifndef NCANARIES_MODE
+    static_assert(offsetof(stack_t, small_data) == offsetof(stack_t, small_left_canary) + SIZE_OF_CANARY &&
+                  offsetof(stack_t, small_right_canary) == offsetof(stack_t, small_data) + sizeof(stack_t::small_data),
+                  "Canaries of inline data must be right next to it");
+#endif
+
+/// @brief Checks that field of stack structure is at the same place as field of StackFastView
+#define CHECK_FAST_VIEW_FIELD_(field)                                                                     \
+    static_assert(offsetof(stack_t, field) == STACK_FAST_VIEW_OFFSET + offsetof(StackFastView, field) &&  \
+                  sizeof(stack_t::field) == sizeof(StackFastView::field),                                 \
+                  "Stack structure must begin with StackFastView")
+
+CHECK_FAST_VIEW_FIELD_(data);
+CHECK_FAST_VIEW_FIELD_(index);
+CHECK_FAST_VIEW_FIELD_(push_limit);
+CHECK_FAST_VIEW_FIELD_(pop_limit);
+CHECK_FAST_VIEW_FIELD_(inline_pushes);
+CHECK_FAST_VIEW_FIELD_(inline_pops);
+CHECK_FAST_VIEW_FIELD_(high_water_mark);
+
+#undef CHECK_FAST_VIEW_FIELD_
+
+/// @brief Number of bytes of stack structure that are covered by structure hash (inline data is covered by data hash)
+static const size_t STK_STRUCT_HASHED_SIZE = offsetof(stack_t, small_data);
+
+/// @brief Iteration over blocks of elements from the bottom one (segments of segmented stack or one block).
+///        Segments are linked from the top, so lower segments are found by walks from it, a window at once
+struct stack_blocks_t
+{
+    const stack_t* stk;
+    size_t         number_of_blocks;
+    size_t         next_block;
+    StackElem_t**  window;              ///< Elements of lower segments window_first, window_first + 1, ...
+    size_t         window_capacity;
+    size_t         window_first;
+    size_t         window_count;
+    StackElem_t*   local_window[STK_BLOCKS_WINDOW];
 };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -91,7 +475,8 @@ struct stack_t
 static StackError StackHash      (stack_t* stk);
 
 /*! -----------------------------------------------------------------------------------------------------
-    Calculates stack data (elements) hash using DJB2-algorithm
+    Calculates stack data (elements) hash from scratch. Only elements in [0, index) are hashed,
+    push and pop update the hash themselves in O(1)
     \param[in, out]  stk  Pointer to stack sructure
     \return Type of stack error or 0 for "no error"-state
     ----------------------------------------------------------------------------------------------------- */
@@ -103,333 +488,4043 @@ static StackError StackHashData  (stack_t* stk);
     \return Type of stack error or 0 for "no error"-state
     ----------------------------------------------------------------------------------------------------- */
 static StackError StackHashStruct(stack_t* stk);
-#endif
 
 /*! -----------------------------------------------------------------------------------------------------
-    Calculates the real pointer to stack structure using XOR with key_for_decode
-    \param[in]  ptr_do_decode  Encoded (decoded) pointer to stack sructure
-    \return Decoded (encoded) pointer to stack structure
+    Takes elements that are going to be popped or overwritten out of data hash (they must still be in place)
+    \param[in, out]  stk   Pointer to stack sructure
+    \param[in]       from  Position of the first element
+    \param[in]       to    Position after the last element (top of stack)
     ----------------------------------------------------------------------------------------------------- */
-static size_t    StackPtrXOR    (size_t ptr_to_decode);
+static void StackHashDrop(stack_t* stk, stk_index_t from, stk_index_t to);
 
 /*! -----------------------------------------------------------------------------------------------------
-    Downsizes the stack
+    Starts rehashing of elements by StackVerifyDataStep from the bottom one
     \param[in, out]  stk  Pointer to stack sructure
-    \return Type of stack error or 0 for "no error"-state
     ----------------------------------------------------------------------------------------------------- */
-static StackError StackResizeDown(stack_t* stk);
+static void StackHashCheckRestart(stack_t* stk);
 
 /*! -----------------------------------------------------------------------------------------------------
-    Upsizes the stack
-    \param[in, out]  stk  Pointer to stack sructure
-    \return Type of stack error or 0 for "no error"-state
+    Checks whether hashes of the stack are maintained (depends on protection level)
+    \param[in]  stk  Pointer to stack sructure
+    \return True (if hashes are maintained), false (otherwise)
     ----------------------------------------------------------------------------------------------------- */
-static StackError StackResizeUp  (stack_t* stk);
+static inline bool StackUsesHash(const stack_t* stk)
+{
+    return stk->protection >= STK_PROTECT_SAMPLED;
+}
 
-/*!
-    Verifies all stack's sructure and data (elements)
+/*! -----------------------------------------------------------------------------------------------------
+    Checks whether hashes of the stack are verified by its operations (scrubbed stack has no structure
+    hash of its own, its hashes are verified by scrubber)
     \param[in]  stk  Pointer to stack sructure
-    \return Type of stack error or 0 for "no error"-state
-*/
-static StackError StackVerifyAll(stack_t* stk);
+    \return True (if hashes are verified by operations), false (otherwise)
+    ----------------------------------------------------------------------------------------------------- */
+static inline bool StackVerifiesHash(const stack_t* stk)
+{
+    return stk->protection == STK_PROTECT_SAMPLED || stk->protection == STK_PROTECT_FULL;
+}
 
-/*!
-    Verifies critical (the most important) parts of stack's sructure and data (elements)
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates stack structure hash without saving it
     \param[in]  stk  Pointer to stack sructure
-    \return Type of stack error or 0 for "no error"-state
-*/
-static StackError StackVerifyCritical(stack_t* stk);
+    \return Hash of structure
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackCalcStructHash(const stack_t* stk);
+#endif
 
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates hash of elements without saving it
+    \param[in]  data             Array of elements
+    \param[in]  number_of_elems  Number of elements
+    \return Hash of elements
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackCalcDataHash(const StackElem_t* data, stk_index_t number_of_elems);
 
-#ifndef NDEBUG
-    /// @brief Macro for verifying stack
-    #define STACK_VERIFY(stk)                                                    \
-        do                                                                       \
-        {                                                                        \
-            StackError temp_code_err = STK_NO_ERROR;                             \
-            if ((temp_code_err = StackVerifyAll(stk)) != STK_NO_ERROR)           \
-            {                                                                    \
-                if (temp_code_err >= STACK_ANTIOVERFLOW_ERR)                     \
-                    StackDump(StackPtrXOR((size_t) stk), __FILE__, __LINE__);    \
-                return temp_code_err;                                            \
-            }                                                                    \
-        } while(0)
-#else
-    /// @brief Macro for verifying stack
-    #define STACK_VERIFY(stk)                                                    \
-        do {                                                                     \
-            StackError temp_code_err = STK_NO_ERROR;                             \
-            if ((temp_code_err = StackVerifyAll(stk)) != STK_NO_ERROR)           \
-                return temp_code_err;                                            \
-        } while(0)
-#endif
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates how data hash changes when stack of <from> elements gets elements up to <to>
+    (hash of the first <to> elements minus hash of the first <from> ones)
+    \param[in]  data  Array of elements (element on position i is data[i])
+    \param[in]  from  Number of elements before change
+    \param[in]  to    Number of elements after change (not less than <from>)
+    \return Difference of hashes (differences of consecutive ranges sum up to hash of all elements)
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackCalcHashDelta(const StackElem_t* data, stk_index_t from, stk_index_t to);
 
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates sum of hashes of whole chunks of elements (chunk hash is mixed with number of chunk)
+    \param[in]  data              Pointer to the first element of the first chunk
+    \param[in]  number_of_chunks  Number of chunks
+    \param[in]  first_chunk       Number of the first chunk in stack
+    \return Sum of hashes of chunks
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackCalcChunksHash(const StackElem_t* data, stk_index_t number_of_chunks,
+                                         stk_index_t first_chunk);
 
-// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-//----------------------------------------------------------------------------------------------------------------
-// ------> !!! STACK PART !!! <-----------------------------------------------------------------------------
-//----------------------------------------------------------------------------------------------------------------
-// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates sum of hashes of elements that are hashed one by one (elements of chunk that is not full)
+    \param[in]  data             Pointer to the first element
+    \param[in]  number_of_elems  Number of elements
+    \param[in]  first_position   Position of the first element in stack
+    \return Sum of hashes of elements
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackCalcElemsHash(const StackElem_t* data, stk_index_t number_of_elems,
+                                        stk_index_t first_position);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Adds elements that follow already added ones to data hash (pieces may lie anywhere in memory)
+    \param[in]  stream           Hash of elements that were added before
+    \param[in]  data             Pointer to the first element of piece
+    \param[in]  number_of_elems  Number of elements in piece
+    ----------------------------------------------------------------------------------------------------- */
+static void StackHashStreamAdd(stack_hash_stream_t* stream, const StackElem_t* data, stk_index_t number_of_elems);
 
+/*! -----------------------------------------------------------------------------------------------------
+    Finishes hash of elements that were added to stream
+    \param[in]  stream  Hash of elements
+    \return The same hash as StackCalcDataHash gives for contiguous array of these elements
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackHashStreamEnd(const stack_hash_stream_t* stream);
 
-StackError StackDtor(size_t* stk_enc_ptr)
-{
-    stack_t* stk = (stack_t*) StackPtrXOR(*stk_enc_ptr);
+/*! -----------------------------------------------------------------------------------------------------
+    Finds stack structure by its handle in O(1) (memory of destructed stack is never read)
+    \param[in]  stk_enc_ptr  Handle of stack
+    \return Pointer to stack structure or NULL if handle is wrong or stack was destructed
+    ----------------------------------------------------------------------------------------------------- */
+static stack_t*  StackFromHandle(size_t stk_enc_ptr);
 
-    STACK_VERIFY(stk);
+/*! -----------------------------------------------------------------------------------------------------
+    Puts slot of handle table to free list (lock of handle table must be taken)
+    \param[in]  slot_idx  Index of slot
+    ----------------------------------------------------------------------------------------------------- */
+static void      StackHandleRelease(size_t slot_idx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Checks whether stack elements are kept inside stack structure
+    \param[in]  stk  Pointer to stack sructure
+    \return True (if data is inline), false (if it is on the heap)
+    ----------------------------------------------------------------------------------------------------- */
+static inline bool StackIsInline(const stack_t* stk)
+{
+    return stk->data == stk->small_data;
+}
 
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates size of heap block of stack data
+    \param[in]  capacity  Number of elements that can be put to stack
+    \return Size of block with data and its canaries
+    ----------------------------------------------------------------------------------------------------- */
+static inline size_t StackDataBlockSize(stk_index_t capacity)
+{
     #ifndef NCANARIES_MODE
-        free((char*) stk->data - SIZE_OF_CANARY); stk->data = NULL;
+        return capacity*sizeof(StackElem_t) + SIZE_OF_CANARY*2;
     #else
-        free(stk->data); stk->data = NULL;
+        return capacity*sizeof(StackElem_t);
     #endif
-    stk->index = 0;
-    stk->capacity = 0;
-    free(stk); stk = NULL;
-
-    *stk_enc_ptr = 0;
+}
 
-    return STK_NO_ERROR;
+/*! -----------------------------------------------------------------------------------------------------
+    Checks whether there are segments below the top one
+    \param[in]  stk  Pointer to stack sructure
+    \return True (if stack is segmented and has lower segments), false (otherwise)
+    ----------------------------------------------------------------------------------------------------- */
+static inline bool StackHasLowerSegment(const stack_t* stk)
+{
+    return stk->top_segment != NULL && stk->top_segment->prev != NULL;
 }
 
-//----------------------------------------------------------------------------------------------------------------------
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates number of elements in stack
+    \param[in]  stk  Pointer to stack sructure
+    \return Number of elements (including ones in lower segments)
+    ----------------------------------------------------------------------------------------------------- */
+static inline size_t StackSize(const stack_t* stk)
+{
+    return stk->lower_size + (size_t) stk->index;
+}
 
-#ifndef NHASH_MODE
-    static StackError StackHash(stack_t* stk)
-    {
-        StackError code_err = STK_NO_ERROR;
-        if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
-            return code_err;
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates capacity that stack is never downsized below (minimum of policy or reserved one)
+    \param[in]  stk  Pointer to stack sructure
+    \return Minimum capacity of stack
+    ----------------------------------------------------------------------------------------------------- */
+static inline stk_index_t StackCapacityFloor(const stack_t* stk)
+{
+    stk_index_t floor = DEFAULT_STK_CAPACITY;
+    if (stk->min_capacity > floor)
+        floor = stk->min_capacity;
+    if (stk->reserved_capacity > floor)
+        floor = stk->reserved_capacity;
 
-        if ((code_err = StackHashStruct(stk)) != STK_NO_ERROR)
-            return code_err;
+    // Guarded data takes whole pages, so its capacity is always rounded
+    if (stk->storage == STK_STORAGE_GUARDED)
+        floor = (stk_index_t) (StackGuardRoundSize((size_t) floor*sizeof(StackElem_t)) / sizeof(StackElem_t));
 
-        if ((code_err = StackHashData(stk)) != STK_NO_ERROR)
-            return code_err;
+    return floor;
+}
 
-        return code_err;
-    }
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates capacity that stack can never grow above
+    \param[in]  stk  Pointer to stack sructure
+    \return Maximum capacity of stack (virtual stack can't grow out of its reserved address space)
+    ----------------------------------------------------------------------------------------------------- */
+static inline stk_index_t StackMaxCapacity(const stack_t* stk)
+{
+    if (stk->storage == STK_STORAGE_VIRTUAL)
+        return (stk_index_t) ((stk->vm_reserved_size - 2*SIZE_OF_CANARY) / sizeof(StackElem_t));
 
-//----------------------------------------------------------------------------------------------------------------------
+    return MAX_STK_CAPACITY;
+}
 
-    static StackError StackHashData(stack_t* stk)
-    {
-        StackError code_err = STK_NO_ERROR;
-        if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
-            return code_err;
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates number of elements that stack with given capacity is downsized below
+    \param[in]  stk       Pointer to stack sructure
+    \param[in]  capacity  Capacity of stack
+    \return Index that stack is downsized below (0 if it is never downsized)
+    ----------------------------------------------------------------------------------------------------- */
+static stk_index_t StackCalcShrinkIndex(const stack_t* stk, stk_index_t capacity);
 
-        stk->hash_data = 0;
-        stk->hash_data = MyHash(stk->data, stk->capacity*sizeof(StackElem_t));
+/*! -----------------------------------------------------------------------------------------------------
+    Updates index that stack is downsized below and bounds of inline push and pop (see StackFastView),
+    must be called after every change of capacity
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackUpdateBounds(stack_t* stk);
 
-        return STK_NO_ERROR;
-    }
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates capacity that is enough for given number of elements using growth factor of stack
+    \param[in]  stk           Pointer to stack sructure
+    \param[in]  min_capacity  Number of elements that should fit in stack
+    \return New capacity (maximum capacity of stack at most)
+    ----------------------------------------------------------------------------------------------------- */
+static stk_index_t StackGrownCapacity(const stack_t* stk, stk_index_t min_capacity);
 
-//----------------------------------------------------------------------------------------------------------------------
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates capacity that stack should have after its index became less
+    \param[in]  stk        Pointer to stack sructure
+    \param[in]  new_index  New number of elements in stack
+    \return New capacity (current one if stack should not be downsized)
+    ----------------------------------------------------------------------------------------------------- */
+static stk_index_t StackShrunkCapacity(const stack_t* stk, stk_index_t new_index);
 
-    static StackError StackHashStruct(stack_t* stk)
-    {
-        StackError code_err = STK_NO_ERROR;
-        if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
-            return code_err;
+/*! -----------------------------------------------------------------------------------------------------
+    Frees heap block of stack data (inline data is not freed)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackFreeData(stack_t* stk);
 
-        stk->hash_struct = 0;
-        unsigned long temp_hash_data = stk->hash_data;
-        stk->hash_data = 0;
+/*! -----------------------------------------------------------------------------------------------------
+    Reallocates stack data to new capacity without any verification (zeroes new elements,
+    puts data canary to its new place and updates index that stack is downsized below)
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackRealloc   (stack_t* stk, stk_index_t new_capacity);
 
-        stk->hash_struct = MyHash(stk, sizeof(*stk));
-        stk->hash_data = temp_hash_data;
+/*! -----------------------------------------------------------------------------------------------------
+    Reallocates heap block (or inline data) of contiguous stack, see StackRealloc
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackHeapRealloc(stack_t* stk, stk_index_t new_capacity);
 
-        return STK_NO_ERROR;
-    }
-#endif
+/*! -----------------------------------------------------------------------------------------------------
+    Downsizes stack data after elements were already taken away, failure is not reported: stack keeps
+    its larger data as reserved by StackReserve (until StackShrinkToFit)
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackShrinkAfterPop(stack_t* stk, stk_index_t new_capacity);
 
-//----------------------------------------------------------------------------------------------------------------------
+/*! -----------------------------------------------------------------------------------------------------
+    Puts new (or spare) empty segment on top of segmented stack without any verification
+    (hash of the old top segment is saved in it)
+    \param[in, out]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackSegmentUp  (stack_t* stk);
 
-#ifndef NDEBUG
-    StackError StackInit(size_t* stk_enc_ptr, const char* stk_name, const char* stk_init_file,
-                         int stk_init_line, const char* stk_init_func)
-#else
-    StackError StackInit(size_t* stk_enc_ptr)
-#endif
-{
-    if (key_for_ptr_dec == 0)
-    {
-        if ((key_for_ptr_dec = MyGetRandom64()) == 0)
-            return CANT_CREATE_RAND_NUM_ERR;
-    }
+/*! -----------------------------------------------------------------------------------------------------
+    Makes the segment below the top one the top (the empty top segment is kept as spare),
+    lower segment is verified as protection level requires
+    \param[in, out]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackSegmentDown(stack_t* stk);
 
-    stack_t* stk = (stack_t*) calloc(1, sizeof(stack_t));
+/*! -----------------------------------------------------------------------------------------------------
+    Puts several values to segmented stack (new segments are linked when top one gets full)
+    \param[in, out]  stk              Pointer to stack sructure
+    \param[in]       values           Array of values that should be put to stack
+    \param[in]       number_of_elems  Number of values
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackSegmentPushN(stack_t* stk, const StackElem_t* values, size_t number_of_elems);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts several values from segmented stack (emptied segments are unlinked)
+    \param[in, out]  stk              Pointer to stack sructure
+    \param[out]      vars             Array where extracted values should be put (vars[0] is the top one)
+    \param[in]       number_of_elems  Number of values
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackSegmentPopN (stack_t* stk, StackElem_t* vars, size_t number_of_elems);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Discards elements of segmented stack above given depth (segments above it are unlinked without hashing)
+    \param[in, out]  stk    Pointer to stack sructure
+    \param[in]       depth  Number of elements that are kept
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackSegmentRewind(stack_t* stk, size_t depth);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Makes marks that are deeper than stack invalid, must be called after stack got less
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackMarksCut(stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reads operands of stack machine operation without changing stack (the lower ones can be in lower
+    segment of segmented stack)
+    \param[in, out]  stk             Pointer to stack sructure
+    \param[out]      args            Array where operands should be put (args[0] is the top one)
+    \param[in]       number_of_args  Number of operands (not more than STK_MACHINE_MAX_ARGS)
+    \return Type of stack error (STACK_ANTIOVERFLOW_ERR if stack has less elements) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackMachineArgs(stack_t* stk, StackElem_t* args, size_t number_of_args);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Replaces operands of stack machine operation with its results as pops of operands and pushes of
+    results would do: elements are rewritten in place, capacity is changed once at most, hash is updated
+    and stack is verified once (segment boundary is crossed by StackSegmentPopN and StackSegmentPushN).
+    Marks are cut by number of operands that are popped: bottom operands that operation keeps in their places
+    are neither rewritten nor popped, all the others are popped even if results are equal to them
+    \param[in, out]  stk                Pointer to stack sructure
+    \param[in]       number_of_args     Number of operands
+    \param[in]       number_of_kept     Number of bottom operands that stay in place (they must be the bottom
+                                        results too: 1 for StackDup, 2 for StackOver, 0 for the others)
+    \param[in]       results            New top elements (results[0] is the top one)
+    \param[in]       number_of_results  Number of results (not more than number_of_args + 1)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackMachineReplace(stack_t* stk, size_t number_of_args, size_t number_of_kept,
+                                      const StackElem_t* results, size_t number_of_results);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates built-in binary operation of stack machine
+    \param[in]   op      Operation
+    \param[in]   lhs     The second element from the top
+    \param[in]   rhs     The top element
+    \param[out]  result  Pointer to variable where result should be put
+    \return Type of stack error (STACK_BAD_OPERAND_ERR if operation is unknown or can't be done)
+            or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackCalcBinaryOp(StackBinaryOpKind op, StackElem_t lhs, StackElem_t rhs, StackElem_t* result);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Allocates stack structure and fills it using config (elements are kept inline)
+    \param[out]  stk_ptr      Pointer to new stack structure
+    \param[in]   stk_enc_ptr  Encoded pointer that will be given to user (must be 0)
+    \param[in]   config       Settings of the stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackCreate(stack_t** stk_ptr, size_t* stk_enc_ptr, const StackConfig* config
+                              ON_DEBUG(, const char* stk_name, const char* stk_init_file, int stk_init_line,
+                                       const char* stk_init_func));
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates size of stack file
+    \param[in]  capacity  Number of elements
+    \return Size of file with header, elements and data canary
+    ----------------------------------------------------------------------------------------------------- */
+static inline size_t StackFileSize(stk_index_t capacity)
+{
+    return sizeof(stack_file_header_t) + (size_t) capacity*sizeof(StackElem_t) + sizeof(canary_t);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Opens (or creates) stack file, maps it and takes index, capacity and data hash from its header
+    \param[in, out]  stk   Pointer to stack sructure
+    \param[in]       path  Path to file
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackFileOpen   (stack_t* stk, const char* path);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Changes size of stack file and its mapping without any verification
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackFileRealloc(stack_t* stk, stk_index_t new_capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes index, capacity and hashes to header of stack file (data hash is calculated if it isn't maintained)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackFileSyncHeader(stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Unmaps and closes stack file (header is not written)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackFileClose  (stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates hash of stack file header (all fields except hash_header)
+    \param[in]  header  Pointer to header
+    \return Hash of header
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackFileHeaderHash(const stack_file_header_t* header);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reserves address space of virtual stack without committing it (range is aligned by huge page)
+    \param[in, out]  stk       Pointer to stack sructure
+    \param[in]       capacity  Number of elements that should fit in reserved range (0 for default one)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackVirtualReserve(stack_t* stk, size_t capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Commits (or decommits and returns to system) pages of virtual stack for new capacity without
+    any verification (elements are never moved)
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackVirtualRealloc(stack_t* stk, stk_index_t new_capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Unmaps all reserved address space of virtual stack
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackVirtualRelease(stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Maps (or remaps) pages between guard pages for new capacity without any verification
+    (capacity is rounded up to whole pages, elements are never copied after the first mapping)
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackGuardedRealloc(stack_t* stk, stk_index_t new_capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Describes stack if fault address is on guard pages of its data (is called by SIGSEGV handler)
+    \param[in]   owner       Pointer to stack sructure
+    \param[in]   fault_addr  Address of fault
+    \param[out]  buf         Buffer for report
+    \param[in]   buf_size    Size of buffer
+    \return Length of report or 0 if fault is not on guard pages of this stack
+    ----------------------------------------------------------------------------------------------------- */
+static size_t     StackGuardedReport (const void* owner, const void* fault_addr, char* buf, size_t buf_size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts string to text buffer (it is async-signal-safe)
+    \param[in, out]  buf  Text buffer
+    \param[in]       str  String (NULL is put as "(null)")
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackTextStr       (stack_text_buf_t* buf, const char* str);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts number to text buffer (it is async-signal-safe)
+    \param[in, out]  buf    Text buffer
+    \param[in]       value  Number
+    \param[in]       base   10 or 16 (hexadecimal number is put as unsigned one with "0x")
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackTextNum       (stack_text_buf_t* buf, long long value, unsigned int base);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Makes digits of number without library calls, so SIGSEGV handler can use it
+    \param[out]  text   Buffer of at least STK_NUM_TEXT_SIZE characters (text is not terminated)
+    \param[in]   value  Number
+    \param[in]   base   10 or 16 (hexadecimal number is made as unsigned one)
+    \return Number of characters
+    ----------------------------------------------------------------------------------------------------- */
+static size_t     StackFormatNum     (char* text, long long value, unsigned int base);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates hash of stack snapshot header (all fields except hash_header)
+    \param[in]  header  Pointer to header
+    \return Hash of header
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackSnapshotHeaderHash(const stack_snapshot_header_t* header);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes all bytes of buffers (writev is repeated after partial writes and interrupts)
+    \param[in]       fd          File descriptor
+    \param[in, out]  iov         Buffers (they are changed)
+    \param[in]       iov_count   Number of buffers
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackWriteAll(int fd, struct iovec* iov, size_t iov_count);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reads bytes until buffer is full or input ends (read is repeated after partial reads and interrupts)
+    \param[in]   fd    File descriptor
+    \param[out]  buf   Buffer
+    \param[in]   size  Size of buffer
+    \return Number of bytes read (less than size if input ended) or -1 if read failed
+    ----------------------------------------------------------------------------------------------------- */
+static ssize_t    StackReadAll (int fd, void* buf, size_t size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gives pages of chunk of file stack back to system after it was written or read
+    (nothing is done for other stacks: their memory can't be restored from file)
+    \param[in]  stk    Pointer to stack sructure
+    \param[in]  chunk  Pointer to the first element of chunk
+    \param[in]  size   Size of chunk in bytes
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackSnapshotChunkDone(const stack_t* stk, const void* chunk, size_t size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reads elements of snapshot right into emptied stack, capacity is changed once
+    \param[in, out]  stk     Pointer to stack sructure
+    \param[in]       fd      File descriptor
+    \param[in]       header  Verified header of snapshot
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackSnapshotRead(stack_t* stk, int fd, const stack_snapshot_header_t* header);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Removes all elements of stack without resize (segments except the bottom one are freed)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void       StackClear(stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Starts iteration over blocks of elements, nothing is allocated (lower segments are counted by walk
+    that is bounded by lower_size, so corrupted links are not followed further)
+    \param[in]   stk              Pointer to stack sructure
+    \param[out]  blocks           Iteration state
+    \param[in]   window           Array for elements of lower segments (NULL if the small window of iteration
+                                  state is used)
+    \param[in]   window_capacity  Number of places in array
+    ----------------------------------------------------------------------------------------------------- */
+static void StackBlocksBegin(const stack_t* stk, stack_blocks_t* blocks, StackElem_t** window,
+                             size_t window_capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Takes the next block of iteration, size of the top block is the number of its elements
+    (but not more than cells that are in memory of stack)
+    \param[in, out]  blocks  Iteration state
+    \param[out]      block   Elements of block
+    \return True (if block is taken), false (if there are no more blocks)
+    ----------------------------------------------------------------------------------------------------- */
+static bool StackBlocksNext(stack_blocks_t* blocks, struct iovec* block);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates number of cells of the top block that are in memory of stack (capacity of corrupted
+    stack may be larger)
+    \param[in]  stk  Pointer to stack sructure
+    \return Number of cells
+    ----------------------------------------------------------------------------------------------------- */
+static stk_index_t StackReadableCells(const stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes stack info and runs of equal elements (works for corrupted stacks too)
+    \param[in]  stk          Pointer to stack sructure
+    \param[in]  fd           File descriptor
+    \param[in]  options      Format and number of elements
+    \param[in]  file_name    Name of file where dump was requested (NULL if it is unknown)
+    \param[in]  line_number  Number of line where dump was requested
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackDumpWith(const stack_t* stk, int fd, const StackDumpOptions* options,
+                                const char* file_name, int line_number);
+
+#ifndef NDEBUG
+    /*! -----------------------------------------------------------------------------------------------------
+        Prints stack info to stdout (the same as StackDump, but stack may have no handle yet)
+        \param[in]  stk          Pointer to stack sructure
+        \param[in]  file_name    Name of file where function was called
+        \param[in]  line_number  Number of line where function was called
+        ----------------------------------------------------------------------------------------------------- */
+    static void StackDumpStk(const stack_t* stk, const char* file_name, int line_number);
+#endif
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes run of equal elements as line of text or JSON object
+    \param[in, out]  buf    Dump buffer
+    \param[in]       first  Position of the first element of run
+    \param[in]       last   Position of the last element of run
+    \param[in]       value  Value of elements
+    ----------------------------------------------------------------------------------------------------- */
+static void StackDumpRun(stack_dump_buf_t* buf, stk_index_t first, stk_index_t last, StackElem_t value);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts bytes to dump buffer (buffer is written to its file when it is full)
+    \param[in, out]  buf   Dump buffer
+    \param[in]       str   Bytes
+    \param[in]       size  Number of bytes
+    ----------------------------------------------------------------------------------------------------- */
+static void StackDumpBytes(stack_dump_buf_t* buf, const char* str, size_t size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts string to dump buffer (JSON strings are quoted and escaped, NULL is put as "null")
+    \param[in, out]  buf      Dump buffer
+    \param[in]       str      String
+    \param[in]       is_json  String is JSON value
+    ----------------------------------------------------------------------------------------------------- */
+static void StackDumpStr(stack_dump_buf_t* buf, const char* str, bool is_json = false);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts number to dump buffer
+    \param[in, out]  buf    Dump buffer
+    \param[in]       value  Number
+    \return Number of characters that were put
+    ----------------------------------------------------------------------------------------------------- */
+static size_t StackDumpNum(stack_dump_buf_t* buf, long long value);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes dump buffer to its file
+    \param[in, out]  buf  Dump buffer
+    ----------------------------------------------------------------------------------------------------- */
+static void StackDumpFlush(stack_dump_buf_t* buf);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Verifies the stack and changes its capacity
+    \param[in, out]  stk           Pointer to stack sructure
+    \param[in]       new_capacity  New number of elements that can be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackResize    (stack_t* stk, stk_index_t new_capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Downsizes the stack as its growth policy requires
+    \param[in, out]  stk        Pointer to stack sructure
+    \param[in]       new_index  Number of elements that will be left in stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackResizeDown(stack_t* stk, stk_index_t new_index);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Upsizes the stack as its growth policy requires
+    \param[in, out]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackResizeUp  (stack_t* stk);
+
+/*!
+    Verifies all stack's sructure and data (elements), data hash is recalculated from scratch
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyAll(stack_t* stk);
+
+/*!
+    Verifies stack's sructure and data canaries in O(1) (data hash is not recalculated)
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyFast(stack_t* stk);
+
+/*!
+    Rehashes one more chunk of elements in O(1), when all whole chunks are rehashed, compares their hash together
+    with hashes of elements above them with data hash (so elements are verified every index/16 + 1 calls)
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyDataStep(stack_t* stk);
+
+/*!
+    Verifies critical (the most important) parts of stack's sructure and data (elements)
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyCritical(stack_t* stk);
+
+/*!
+    Verifies canaries of stack's sructure and data (elements)
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyCanaries(stack_t* stk);
+
+/*!
+    Verifies canaries and saved hash of full segment that is not the top one (as protection level requires)
+    \param[in]  stk      Pointer to stack sructure
+    \param[in]  segment  Pointer to segment
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifySegment(stack_t* stk, const stack_segment_t* segment);
+
+/*!
+    Verifies stack as deep as its protection level requires before resize, init or destruction
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyDeep(stack_t* stk);
+
+/*!
+    Verifies stack as its protection level requires at the beginning of push or pop
+    (STK_PROTECT_SAMPLED counts operations here and verifies all stack every verify_period ones)
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyOp(stack_t* stk);
+
+/*!
+    Verifies stack as its protection level requires after the stack was changed
+    \param[in]  stk  Pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackVerifyStep(stack_t* stk);
+
+#ifndef NSTATS_MODE
+/*! -----------------------------------------------------------------------------------------------------
+    Reads CPU tick counter (monotonic clock in nanoseconds on CPUs without it)
+    \return Number of ticks
+    ----------------------------------------------------------------------------------------------------- */
+static inline unsigned long long StackTicks()
+{
+    #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+    #else
+        timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (unsigned long long) now.tv_sec * 1000000000ull + (unsigned long long) now.tv_nsec;
+    #endif
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Adds value to counter of stack. Only the owner thread changes counters, so relaxed load and store
+    are enough (threads that sum statistics never see torn values, and no locked instruction is needed)
+    \param[in, out]  counter  Pointer to counter
+    \param[in]       value    Value that should be added
+    ----------------------------------------------------------------------------------------------------- */
+static inline void StackStatAdd(unsigned long long* counter, unsigned long long value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Starts measuring verification of stack (verification with STK_PROTECT_NONE or STK_PROTECT_SCRUBBED
+    is not measured: it is not done by operations)
+    \param[in]  stk  Pointer to stack sructure
+    \return Ticks at the beginning of verification (0 if it is not measured)
+    ----------------------------------------------------------------------------------------------------- */
+static inline unsigned long long StackStatsVerifyStart(const stack_t* stk)
+{
+    return stk->protection != STK_PROTECT_NONE && stk->protection != STK_PROTECT_SCRUBBED ? StackTicks() : 0;
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Counts failed verification by bits of its error
+    \param[in, out]  stk       Pointer to stack sructure
+    \param[in]       code_err  Error that verification found
+    ----------------------------------------------------------------------------------------------------- */
+static void StackStatsCountFailure(stack_t* stk, StackError code_err);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finishes measuring verification of stack and counts it if it failed
+    \param[in, out]  stk          Pointer to stack sructure
+    \param[in]       start_ticks  Value returned by StackStatsVerifyStart
+    \param[in]       code_err     Result of verification
+    ----------------------------------------------------------------------------------------------------- */
+static inline void StackStatsVerifyStop(stack_t* stk, unsigned long long start_ticks, StackError code_err)
+{
+    if (start_ticks != 0)
+        StackStatAdd(&stk->stats.verify_cycles, StackTicks() - start_ticks);
+    if (code_err != STK_NO_ERROR)
+        StackStatsCountFailure(stk, code_err);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Counts pushed elements and updates high-water mark of stack
+    \param[in, out]  stk              Pointer to stack sructure
+    \param[in]       number_of_elems  Number of pushed elements
+    ----------------------------------------------------------------------------------------------------- */
+static inline void StackStatsPushed(stack_t* stk, size_t number_of_elems)
+{
+    StackStatAdd(&stk->stats.pushes, number_of_elems);
+    if (StackSize(stk) > stk->high_water_mark)
+        __atomic_store_n(&stk->high_water_mark, StackSize(stk), __ATOMIC_RELAXED);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Counts resize of stack that has been done
+    \param[in, out]  stk             Pointer to stack sructure
+    \param[in]       grown           True if capacity grew, false if it decreased
+    \param[in]       new_block_size  Size of data block (segment) that resize gave (0 if nothing was allocated)
+    ----------------------------------------------------------------------------------------------------- */
+static void StackStatsResized(stack_t* stk, bool grown, size_t new_block_size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Adds stack to the list of live stacks
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackStatsRegister  (stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Removes stack from the list of live stacks
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackStatsUnregister(stack_t* stk);
+#endif
+
+/*! -----------------------------------------------------------------------------------------------------
+    Adds stack to the list of scrubbed stacks (nothing is done unless it has STK_PROTECT_SCRUBBED)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubRegister  (stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Removes stack from the list of scrubbed stacks and waits until scrubber leaves it
+    (stack is marked as being changed until it is freed)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubUnregister(stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Unlinks stack from the list of scrubbed stacks and marks it as being changed (lock of the list
+    must be taken, scrubber may still read the stack)
+    \param[in, out]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubUnlink    (stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Waits until scrubber leaves stack that is being changed, must be called before memory that
+    scrubber may read (elements, segments) is freed or moved
+    \param[in]  stk  Pointer to stack sructure
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubWait      (const stack_t* stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Body of scrubber thread: passes over scrubbed stacks until StackScrubStop
+    \param[in]  config  Settings of scrubber
+    \return NULL
+    ----------------------------------------------------------------------------------------------------- */
+static void* StackScrubThread(void* config);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Scrubs all scrubbed stacks once
+    \param[in]  config         Settings of scrubber
+    \param[in]  is_background  Pass is done by scrubber thread
+    \return Bits of errors that were found in all stacks
+    ----------------------------------------------------------------------------------------------------- */
+static StackError StackScrubPass(const StackScrubConfig* config, bool is_background);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Scrubs one stack: takes copy of its structure, verifies it and rehashes elements by chunks (stack
+    is left as soon as its owner changes it), report is written if errors of stack changed
+    \param[in, out]  stk   Pointer to stack sructure (scrubber must be its scrub_target)
+    \param[in, out]  pass  State of pass
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubStack(stack_t* stk, stack_scrub_pass_t* pass);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Verifies copy of structure of scrubbed stack and its elements
+    \param[in, out]  stk       Pointer to stack sructure
+    \param[in]       snap      Copy of stack structure that was taken while stack was not being changed
+    \param[in]       seq       Scrub sequence of stack when the copy was taken
+    \param[in]       is_clean  Stack was not changed since the last scrub
+    \param[in, out]  pass      State of pass
+    \param[out]      is_left   Stack was changed during verification, so its result is wrong
+    \return Bits of errors that were found
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned int StackScrubCheck(stack_t* stk, const stack_t* snap, unsigned long long seq, bool is_clean,
+                                    stack_scrub_pass_t* pass, bool* is_left);
+
+#ifndef NHASH_MODE
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates hash of elements by chunks, scrubber checks between chunks that stack was not changed
+    and sleeps if its CPU budget requires
+    \param[in]       stk              Pointer to stack sructure
+    \param[in]       data             Array of elements
+    \param[in]       number_of_elems  Number of elements
+    \param[in]       seq              Scrub sequence of stack when scrub began
+    \param[in, out]  pass             State of pass
+    \param[out]      is_left          Stack was changed, so hash is wrong
+    \return Hash of elements
+    ----------------------------------------------------------------------------------------------------- */
+static unsigned long StackScrubHash(const stack_t* stk, const StackElem_t* data, stk_index_t number_of_elems,
+                                    unsigned long long seq, stack_scrub_pass_t* pass, bool* is_left);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Leaves stack while scrubber sleeps to keep its CPU budget and comes back to it
+    \param[in]       stk   Pointer to stack sructure
+    \param[in]       seq   Scrub sequence of stack when scrub began
+    \param[in, out]  pass  State of pass
+    \return True if stack is still scrubbed and was not changed, false (otherwise)
+    ----------------------------------------------------------------------------------------------------- */
+static bool StackScrubPause(const stack_t* stk, unsigned long long seq, stack_scrub_pass_t* pass);
+#endif
+
+/*! -----------------------------------------------------------------------------------------------------
+    Sleeps as long as CPU budget of scrubber requires after time that it worked
+    \param[in, out]  pass  State of pass
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubRest(stack_scrub_pass_t* pass);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Remembers report of stack with errors that scrubber found and writes its dump to report_fd of config
+    \param[in, out]  pass      State of pass
+    \param[in]       snap      Copy of stack structure
+    \param[in]       code_err  Errors that scrubber found
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubWriteReport(stack_scrub_pass_t* pass, const stack_t* snap, unsigned int code_err);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gives report of pass to callback (or writes short message to stderr if there is neither callback nor dump)
+    \param[in, out]  pass  State of pass
+    ----------------------------------------------------------------------------------------------------- */
+static void StackScrubNotify(stack_scrub_pass_t* pass);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Checks that scrubbed stack was not changed since its scrub sequence was read
+    \param[in]  stk  Pointer to stack sructure
+    \param[in]  seq  Scrub sequence that was read
+    \return True (if it was not changed), false (otherwise)
+    ----------------------------------------------------------------------------------------------------- */
+static inline bool StackScrubUnchanged(const stack_t* stk, unsigned long long seq)
+{
+    // Reads of stack that were done before must not be moved after the check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return __atomic_load_n(&stk->scrub_seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reads monotonic clock
+    \return Time in seconds
+    ----------------------------------------------------------------------------------------------------- */
+static inline double StackScrubClock()
+{
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1E-9;
+}
+
+/// @brief Keeps scrub sequence of scrubbed stack odd until the end of scope, so scrubber doesn't trust
+///        what it reads from the stack meanwhile (see STACK_WRITE)
+struct stack_scrub_write_t
+{
+    stack_t* stk;  ///< NULL if stack is not scrubbed or it is already marked by outer scope
+
+    explicit stack_scrub_write_t(stack_t* stk_to_write) : stk(NULL)
+    {
+        if (stk_to_write->protection != STK_PROTECT_SCRUBBED)
+            return;
+
+        // Only the owner thread changes sequence, so it is changed by plain stores
+        unsigned long long seq = __atomic_load_n(&stk_to_write->scrub_seq, __ATOMIC_RELAXED);
+        if ((seq & 1) != 0)
+            return;
+
+        __atomic_store_n(&stk_to_write->scrub_seq, seq + 1, __ATOMIC_RELAXED);
+        std::atomic_thread_fence(std::memory_order_release);
+        stk = stk_to_write;
+    }
+
+    ~stack_scrub_write_t()
+    {
+        if (stk != NULL)
+            __atomic_store_n(&stk->scrub_seq, stk->scrub_seq + 1, __ATOMIC_RELEASE);
+    }
+};
+
+
+#ifndef NDEBUG
+    /// @brief Macro for verifying stack with given verifier
+    #define STACK_VERIFY_WITH_(stk, verifier)                                         \
+        do                                                                            \
+        {                                                                             \
+            StackError temp_code_err = STK_NO_ERROR;                                  \
+            STATS_SET_UP(unsigned long long temp_ticks = StackStatsVerifyStart(stk)); \
+            temp_code_err = verifier(stk);                                            \
+            STATS_SET_UP(StackStatsVerifyStop(stk, temp_ticks, temp_code_err));       \
+            if (temp_code_err != STK_NO_ERROR)                                        \
+            {                                                                         \
+                if (temp_code_err >= STACK_ANTIOVERFLOW_ERR)                          \
+                    StackDumpStk(stk, __FILE__, __LINE__);                    \
+                return temp_code_err;                                                 \
+            }                                                                         \
+        } while(0)
+#else
+    /// @brief Macro for verifying stack with given verifier
+    #define STACK_VERIFY_WITH_(stk, verifier)                                         \
+        do {                                                                          \
+            StackError temp_code_err = STK_NO_ERROR;                                  \
+            STATS_SET_UP(unsigned long long temp_ticks = StackStatsVerifyStart(stk)); \
+            temp_code_err = verifier(stk);                                            \
+            STATS_SET_UP(StackStatsVerifyStop(stk, temp_ticks, temp_code_err));       \
+            if (temp_code_err != STK_NO_ERROR)                                        \
+                return temp_code_err;                                                 \
+        } while(0)
+#endif
+
+/// @brief Macro for verifying stack at the beginning of push and pop
+#define STACK_VERIFY_OP(stk)  STACK_VERIFY_WITH_(stk, StackVerifyOp)
+
+/// @brief Macro for verifying stack after it was changed
+#define STACK_VERIFY(stk)     STACK_VERIFY_WITH_(stk, StackVerifyStep)
+
+/// @brief Macro for verifying all stack (including full recalculation of data hash) before resize, init or destruction
+#define STACK_VERIFY_ALL(stk) STACK_VERIFY_WITH_(stk, StackVerifyDeep)
+
+/// @brief Macro for marking stack as being changed until the end of function (it is used before any verification,
+///        because verification can change stack too)
+#define STACK_WRITE(stk)      stack_scrub_write_t temp_scrub_write(stk)
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! STACK PART !!! <-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackDtor(size_t* stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(*stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_VERIFY_ALL(stk);
+
+    STATS_SET_UP(StackStatsUnregister(stk));
+    StackScrubUnregister(stk);
+    if (stk->storage == STK_STORAGE_GUARDED)
+        StackGuardUnregister(stk);
+
+    StackFreeData(stk);
+    stk->index = 0;
+    stk->capacity = 0;
+
+    if (stk->marks != NULL)
+        stk->allocator.free(stk->allocator.ctx, stk->marks, stk->marks_capacity*sizeof(stack_mark_t));
+
+    StackHandleFree(*stk_enc_ptr);
+
+    StackAllocator allocator = stk->allocator;
+    allocator.free(allocator.ctx, stk, sizeof(stack_t)); stk = NULL;
+
+    *stk_enc_ptr = 0;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackFreeData(stack_t* stk)
+{
+    StackScrubWait(stk);
+
+    if (stk->storage == STK_STORAGE_SEGMENTED)
+    {
+        while (stk->top_segment != NULL)
+        {
+            stack_segment_t* prev = stk->top_segment->prev;
+            stk->allocator.free(stk->allocator.ctx, stk->top_segment, sizeof(stack_segment_t));
+            stk->top_segment = prev;
+        }
+
+        if (stk->spare_segment != NULL)
+            stk->allocator.free(stk->allocator.ctx, stk->spare_segment, sizeof(stack_segment_t));
+
+        stk->spare_segment = NULL;
+        stk->lower_size = 0;
+    }
+    else if (stk->storage == STK_STORAGE_FILE)
+    {
+        StackFileSyncHeader(stk);
+        StackFileClose(stk);
+    }
+    else if (stk->storage == STK_STORAGE_VIRTUAL)
+        StackVirtualRelease(stk);
+    else if (stk->storage == STK_STORAGE_GUARDED)
+    {
+        if (!StackIsInline(stk))
+            StackGuardUnmap(stk->data, (size_t) stk->capacity*sizeof(StackElem_t));
+    }
+    else if (!StackIsInline(stk))
+    {
+        #ifndef NCANARIES_MODE
+            stk->allocator.free(stk->allocator.ctx, (char*) stk->data - SIZE_OF_CANARY, StackDataBlockSize(stk->capacity));
+        #else
+            stk->allocator.free(stk->allocator.ctx, stk->data, StackDataBlockSize(stk->capacity));
+        #endif
+    }
+
+    stk->data = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NHASH_MODE
+    static StackError StackHash(stack_t* stk)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+            return code_err;
+
+        // Structure hash covers data hash, so data is hashed first
+        if ((code_err = StackHashData(stk)) != STK_NO_ERROR)
+            return code_err;
+
+        if ((code_err = StackHashStruct(stk)) != STK_NO_ERROR)
+            return code_err;
+
+        return code_err;
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static StackError StackHashData(stack_t* stk)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+            return code_err;
+
+        stk->hash_data = StackCalcDataHash(stk->data, stk->index);
+
+        return STK_NO_ERROR;
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static StackError StackHashStruct(stack_t* stk)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+            return code_err;
+
+        STATS_SET_UP(unsigned long long start_ticks = StackTicks());
+
+        stk->hash_struct = StackCalcStructHash(stk);
+
+        STATS_SET_UP(StackStatAdd(&stk->stats.hash_cycles, StackTicks() - start_ticks));
+
+        return STK_NO_ERROR;
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static unsigned long StackCalcStructHash(const stack_t* stk)
+    {
+        // Hash fields are zeroed in a copy: writing them right before the wide loads of the
+        // hash kernel would make the loads wait for the stores. Data hash is covered, so the
+        // maintained value can't be changed unnoticed between full verifications
+        stack_t temp_stk;
+        memcpy(&temp_stk, stk, STK_STRUCT_HASHED_SIZE);
+        temp_stk.hash_struct = 0;
+        temp_stk.ops_since_verify = 0;
+        temp_stk.checked_size = 0;
+        temp_stk.checked_hash = 0;
+        temp_stk.inline_pushes = 0;
+        temp_stk.inline_pops = 0;
+        temp_stk.high_water_mark = 0;
+
+        return MyHash(&temp_stk, STK_STRUCT_HASHED_SIZE);
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static void StackHashDrop(stack_t* stk, stk_index_t from, stk_index_t to)
+    {
+        stk->hash_data -= StackCalcHashDelta(stk->data, from, to);
+
+        // Chunks that were rehashed by StackVerifyDataStep and are going to change are taken out of its hash
+        stk_index_t first_chunk = from / STK_HASH_CHUNK_CAPACITY;
+        stk_index_t end_chunk   = stk->checked_size / STK_HASH_CHUNK_CAPACITY;
+        if (first_chunk < end_chunk)
+        {
+            stk->checked_hash -= StackCalcChunksHash(stk->data + first_chunk * STK_HASH_CHUNK_CAPACITY,
+                                                     end_chunk - first_chunk, first_chunk);
+            stk->checked_size = first_chunk * STK_HASH_CHUNK_CAPACITY;
+        }
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static void StackHashCheckRestart(stack_t* stk)
+    {
+        stk->checked_size = 0;
+        stk->checked_hash = 0;
+    }
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackCalcDataHash(const StackElem_t* data, stk_index_t number_of_elems)
+{
+    return StackCalcHashDelta(data, 0, number_of_elems);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackCalcHashDelta(const StackElem_t* data, stk_index_t from, stk_index_t to)
+{
+    stk_index_t first_chunk = from / STK_HASH_CHUNK_CAPACITY;
+    stk_index_t end_chunk   = to   / STK_HASH_CHUNK_CAPACITY;
+
+    if (first_chunk == end_chunk)
+        return StackCalcElemsHash(data + from, to - from, from);
+
+    // Elements of the chunk of <from> were hashed one by one, now the whole chunk is hashed instead
+    stk_index_t first_chunk_start = first_chunk * STK_HASH_CHUNK_CAPACITY;
+    stk_index_t end_chunk_start   = end_chunk   * STK_HASH_CHUNK_CAPACITY;
+
+    return StackCalcChunksHash(data + first_chunk_start, end_chunk - first_chunk, first_chunk) +
+           StackCalcElemsHash (data + end_chunk_start, to - end_chunk_start, end_chunk_start) -
+           StackCalcElemsHash (data + first_chunk_start, from - first_chunk_start, first_chunk_start);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackCalcChunksHash(const StackElem_t* data, stk_index_t number_of_chunks,
+                                         stk_index_t first_chunk)
+{
+    unsigned long calc_hash = 0;
+
+    // Scalar algorithm is used, so data hash saved in files doesn't depend on CPU
+    for (stk_index_t i = 0; i < number_of_chunks; i++)
+        calc_hash += MyHashElem(MyHashWith(HASH_ALGO_SCALAR, data + i * STK_HASH_CHUNK_CAPACITY,
+                                           STK_HASH_CHUNK_CAPACITY * sizeof(StackElem_t)), first_chunk + i);
+
+    return calc_hash;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackCalcElemsHash(const StackElem_t* data, stk_index_t number_of_elems,
+                                        stk_index_t first_position)
+{
+    unsigned long calc_hash = 0;
+    for (stk_index_t i = 0; i < number_of_elems; i++)
+        calc_hash += MyHashElem(data[i], first_position + i);
+
+    return calc_hash;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackHashStreamAdd(stack_hash_stream_t* stream, const StackElem_t* data, stk_index_t number_of_elems)
+{
+    while (number_of_elems > 0)
+    {
+        // Whole chunks are hashed right in place, elements of chunk that is split between pieces are copied
+        if (stream->tail_size == 0 && number_of_elems >= STK_HASH_CHUNK_CAPACITY)
+        {
+            stk_index_t number_of_chunks = number_of_elems / STK_HASH_CHUNK_CAPACITY;
+            stk_index_t first_chunk = stream->position / STK_HASH_CHUNK_CAPACITY;
+
+            stream->hash += StackCalcChunksHash(data, number_of_chunks, first_chunk);
+            stream->position += number_of_chunks * STK_HASH_CHUNK_CAPACITY;
+            data             += number_of_chunks * STK_HASH_CHUNK_CAPACITY;
+            number_of_elems  -= number_of_chunks * STK_HASH_CHUNK_CAPACITY;
+            continue;
+        }
+
+        stk_index_t taken = STK_HASH_CHUNK_CAPACITY - stream->tail_size;
+        if (taken > number_of_elems)
+            taken = number_of_elems;
+
+        memcpy(stream->tail + stream->tail_size, data, (size_t) taken*sizeof(StackElem_t));
+        stream->tail_size += taken;
+        data              += taken;
+        number_of_elems   -= taken;
+
+        if (stream->tail_size == STK_HASH_CHUNK_CAPACITY)
+        {
+            stk_index_t chunk = stream->position / STK_HASH_CHUNK_CAPACITY;
+            stream->hash += StackCalcChunksHash(stream->tail, 1, chunk);
+            stream->position += STK_HASH_CHUNK_CAPACITY;
+            stream->tail_size = 0;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackHashStreamEnd(const stack_hash_stream_t* stream)
+{
+    return stream->hash + StackCalcElemsHash(stream->tail, stream->tail_size, stream->position);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackConfig StackDefaultConfig()
+{
+    StackConfig config = {};
+    config.protection    = DEFAULT_PROTECTION;
+    config.verify_period = DEFAULT_VERIFY_PERIOD;
+    config.allocator     = NULL;
+
+    config.growth.growth_factor    = DEFAULT_GROWTH_FACTOR;
+    config.growth.shrink_threshold = DEFAULT_SHRINK_THRESHOLD;
+    config.growth.min_capacity     = DEFAULT_STK_CAPACITY;
+    config.growth.shrink_disabled  = false;
+
+    config.storage      = STK_STORAGE_CONTIGUOUS;
+    config.max_capacity = 0;
+
+    return config;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NDEBUG
+    StackError StackInit(size_t* stk_enc_ptr, const char* stk_name, const char* stk_init_file,
+                         int stk_init_line, const char* stk_init_func)
+    {
+        StackConfig config = StackDefaultConfig();
+        return StackInitEx(stk_enc_ptr, &config, stk_name, stk_init_file, stk_init_line, stk_init_func);
+    }
+#else
+    StackError StackInit(size_t* stk_enc_ptr)
+    {
+        StackConfig config = StackDefaultConfig();
+        return StackInitEx(stk_enc_ptr, &config);
+    }
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NDEBUG
+    StackError StackInitEx(size_t* stk_enc_ptr, const StackConfig* config, const char* stk_name,
+                           const char* stk_init_file, int stk_init_line, const char* stk_init_func)
+#else
+    StackError StackInitEx(size_t* stk_enc_ptr, const StackConfig* config)
+#endif
+{
+    const StackConfig default_config = StackDefaultConfig();
+    if (config == NULL)
+        config = &default_config;
+
+    stack_t* stk = NULL;
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackCreate(&stk, stk_enc_ptr, config ON_DEBUG(, stk_name, stk_init_file, stk_init_line,
+                                                                     stk_init_func))) != STK_NO_ERROR)
+        return code_err;
+
+    if (stk->storage == STK_STORAGE_VIRTUAL)
+        code_err = StackVirtualReserve(stk, config->max_capacity);
+
+    if (code_err == STK_NO_ERROR)
+        code_err = stk->storage == STK_STORAGE_SEGMENTED ? StackSegmentUp(stk) : StackRealloc(stk, StackCapacityFloor(stk));
+
+    if (code_err != STK_NO_ERROR)
+    {
+        if (stk->storage == STK_STORAGE_VIRTUAL)
+            StackVirtualRelease(stk);
+        stk->allocator.free(stk->allocator.ctx, stk, sizeof(stack_t));
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    #ifndef NHASH_MODE
+        if (StackUsesHash(stk))
+            StackHash(stk);
+    #endif
+    if ((code_err = StackVerifyDeep(stk)) != STK_NO_ERROR)
+    {
+        StackFreeData(stk);
+        stk->allocator.free(stk->allocator.ctx, stk, sizeof(stack_t));
+        return code_err;
+    }
+
+    if ((*stk_enc_ptr = stk->handle = StackHandleAlloc(stk, STK_HANDLE_STACK)) == 0)
+    {
+        StackFreeData(stk);
+        stk->allocator.free(stk->allocator.ctx, stk, sizeof(stack_t));
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    STATS_SET_UP(StackStatsRegister(stk));
+    StackScrubRegister(stk);
+    // Handler knows about first 1024 live guarded stacks, data of the others still faults, but without report
+    if (stk->storage == STK_STORAGE_GUARDED)
+        (void) StackGuardRegister(stk, StackGuardedReport);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NDEBUG
+    StackError StackInitFile(size_t* stk_enc_ptr, const char* path, const StackConfig* config, const char* stk_name,
+                             const char* stk_init_file, int stk_init_line, const char* stk_init_func)
+#else
+    StackError StackInitFile(size_t* stk_enc_ptr, const char* path, const StackConfig* config)
+#endif
+{
+    const StackConfig default_config = StackDefaultConfig();
+    if (config == NULL)
+        config = &default_config;
+
+    stack_t* stk = NULL;
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackCreate(&stk, stk_enc_ptr, config ON_DEBUG(, stk_name, stk_init_file, stk_init_line,
+                                                                     stk_init_func))) != STK_NO_ERROR)
+        return code_err;
+
+    stk->storage = STK_STORAGE_FILE;
+
+    if ((code_err = StackFileOpen(stk, path)) != STK_NO_ERROR)
+    {
+        stk->allocator.free(stk->allocator.ctx, stk, sizeof(stack_t));
+        return code_err;
+    }
+
+    // Data hash is taken from the file, so it is checked (not recalculated) by the first verification.
+    // Elements and canaries of file are verified whatever protection level is, header of file that
+    // failed it is not rewritten
+    STACK_HASH(stk);
+    if ((code_err = StackVerifyAll(stk)) != STK_NO_ERROR)
+    {
+        StackFileClose(stk);
+        stk->allocator.free(stk->allocator.ctx, stk, sizeof(stack_t));
+        return code_err;
+    }
+
+    if ((*stk_enc_ptr = stk->handle = StackHandleAlloc(stk, STK_HANDLE_STACK)) == 0)
+    {
+        StackFreeData(stk);
+        stk->allocator.free(stk->allocator.ctx, stk, sizeof(stack_t));
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    STATS_SET_UP(StackStatsRegister(stk));
+    StackScrubRegister(stk);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackCreate(stack_t** stk_ptr, size_t* stk_enc_ptr, const StackConfig* config
+                              ON_DEBUG(, const char* stk_name, const char* stk_init_file, int stk_init_line,
+                                       const char* stk_init_func))
+{
+    #ifndef NDEBUG
+        if (*stk_enc_ptr != 0)
+        {
+            StackDump(*stk_enc_ptr, __FILE__, __LINE__);
+            return STACK_ALREADY_INITED_ERR;
+        }
+    #else
+        (void) stk_enc_ptr;
+    #endif
+
+    const StackAllocator* allocator = config->allocator != NULL ? config->allocator : StackMallocAllocator();
+
+    stack_t* stk = (stack_t*) allocator->alloc(allocator->ctx, sizeof(stack_t));
     /* Накладные расходы:
        1) память - выделяется больше, чем надо (точное количество зависит от компилятора)
        2) время - зависит от количества блоков памяти, о которых известно, что они свободны
           (если их недостаточно, то придётся искать доп. память)                             */
 
-    #ifndef NDEBUG
-        if (*stk_enc_ptr != 0)
+    if (stk == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    memset(stk, 0, sizeof(stack_t));
+    stk->allocator = *allocator;
+
+    #ifndef NDEBUG
+        stk->stk_name = stk_name;
+        stk->init_file = stk_init_file;
+        stk->init_line = stk_init_line;
+        stk->init_func = stk_init_func;
+    #endif
+
+    stk->protection = config->protection;
+    stk->verify_period = config->verify_period > 0 ? config->verify_period : 1;
+
+    stk->growth_factor = config->growth.growth_factor > 1 ? config->growth.growth_factor : DEFAULT_GROWTH_FACTOR;
+    stk->shrink_threshold = config->growth.shrink_threshold > stk->growth_factor ?
+                            config->growth.shrink_threshold : stk->growth_factor;
+    stk->min_capacity = config->growth.min_capacity < (size_t) MAX_STK_CAPACITY ?
+                        (stk_index_t) config->growth.min_capacity : MAX_STK_CAPACITY;
+    stk->shrink_disabled = config->growth.shrink_disabled;
+    stk->storage = config->storage;
+    stk->keep_discarded = config->keep_discarded;
+    stk->file_fd = -1;
+
+    #ifndef NCANARIES_MODE
+        stk->left_canary = stk->right_canary = STACK_CANARY_VALUE;
+        stk->small_left_canary = stk->small_right_canary = DATA_CANARY_VALUE;
+    #endif
+
+    stk->data = stk->small_data;
+    stk->index = 0;
+    stk->capacity = DEFAULT_STK_CAPACITY;
+    StackUpdateBounds(stk);
+
+    *stk_ptr = stk;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPop(size_t stk_enc_ptr, StackElem_t* var)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackError code_err = STK_NO_ERROR;
+    if (stk->index == 0 && StackHasLowerSegment(stk))
+    {
+        code_err = StackSegmentDown(stk);
+        STACK_HASH(stk);
+        if (code_err != STK_NO_ERROR)
+            return code_err;
+    }
+
+        if (stk->index == 0)
+        {
+            stk->code_errors |= STACK_ANTIOVERFLOW_ERR;
+            STACK_HASH(stk);
+
+            #ifndef NDEBUG
+                StackDumpStk(stk, __FILE__, __LINE__);
+            #endif
+
+            return STACK_ANTIOVERFLOW_ERR;
+        }
+
+    if (stk->index - 1 < stk->shrink_index)
+        if ((code_err = StackResizeDown(stk, stk->index - 1)) != STK_NO_ERROR)
+            return code_err;
+
+    --stk->index;
+    *var = stk->data[stk->index];
+    HASH_SET_UP(if (StackUsesHash(stk)) StackHashDrop(stk, stk->index, stk->index + 1));
+    stk->data[stk->index] = 0;
+    STATS_SET_UP(StackStatAdd(&stk->stats.pops, 1));
+
+    if (StackSize(stk) < stk->mark_depth)
+        StackMarksCut(stk);
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPopN(size_t stk_enc_ptr, StackElem_t* vars, size_t number_of_elems)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    if (number_of_elems > StackSize(stk))
+    {
+        stk->code_errors |= STACK_ANTIOVERFLOW_ERR;
+        STACK_HASH(stk);
+
+        #ifndef NDEBUG
+            StackDumpStk(stk, __FILE__, __LINE__);
+        #endif
+
+        return STACK_ANTIOVERFLOW_ERR;
+    }
+
+    if (stk->storage == STK_STORAGE_SEGMENTED)
+        return StackSegmentPopN(stk, vars, number_of_elems);
+
+    stk_index_t new_index = stk->index - (stk_index_t) number_of_elems;
+    stk_index_t new_capacity = StackShrunkCapacity(stk, new_index);
+
+    if (new_capacity != stk->capacity)
+        STACK_VERIFY_ALL(stk);
+
+    for (size_t i = 0; i < number_of_elems; i++)
+        vars[i] = stk->data[stk->index - 1 - (stk_index_t) i];
+
+    HASH_SET_UP(if (StackUsesHash(stk)) StackHashDrop(stk, new_index, stk->index));
+    memset(stk->data + new_index, 0, number_of_elems*sizeof(StackElem_t));
+    stk->index = new_index;
+    STATS_SET_UP(StackStatAdd(&stk->stats.pops, number_of_elems));
+    StackMarksCut(stk);
+
+    StackShrinkAfterPop(stk, new_capacity);
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPush(size_t stk_enc_ptr, StackElem_t value)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackError code_err = STK_NO_ERROR;
+    if (stk->index == stk->capacity)
+        if ((code_err = StackResizeUp(stk)) != STK_NO_ERROR)
+            return code_err;
+
+    stk->data[stk->index] = value;
+    HASH_SET_UP(if (StackUsesHash(stk)) stk->hash_data += StackCalcHashDelta(stk->data, stk->index, stk->index + 1));
+    ++stk->index;
+    STATS_SET_UP(StackStatsPushed(stk, 1));
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPushN(size_t stk_enc_ptr, const StackElem_t* values, size_t number_of_elems)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    if (number_of_elems == 0)
+        return STK_NO_ERROR;
+
+    if (number_of_elems > (size_t) (StackMaxCapacity(stk) - stk->index))
+    {
+        stk->code_errors |= STACK_OVERFLOW_ERR;
+        STACK_HASH(stk);
+        return STACK_OVERFLOW_ERR;
+    }
+
+    if (stk->storage == STK_STORAGE_SEGMENTED)
+        return StackSegmentPushN(stk, values, number_of_elems);
+
+    stk_index_t new_index = stk->index + (stk_index_t) number_of_elems;
+    stk_index_t new_capacity = StackGrownCapacity(stk, new_index);
+
+    StackError code_err = STK_NO_ERROR;
+    if (new_capacity != stk->capacity)
+    {
+        STACK_VERIFY_ALL(stk);
+
+        if ((code_err = StackRealloc(stk, new_capacity)) != STK_NO_ERROR)
+        {
+            STACK_HASH(stk);
+            return code_err;
+        }
+    }
+
+    memcpy(stk->data + stk->index, values, number_of_elems*sizeof(StackElem_t));
+    HASH_SET_UP(if (StackUsesHash(stk)) stk->hash_data += StackCalcHashDelta(stk->data, stk->index, new_index));
+
+    stk->index = new_index;
+    STATS_SET_UP(StackStatsPushed(stk, number_of_elems));
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackReserve(size_t stk_enc_ptr, size_t capacity)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    if (capacity > (size_t) StackMaxCapacity(stk))
+    {
+        stk->code_errors |= STACK_OVERFLOW_ERR;
+        STACK_HASH(stk);
+        return STACK_OVERFLOW_ERR;
+    }
+
+    // Segments are never reallocated, so there is nothing to reserve
+    if ((stk_index_t) capacity <= stk->reserved_capacity || stk->storage == STK_STORAGE_SEGMENTED)
+        return STK_NO_ERROR;
+
+    STACK_VERIFY_ALL(stk);
+
+    stk->reserved_capacity = (stk_index_t) capacity;
+
+    StackError code_err = STK_NO_ERROR;
+    if ((stk_index_t) capacity > stk->capacity)
+        code_err = StackRealloc(stk, (stk_index_t) capacity);
+    else
+        StackUpdateBounds(stk);
+
+    STACK_HASH(stk);
+    if (code_err != STK_NO_ERROR)
+        return code_err;
+
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackShrinkToFit(size_t stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    if (stk->storage == STK_STORAGE_SEGMENTED)
+    {
+        if (stk->spare_segment != NULL)
+        {
+            StackScrubWait(stk);
+            stk->allocator.free(stk->allocator.ctx, stk->spare_segment, sizeof(stack_segment_t));
+            stk->spare_segment = NULL;
+        }
+
+        STACK_HASH(stk);
+        STACK_VERIFY(stk);
+        return STK_NO_ERROR;
+    }
+
+    STACK_VERIFY_ALL(stk);
+
+    stk->reserved_capacity = 0;
+
+    stk_index_t new_capacity = StackCapacityFloor(stk);
+    if (stk->index > new_capacity)
+        new_capacity = stk->index;
+
+    StackError code_err = STK_NO_ERROR;
+    if (new_capacity != stk->capacity)
+        code_err = StackRealloc(stk, new_capacity);
+    else
+        StackUpdateBounds(stk);
+
+    STACK_HASH(stk);
+    if (code_err != STK_NO_ERROR)
+        return code_err;
+
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackMark(size_t stk_enc_ptr, StackMarkToken* token)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    size_t depth = StackSize(stk);
+
+    // Depths of live marks are not more than size of stack, so the top mark is reused if it has the same depth
+    if (stk->marks_count == 0 || stk->marks[stk->marks_count - 1].depth != depth)
+    {
+        if (stk->marks_count == stk->marks_capacity)
+        {
+            size_t new_marks_capacity = stk->marks_capacity > 0 ? 2*stk->marks_capacity : DEFAULT_MARKS_CAPACITY;
+            stack_mark_t* new_marks = (stack_mark_t*) (stk->marks == NULL ?
+                stk->allocator.alloc(stk->allocator.ctx, new_marks_capacity*sizeof(stack_mark_t)) :
+                stk->allocator.realloc(stk->allocator.ctx, stk->marks, stk->marks_capacity*sizeof(stack_mark_t),
+                                       new_marks_capacity*sizeof(stack_mark_t)));
+            if (new_marks == NULL)
+            {
+                stk->code_errors |= OUT_OF_MEMORY_ERR;
+                STACK_HASH(stk);
+                return OUT_OF_MEMORY_ERR;
+            }
+
+            stk->marks = new_marks;
+            stk->marks_capacity = new_marks_capacity;
+        }
+
+        stk->marks[stk->marks_count].depth = depth;
+        stk->marks[stk->marks_count].serial = ++stk->marks_serial;
+        stk->marks_count++;
+        stk->mark_depth = depth;
+        StackUpdateBounds(stk);
+    }
+
+    token->depth = depth;
+    token->slot = stk->marks_count - 1;
+    token->serial = stk->marks[token->slot].serial;
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackRewind(size_t stk_enc_ptr, const StackMarkToken* token)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    if (token->slot >= stk->marks_count || stk->marks[token->slot].serial != token->serial)
+    {
+        stk->code_errors |= STACK_BAD_MARK_ERR;
+        STACK_HASH(stk);
+
+        #ifndef NDEBUG
+            StackDumpStk(stk, __FILE__, __LINE__);
+        #endif
+
+        return STACK_BAD_MARK_ERR;
+    }
+
+    size_t depth = stk->marks[token->slot].depth;
+    size_t number_of_elems = StackSize(stk) - depth;
+    if (number_of_elems == 0)
+        return STK_NO_ERROR;
+
+    if (stk->storage == STK_STORAGE_SEGMENTED)
+        return StackSegmentRewind(stk, depth);
+
+    stk_index_t new_index = (stk_index_t) depth;
+    stk_index_t new_capacity = StackShrunkCapacity(stk, new_index);
+
+    if (new_capacity != stk->capacity)
+        STACK_VERIFY_ALL(stk);
+
+    HASH_SET_UP(if (StackUsesHash(stk)) StackHashDrop(stk, new_index, stk->index));
+    if (!stk->keep_discarded)
+        memset(stk->data + new_index, 0, number_of_elems*sizeof(StackElem_t));
+
+    stk->index = new_index;
+    STATS_SET_UP(StackStatAdd(&stk->stats.pops, number_of_elems));
+    StackMarksCut(stk);
+
+    StackShrinkAfterPop(stk, new_capacity);
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackCheckpoint(size_t stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    if (stk->storage != STK_STORAGE_FILE)
+        return STK_NO_ERROR;
+
+    StackFileSyncHeader(stk);
+
+    if (msync(stk->file_map, stk->file_size, MS_SYNC) != 0)
+    {
+        stk->code_errors |= STACK_FILE_ERR;
+        STACK_HASH(stk);
+        return STACK_FILE_ERR;
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static stk_index_t StackCalcShrinkIndex(const stack_t* stk, stk_index_t capacity)
+{
+    if (stk->shrink_disabled || stk->storage == STK_STORAGE_SEGMENTED || capacity <= StackCapacityFloor(stk))
+        return 0;
+
+    return (stk_index_t) (capacity / stk->shrink_threshold);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackUpdateBounds(stack_t* stk)
+{
+    stk->shrink_index = StackCalcShrinkIndex(stk, stk->capacity);
+
+    // Inline functions don't verify, hash or switch segments, so other stacks always call StackPush and StackPop
+    if (stk->protection == STK_PROTECT_NONE && stk->storage != STK_STORAGE_SEGMENTED)
+    {
+        stk->push_limit = stk->capacity;
+        stk->pop_limit = (stk_index_t) stk->mark_depth > stk->shrink_index ? (stk_index_t) stk->mark_depth :
+                                                                              stk->shrink_index;
+    }
+    else
+    {
+        stk->push_limit = 0;
+        stk->pop_limit = LLONG_MAX;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackMarksCut(stack_t* stk)
+{
+    size_t size = StackSize(stk);
+    if (size >= stk->mark_depth)
+        return;
+
+    while (stk->marks_count > 0 && stk->marks[stk->marks_count - 1].depth > size)
+        stk->marks_count--;
+
+    stk->mark_depth = stk->marks_count > 0 ? stk->marks[stk->marks_count - 1].depth : 0;
+    StackUpdateBounds(stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static stk_index_t StackGrownCapacity(const stack_t* stk, stk_index_t min_capacity)
+{
+    stk_index_t max_capacity = StackMaxCapacity(stk);
+    stk_index_t new_capacity = stk->capacity;
+    while (new_capacity < min_capacity)
+    {
+        double grown_capacity = new_capacity * stk->growth_factor;
+        if (grown_capacity >= (double) max_capacity)
+            return max_capacity;
+
+        // Small capacities with small factors must grow too
+        new_capacity = (stk_index_t) grown_capacity > new_capacity ? (stk_index_t) grown_capacity : new_capacity + 1;
+    }
+
+    return new_capacity;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static stk_index_t StackShrunkCapacity(const stack_t* stk, stk_index_t new_index)
+{
+    stk_index_t new_capacity = stk->capacity;
+    stk_index_t shrink_index = stk->shrink_index;
+    stk_index_t floor = StackCapacityFloor(stk);
+
+    while (new_index < shrink_index)
+    {
+        new_capacity = (stk_index_t) (new_capacity / stk->growth_factor);
+        if (new_capacity < floor)
+            new_capacity = floor;
+
+        shrink_index = StackCalcShrinkIndex(stk, new_capacity);
+    }
+
+    return new_capacity;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackSegmentUp(stack_t* stk)
+{
+    stack_segment_t* segment = stk->spare_segment;
+    STATS_SET_UP(size_t new_block_size = 0);
+    if (segment != NULL)
+        stk->spare_segment = NULL;
+    else
+    {
+        segment = (stack_segment_t*) stk->allocator.alloc(stk->allocator.ctx, sizeof(stack_segment_t));
+        if (segment == NULL)
+        {
+            stk->code_errors |= OUT_OF_MEMORY_ERR;
+            return OUT_OF_MEMORY_ERR;
+        }
+
+        memset(segment, 0, sizeof(stack_segment_t));
+        #ifndef NCANARIES_MODE
+            segment->left_canary = segment->right_canary = DATA_CANARY_VALUE;
+        #endif
+        STATS_SET_UP(new_block_size = sizeof(stack_segment_t));
+    }
+
+    if (stk->top_segment != NULL)
+    {
+        HASH_SET_UP(stk->top_segment->hash_data = stk->hash_data);
+        stk->lower_size += (size_t) stk->index;
+        STATS_SET_UP(StackStatsResized(stk, true, new_block_size));
+    }
+
+    segment->prev = stk->top_segment;
+    stk->top_segment = segment;
+    stk->data = segment->data;
+    stk->index = 0;
+    stk->capacity = STK_SEGMENT_CAPACITY;
+    HASH_SET_UP(stk->hash_data = 0);
+    HASH_SET_UP(StackHashCheckRestart(stk));
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackSegmentDown(stack_t* stk)
+{
+    stack_segment_t* lower = stk->top_segment->prev;
+
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackVerifySegment(stk, lower)) != STK_NO_ERROR)
+        return code_err;
+
+    // The empty segment is kept, so pushes and pops at the boundary do not allocate
+    StackScrubWait(stk);
+    if (stk->spare_segment != NULL)
+        stk->allocator.free(stk->allocator.ctx, stk->spare_segment, sizeof(stack_segment_t));
+    stk->spare_segment = stk->top_segment;
+
+    stk->top_segment = lower;
+    stk->data = lower->data;
+    stk->index = STK_SEGMENT_CAPACITY;
+    stk->lower_size -= STK_SEGMENT_CAPACITY;
+    HASH_SET_UP(stk->hash_data = lower->hash_data);
+    HASH_SET_UP(StackHashCheckRestart(stk));
+    STATS_SET_UP(StackStatsResized(stk, false, 0));
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackSegmentPushN(stack_t* stk, const StackElem_t* values, size_t number_of_elems)
+{
+    StackError code_err = STK_NO_ERROR;
+
+    while (number_of_elems > 0)
+    {
+        if (stk->index == stk->capacity && (code_err = StackSegmentUp(stk)) != STK_NO_ERROR)
+        {
+            STACK_HASH(stk);
+            return code_err;
+        }
+
+        stk_index_t chunk = stk->capacity - stk->index;
+        if ((size_t) chunk > number_of_elems)
+            chunk = (stk_index_t) number_of_elems;
+
+        memcpy(stk->data + stk->index, values, chunk*sizeof(StackElem_t));
+        HASH_SET_UP(if (StackUsesHash(stk))
+                        stk->hash_data += StackCalcHashDelta(stk->data, stk->index, stk->index + chunk));
+
+        stk->index += chunk;
+        STATS_SET_UP(StackStatsPushed(stk, (size_t) chunk));
+        values += chunk;
+        number_of_elems -= chunk;
+    }
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackSegmentPopN(stack_t* stk, StackElem_t* vars, size_t number_of_elems)
+{
+    StackError code_err = STK_NO_ERROR;
+
+    while (number_of_elems > 0)
+    {
+        if (stk->index == 0 && (code_err = StackSegmentDown(stk)) != STK_NO_ERROR)
+        {
+            STACK_HASH(stk);
+            return code_err;
+        }
+
+        stk_index_t chunk = stk->index;
+        if ((size_t) chunk > number_of_elems)
+            chunk = (stk_index_t) number_of_elems;
+
+        for (stk_index_t i = 0; i < chunk; i++)
+            vars[i] = stk->data[stk->index - 1 - i];
+
+        HASH_SET_UP(if (StackUsesHash(stk)) StackHashDrop(stk, stk->index - chunk, stk->index));
+
+        stk->index -= chunk;
+        memset(stk->data + stk->index, 0, chunk*sizeof(StackElem_t));
+        STATS_SET_UP(StackStatAdd(&stk->stats.pops, (unsigned long long) chunk));
+        vars += chunk;
+        number_of_elems -= chunk;
+    }
+
+    StackMarksCut(stk);
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackSegmentRewind(stack_t* stk, size_t depth)
+{
+    StackError code_err = STK_NO_ERROR;
+
+    // Hash of lower segment was saved when it stopped being the top one, so segments above depth are not hashed
+    while (stk->lower_size > depth)
+    {
+        if (!stk->keep_discarded)
+            memset(stk->data, 0, (size_t) stk->index*sizeof(StackElem_t));
+
+        STATS_SET_UP(StackStatAdd(&stk->stats.pops, (unsigned long long) stk->index));
+        stk->index = 0;
+
+        if ((code_err = StackSegmentDown(stk)) != STK_NO_ERROR)
+        {
+            StackMarksCut(stk);
+            STACK_HASH(stk);
+            return code_err;
+        }
+    }
+
+    stk_index_t new_index = (stk_index_t) (depth - stk->lower_size);
+    stk_index_t chunk = stk->index - new_index;
+
+    HASH_SET_UP(if (StackUsesHash(stk)) StackHashDrop(stk, new_index, stk->index));
+    if (!stk->keep_discarded)
+        memset(stk->data + new_index, 0, (size_t) chunk*sizeof(StackElem_t));
+
+    stk->index = new_index;
+    STATS_SET_UP(StackStatAdd(&stk->stats.pops, (unsigned long long) chunk));
+    StackMarksCut(stk);
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackFileOpen(stack_t* stk, const char* path)
+{
+    stk->file_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (stk->file_fd < 0)
+        return STACK_FILE_ERR;
+
+    // Two processes that change the same file would break each other's stacks
+    struct stat file_stat = {};
+    if (flock(stk->file_fd, LOCK_EX | LOCK_NB) != 0 || fstat(stk->file_fd, &file_stat) != 0)
+    {
+        close(stk->file_fd);
+        return STACK_FILE_ERR;
+    }
+
+    bool is_new = file_stat.st_size == 0;
+    size_t file_size = is_new ? StackFileSize(StackCapacityFloor(stk)) : (size_t) file_stat.st_size;
+
+    if (file_size < StackFileSize(0) || (is_new && ftruncate(stk->file_fd, (off_t) file_size) != 0))
+    {
+        close(stk->file_fd);
+        return is_new ? STACK_FILE_ERR : STKSTRUCT_INFO_CORRUPT_ERR;
+    }
+
+    char* file_map = (char*) mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, stk->file_fd, 0);
+    if (file_map == MAP_FAILED)
+    {
+        close(stk->file_fd);
+        return STACK_FILE_ERR;
+    }
+
+    stack_file_header_t* header = (stack_file_header_t*) file_map;
+    StackElem_t* data = (StackElem_t*) (file_map + sizeof(stack_file_header_t));
+
+    if (is_new)
+    {
+        header->magic = STK_FILE_MAGIC;
+        header->version = STK_FILE_VERSION;
+        header->elem_size = sizeof(StackElem_t);
+        header->capacity = StackCapacityFloor(stk);
+        header->left_canary = DATA_CANARY_VALUE;
+        *((canary_t*) (data + header->capacity)) = DATA_CANARY_VALUE;
+        header->hash_header = StackFileHeaderHash(header);
+    }
+    else if (header->magic != STK_FILE_MAGIC || header->version != STK_FILE_VERSION ||
+             header->elem_size != sizeof(StackElem_t) || header->hash_header != StackFileHeaderHash(header) ||
+             header->capacity < 0 || header->capacity > MAX_STK_CAPACITY || StackFileSize(header->capacity) > file_size ||
+             header->index < 0 || header->index > header->capacity)
+    {
+        munmap(file_map, file_size);
+        close(stk->file_fd);
+        return STKSTRUCT_INFO_CORRUPT_ERR;
+    }
+
+    stk->file_map = file_map;
+    stk->file_size = file_size;
+    stk->data = data;
+    stk->index = header->index;
+    stk->capacity = header->capacity;
+    StackUpdateBounds(stk);
+    HASH_SET_UP(stk->hash_data = header->hash_data);
+
+    // File could be written by stack with other growth policy
+    StackError code_err = STK_NO_ERROR;
+    if (stk->index < stk->shrink_index && (code_err = StackFileRealloc(stk, StackShrunkCapacity(stk, stk->index)))
+                                          != STK_NO_ERROR)
+    {
+        StackFileClose(stk);
+        return code_err;
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackFileRealloc(stack_t* stk, stk_index_t new_capacity)
+{
+    size_t new_size = StackFileSize(new_capacity);
+
+    // File must be long enough for mapping before it grows and may be cut only after it shrinks
+    if (new_size > stk->file_size && ftruncate(stk->file_fd, (off_t) new_size) != 0)
+    {
+        stk->code_errors |= OUT_OF_MEMORY_ERR;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    char* new_map = (char*) mremap(stk->file_map, stk->file_size, new_size, MREMAP_MAYMOVE);
+    if (new_map == MAP_FAILED)
+    {
+        // File that is longer than its capacity is still opened (see StackFileOpen), so failed rollback is noted only
+        if (new_size > stk->file_size && ftruncate(stk->file_fd, (off_t) stk->file_size) != 0)
+            stk->code_errors |= STACK_FILE_ERR;
+
+        stk->code_errors |= OUT_OF_MEMORY_ERR;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    // Old mapping doesn't exist any more, so the new one is taken by stack even if the file can't be cut
+    StackError code_err = STK_NO_ERROR;
+    if (new_size < stk->file_size && ftruncate(stk->file_fd, (off_t) new_size) != 0)
+    {
+        stk->code_errors |= STACK_FILE_ERR;
+        code_err = STACK_FILE_ERR;
+    }
+
+    StackElem_t* new_data = (StackElem_t*) (new_map + sizeof(stack_file_header_t));
+    if (new_capacity > stk->capacity)
+        memset(new_data + stk->capacity, 0, sizeof(canary_t));
+    *((canary_t*) (new_data + new_capacity)) = DATA_CANARY_VALUE;
+
+    stk->file_map = new_map;
+    stk->file_size = new_size;
+    stk->data = new_data;
+    stk->capacity = new_capacity;
+    StackUpdateBounds(stk);
+
+    // Capacity in header must always match size of file, other fields are written by checkpoints
+    stack_file_header_t* header = (stack_file_header_t*) new_map;
+    header->capacity = new_capacity;
+    header->hash_header = StackFileHeaderHash(header);
+
+    return code_err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackFileSyncHeader(stack_t* stk)
+{
+    stack_file_header_t* header = (stack_file_header_t*) stk->file_map;
+
+    header->index = stk->index;
+    header->capacity = stk->capacity;
+
+    #ifndef NHASH_MODE
+        header->hash_data = StackUsesHash(stk) ? stk->hash_data : StackCalcDataHash(stk->data, stk->index);
+    #else
+        header->hash_data = StackCalcDataHash(stk->data, stk->index);
+    #endif
+
+    header->hash_header = StackFileHeaderHash(header);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackFileClose(stack_t* stk)
+{
+    munmap(stk->file_map, stk->file_size);
+    close(stk->file_fd);
+
+    stk->file_map = NULL;
+    stk->file_size = 0;
+    stk->file_fd = -1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackFileHeaderHash(const stack_file_header_t* header)
+{
+    return MyHashWith(HASH_ALGO_SCALAR, header, offsetof(stack_file_header_t, hash_header));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackVirtualReserve(stack_t* stk, size_t capacity)
+{
+    if (capacity == 0)
+        capacity = DEFAULT_VIRTUAL_CAPACITY;
+    if (capacity < (size_t) StackCapacityFloor(stk))
+        capacity = (size_t) StackCapacityFloor(stk);
+    if (capacity > (size_t) MAX_STK_CAPACITY)
+        capacity = (size_t) MAX_STK_CAPACITY;
+
+    size_t reserved_size = (StackDataBlockSize((stk_index_t) capacity) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    // Address space is only reserved: PROT_NONE pages without swap reservation cost nothing until commit.
+    // MAP_HUGETLB is not used: hugetlb pages are taken for the whole range on mmap (or give SIGBUS on
+    // page fault with MAP_NORESERVE), so they can't be committed lazily
+    char* map = (char*) mmap(NULL, reserved_size + HUGE_PAGE_SIZE, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        stk->code_errors |= OUT_OF_MEMORY_ERR;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    char* base = (char*) (((uintptr_t) map + HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+    if (base != map)
+        munmap(map, (size_t) (base - map));
+    munmap(base + reserved_size, (size_t) (map + HUGE_PAGE_SIZE - base));
+
+    // With transparent huge pages every committed step is backed by one page, so deep stacks make
+    // less page faults and TLB misses. Without them pages are committed one by one
+    #ifdef MADV_HUGEPAGE
+        bool huge_pages = madvise(base, reserved_size, MADV_HUGEPAGE) == 0;
+    #else
+        bool huge_pages = false;
+    #endif
+
+    stk->vm_base = base;
+    stk->vm_reserved_size = reserved_size;
+    stk->vm_committed_size = 0;
+    stk->vm_commit_step = huge_pages ? HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackVirtualRealloc(stack_t* stk, stk_index_t new_capacity)
+{
+    size_t new_committed_size = (StackDataBlockSize(new_capacity) + stk->vm_commit_step - 1) /
+                                stk->vm_commit_step * stk->vm_commit_step;
+
+    if (new_committed_size > stk->vm_reserved_size)
+    {
+        stk->code_errors |= STACK_OVERFLOW_ERR;
+        return STACK_OVERFLOW_ERR;
+    }
+
+    if (new_committed_size > stk->vm_committed_size &&
+        mprotect(stk->vm_base + stk->vm_committed_size, new_committed_size - stk->vm_committed_size,
+                 PROT_READ | PROT_WRITE) != 0)
+    {
+        stk->code_errors |= OUT_OF_MEMORY_ERR;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    #ifndef NCANARIES_MODE
+        StackElem_t* new_data = (StackElem_t*) (stk->vm_base + SIZE_OF_CANARY);
+
+        // Committed memory after the last element is always zeroed, so it can become elements again
+        if (stk->vm_committed_size == 0)
+            *((canary_t*) stk->vm_base) = DATA_CANARY_VALUE;
+        else
+            memset(new_data + stk->capacity, 0, sizeof(canary_t));
+    #else
+        StackElem_t* new_data = (StackElem_t*) stk->vm_base;
+    #endif
+
+    // Pages are given back to system, commit charge is decreased and access to them is caught.
+    // If it fails, pages just stay committed
+    if (new_committed_size < stk->vm_committed_size)
+    {
+        madvise(stk->vm_base + new_committed_size, stk->vm_committed_size - new_committed_size, MADV_DONTNEED);
+        mprotect(stk->vm_base + new_committed_size, stk->vm_committed_size - new_committed_size, PROT_NONE);
+    }
+
+    CANARIES_SET_UP(*((canary_t*) (new_data + new_capacity)) = DATA_CANARY_VALUE);
+
+    stk->vm_committed_size = new_committed_size;
+    stk->data = new_data;
+    stk->capacity = new_capacity;
+    StackUpdateBounds(stk);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackVirtualRelease(stack_t* stk)
+{
+    if (stk->vm_base != NULL)
+        munmap(stk->vm_base, stk->vm_reserved_size);
+
+    stk->vm_base = NULL;
+    stk->vm_reserved_size = 0;
+    stk->vm_committed_size = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackGuardedRealloc(stack_t* stk, stk_index_t new_capacity)
+{
+    size_t new_size = StackGuardRoundSize((size_t) new_capacity*sizeof(StackElem_t));
+
+    // Pages are zeroed by system and elements above index are always zero, so nothing is cleared here
+    StackElem_t* new_data = NULL;
+    if (StackIsInline(stk))
+    {
+        new_data = (StackElem_t*) StackGuardMap(new_size);
+        if (new_data != NULL)
+            memcpy(new_data, stk->small_data, stk->index*sizeof(StackElem_t));
+    }
+    else
+        new_data = (StackElem_t*) StackGuardRemap(stk->data, (size_t) stk->capacity*sizeof(StackElem_t), new_size);
+
+    if (new_data == NULL)
+    {
+        stk->code_errors |= OUT_OF_MEMORY_ERR;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    stk->data = new_data;
+    stk->capacity = (stk_index_t) (new_size / sizeof(StackElem_t));
+    StackUpdateBounds(stk);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t StackGuardedReport(const void* owner, const void* fault_addr, char* buf, size_t buf_size)
+{
+    const stack_t* stk = (const stack_t*) owner;
+    const char* data_begin = (const char*) stk->data;
+    const char* data_end = (const char*) (stk->data + stk->capacity);
+    const char* fault = (const char*) fault_addr;
+
+    if (StackIsInline(stk) || fault < data_begin - StackGuardPageSize() || fault >= data_end + StackGuardPageSize() ||
+        (fault >= data_begin && fault < data_end))
+        return 0;
+
+    ptrdiff_t offset = fault - data_begin;
+    stk_index_t fault_idx = (offset >= 0 ? offset : offset - (ptrdiff_t) sizeof(StackElem_t) + 1) /
+                            (ptrdiff_t) sizeof(StackElem_t);
+
+    // Report is made by hand: snprintf is not async-signal-safe
+    stack_text_buf_t text = {buf, buf_size, 0};
+
+    StackTextStr(&text, RED "STACK ERROR: guard page of data was accessed (element [");
+    StackTextNum(&text, fault_idx, 10);
+    StackTextStr(&text, "])\nstack_t " MAG);
+    #ifndef NDEBUG
+        StackTextStr(&text, stk->stk_name);
+        StackTextStr(&text, " ");
+    #endif
+    StackTextStr(&text, "[");
+    StackTextNum(&text, (long long) stk->handle, 16);
+    StackTextStr(&text, "]");
+    #ifndef NDEBUG
+        StackTextStr(&text, " " YEL "born at ");
+        StackTextStr(&text, stk->init_file);
+        StackTextStr(&text, ":");
+        StackTextNum(&text, stk->init_line, 10);
+        StackTextStr(&text, " (");
+        StackTextStr(&text, stk->init_func);
+        StackTextStr(&text, ")");
+    #endif
+    StackTextStr(&text, "\n" GRN "{\n\tindex    = ");
+    StackTextNum(&text, stk->index, 10);
+    StackTextStr(&text, "\n\tcapacity = ");
+    StackTextNum(&text, stk->capacity, 10);
+    StackTextStr(&text, "\n}" WHT "\n\n");
+
+    return text.size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackTextStr(stack_text_buf_t* buf, const char* str)
+{
+    if (str == NULL)
+        str = "(null)";
+
+    for (; *str != '\0' && buf->size < buf->capacity; str++)
+        buf->data[buf->size++] = *str;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackTextNum(stack_text_buf_t* buf, long long value, unsigned int base)
+{
+    char digits[STK_NUM_TEXT_SIZE + 1] = {};
+    size_t len = StackFormatNum(digits, value, base);
+
+    if (base == 16)
+        StackTextStr(buf, "0x");
+
+    for (size_t i = 0; i < len && buf->size < buf->capacity; i++)
+        buf->data[buf->size++] = digits[i];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t StackFormatNum(char* text, long long value, unsigned int base)
+{
+    char digits[STK_NUM_TEXT_SIZE] = {};
+    size_t len = 0;
+
+    // Digits are made from the end, unsigned negation doesn't overflow for LLONG_MIN
+    bool is_negative = base == 10 && value < 0;
+    unsigned long long abs_value = is_negative ? 0ull - (unsigned long long) value : (unsigned long long) value;
+    do
+    {
+        digits[sizeof(digits) - ++len] = "0123456789abcdef"[abs_value % base];
+        abs_value /= base;
+    } while (abs_value != 0);
+
+    if (is_negative)
+        digits[sizeof(digits) - ++len] = '-';
+
+    memcpy(text, digits + sizeof(digits) - len, len);
+    return len;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static stack_t* StackFromHandle(size_t stk_enc_ptr)
+{
+    return (stack_t*) StackHandleFind(stk_enc_ptr, STK_HANDLE_STACK);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t StackHandleAlloc(void* object, StackHandleKind kind)
+{
+    std::lock_guard<std::mutex> lock(stk_handle_mutex);
+
+    size_t slot_idx = 0;
+    if (stk_handle_free_head != 0)
+    {
+        // The last freed slot is taken first, its memory is the most likely to be in cache
+        slot_idx = stk_handle_free_head - 1;
+        stk_handle_free_head = stk_handle_slots[slot_idx].next_free;
+    }
+    else if (stk_handle_used < STACK_MAX_HANDLES)
+        slot_idx = stk_handle_used++;
+    else
+        return 0;
+
+    StackHandleSlot* slot = &stk_handle_slots[slot_idx];
+
+    // Generation 0 is never used, so handle 0 (of object that wasn't created) is always wrong
+    unsigned int generation = slot->generation.load(std::memory_order_relaxed) & ~STACK_HANDLE_KIND_MASK;
+    if (generation == 0)
+        generation = STACK_HANDLE_KIND_MASK + 1;
+    generation |= (unsigned int) kind;
+
+    slot->object.store(object, std::memory_order_relaxed);
+    slot->generation.store(generation, std::memory_order_release);
+
+    return (size_t) generation << STACK_HANDLE_GENERATION_SHIFT | slot_idx;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void StackHandleFree(size_t handle)
+{
+    std::lock_guard<std::mutex> lock(stk_handle_mutex);
+
+    size_t slot_idx = handle & STACK_HANDLE_INDEX_MASK;
+    if (slot_idx >= stk_handle_used || stk_handle_slots[slot_idx].generation.load(std::memory_order_relaxed) !=
+                                       (unsigned int) (handle >> STACK_HANDLE_GENERATION_SHIFT))
+        return;
+
+    StackHandleRelease(slot_idx);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackHandleRelease(size_t slot_idx)
+{
+    StackHandleSlot* slot = &stk_handle_slots[slot_idx];
+
+    unsigned int generation = (slot->generation.load(std::memory_order_relaxed) & ~STACK_HANDLE_KIND_MASK)
+                              + STACK_HANDLE_KIND_MASK + 1;
+    slot->generation.store(generation != 0 ? generation : STACK_HANDLE_KIND_MASK + 1, std::memory_order_release);
+    slot->object.store(NULL, std::memory_order_relaxed);
+
+    slot->next_free = (unsigned int) stk_handle_free_head;
+    stk_handle_free_head = slot_idx + 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackRealloc(stack_t* stk, stk_index_t new_capacity)
+{
+    STATS_SET_UP(stk_index_t old_capacity = stk->capacity);
+
+    StackScrubWait(stk);
+
+    StackError code_err = STK_NO_ERROR;
+    switch (stk->storage)
+    {
+        case STK_STORAGE_FILE:     code_err = StackFileRealloc   (stk, new_capacity); break;
+        case STK_STORAGE_VIRTUAL:  code_err = StackVirtualRealloc(stk, new_capacity); break;
+        case STK_STORAGE_GUARDED:  code_err = StackGuardedRealloc(stk, new_capacity); break;
+        case STK_STORAGE_CONTIGUOUS:
+        case STK_STORAGE_SEGMENTED:
+        default:                   code_err = StackHeapRealloc   (stk, new_capacity); break;
+    }
+
+    STATS_SET_UP(if (code_err == STK_NO_ERROR && stk->capacity != old_capacity)
+                     StackStatsResized(stk, stk->capacity > old_capacity,
+                                       StackIsInline(stk)                  ? 0 :
+                                       stk->storage == STK_STORAGE_GUARDED ? (size_t) stk->capacity*sizeof(StackElem_t) :
+                                                                             StackDataBlockSize(stk->capacity)));
+
+    return code_err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackHeapRealloc(stack_t* stk, stk_index_t new_capacity)
+{
+    if ((size_t) new_capacity <= DEFAULT_STK_CAPACITY)
+    {
+        if (!StackIsInline(stk))
+        {
+            memcpy(stk->small_data, stk->data, stk->index*sizeof(StackElem_t));
+            StackFreeData(stk);
+        }
+
+        stk->data = stk->small_data;
+        stk->capacity = DEFAULT_STK_CAPACITY;
+        StackUpdateBounds(stk);
+        memset(stk->data + stk->index, 0, (stk->capacity - stk->index)*sizeof(StackElem_t));
+
+        return STK_NO_ERROR;
+    }
+
+    #ifndef NCANARIES_MODE
+        char* new_block = StackIsInline(stk) ?
+            (char*) stk->allocator.alloc  (stk->allocator.ctx, StackDataBlockSize(new_capacity)) :
+            (char*) stk->allocator.realloc(stk->allocator.ctx, (char*) stk->data - SIZE_OF_CANARY,
+                                           StackDataBlockSize(stk->capacity), StackDataBlockSize(new_capacity));
+        if (new_block == NULL)
+        {
+            stk->code_errors |= OUT_OF_MEMORY_ERR;
+            return OUT_OF_MEMORY_ERR;
+        }
+
+        StackElem_t* new_data = (StackElem_t*) (new_block + SIZE_OF_CANARY);
+        *((canary_t*) new_block) = DATA_CANARY_VALUE;
+        *((canary_t*) (new_data + new_capacity)) = DATA_CANARY_VALUE;
+    #else
+        StackElem_t* new_data = StackIsInline(stk) ?
+            (StackElem_t*) stk->allocator.alloc  (stk->allocator.ctx, StackDataBlockSize(new_capacity)) :
+            (StackElem_t*) stk->allocator.realloc(stk->allocator.ctx, stk->data,
+                                                  StackDataBlockSize(stk->capacity), StackDataBlockSize(new_capacity));
+
+        if (new_data == NULL)
+        {
+            stk->code_errors |= OUT_OF_MEMORY_ERR;
+            return OUT_OF_MEMORY_ERR;
+        }
+    #endif
+
+    if (StackIsInline(stk))
+        memcpy(new_data, stk->small_data, stk->index*sizeof(StackElem_t));
+
+    if (new_capacity > stk->index)
+        memset(new_data + stk->index, 0, (new_capacity - stk->index)*sizeof(StackElem_t));
+
+    stk->data = new_data;
+    stk->capacity = new_capacity;
+    StackUpdateBounds(stk);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackResize(stack_t* stk, stk_index_t new_capacity)
+{
+    STACK_VERIFY_ALL(stk);
+
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackRealloc(stk, new_capacity)) != STK_NO_ERROR)
+    {
+        STACK_HASH(stk);
+        return code_err;
+    }
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackResizeDown(stack_t* stk, stk_index_t new_index)
+{
+    return StackResize(stk, StackShrunkCapacity(stk, new_index));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackShrinkAfterPop(stack_t* stk, stk_index_t new_capacity)
+{
+    if (new_capacity == stk->capacity || StackRealloc(stk, new_capacity) == STK_NO_ERROR)
+        return;
+
+    // Larger data is valid, but verification would report it as unused memory unless it is reserved
+    stk->reserved_capacity = stk->capacity;
+    StackUpdateBounds(stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackResizeUp(stack_t* stk)
+{
+    if (stk->capacity >= StackMaxCapacity(stk))
+    {
+        stk->code_errors |= STACK_OVERFLOW_ERR;
+        STACK_HASH(stk);
+        return STACK_OVERFLOW_ERR;
+    }
+
+    if (stk->storage == STK_STORAGE_SEGMENTED)
+    {
+        StackError code_err = StackSegmentUp(stk);
+        STACK_HASH(stk);
+        if (code_err != STK_NO_ERROR)
+            return code_err;
+
+        STACK_VERIFY(stk);
+        return STK_NO_ERROR;
+    }
+
+    return StackResize(stk, StackGrownCapacity(stk, stk->capacity + 1));
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! STACK MACHINE PART !!! <---------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackBinaryOp(size_t stk_enc_ptr, StackBinaryOpKind op)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t args[2] = {};
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, args, 2)) != STK_NO_ERROR)
+        return code_err;
+
+    StackElem_t result = 0;
+    if ((code_err = StackCalcBinaryOp(op, args[1], args[0], &result)) != STK_NO_ERROR)
+        return code_err;
+
+    return StackMachineReplace(stk, 2, 0, &result, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackBinaryOpFn(size_t stk_enc_ptr, StackBinaryFunc func, void* ctx)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t args[2] = {};
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, args, 2)) != STK_NO_ERROR)
+        return code_err;
+
+    StackElem_t result = 0;
+    if ((code_err = func(args[1], args[0], &result, ctx)) != STK_NO_ERROR)
+        return code_err;
+
+    return StackMachineReplace(stk, 2, 0, &result, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackModifyTop(size_t stk_enc_ptr, StackUnaryFunc func, void* ctx)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t arg = 0;
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, &arg, 1)) != STK_NO_ERROR)
+        return code_err;
+
+    StackElem_t result = 0;
+    if ((code_err = func(arg, &result, ctx)) != STK_NO_ERROR)
+        return code_err;
+
+    return StackMachineReplace(stk, 1, 0, &result, 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackDup(size_t stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t arg = 0;
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, &arg, 1)) != STK_NO_ERROR)
+        return code_err;
+
+    const StackElem_t results[2] = {arg, arg};
+    return StackMachineReplace(stk, 1, 1, results, 2);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackOver(size_t stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t args[2] = {};
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, args, 2)) != STK_NO_ERROR)
+        return code_err;
+
+    const StackElem_t results[3] = {args[1], args[0], args[1]};
+    return StackMachineReplace(stk, 2, 2, results, 3);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackSwap(size_t stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t args[2] = {};
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, args, 2)) != STK_NO_ERROR)
+        return code_err;
+
+    const StackElem_t results[2] = {args[1], args[0]};
+    return StackMachineReplace(stk, 2, 0, results, 2);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackRot(size_t stk_enc_ptr)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_OP(stk);
+
+    StackElem_t args[3] = {};
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackMachineArgs(stk, args, 3)) != STK_NO_ERROR)
+        return code_err;
+
+    const StackElem_t results[3] = {args[2], args[0], args[1]};
+    return StackMachineReplace(stk, 3, 0, results, 3);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackMachineArgs(stack_t* stk, StackElem_t* args, size_t number_of_args)
+{
+    if (number_of_args > StackSize(stk))
+    {
+        stk->code_errors |= STACK_ANTIOVERFLOW_ERR;
+        STACK_HASH(stk);
+
+        #ifndef NDEBUG
+            StackDumpStk(stk, __FILE__, __LINE__);
+        #endif
+
+        return STACK_ANTIOVERFLOW_ERR;
+    }
+
+    // Lower segments are always full, so operands that are not in the top segment are at the end of the lower one
+    for (size_t i = 0; i < number_of_args; i++)
+    {
+        stk_index_t position = stk->index - 1 - (stk_index_t) i;
+        args[i] = position >= 0 ? stk->data[position] :
+                                  stk->top_segment->prev->data[(stk_index_t) STK_SEGMENT_CAPACITY + position];
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackMachineReplace(stack_t* stk, size_t number_of_args, size_t number_of_kept,
+                                      const StackElem_t* results, size_t number_of_results)
+{
+    // Bottom operands that stay in their places (as the one of StackDup) are neither rewritten nor popped
+    number_of_args    -= number_of_kept;
+    number_of_results -= number_of_kept;
+
+    StackError code_err = STK_NO_ERROR;
+    stk_index_t first = stk->index - (stk_index_t) number_of_args;
+    stk_index_t new_index = first + (stk_index_t) number_of_results;
+
+    if (stk->storage == STK_STORAGE_SEGMENTED && (first < 0 || new_index > stk->capacity))
+    {
+        StackElem_t values[STK_MACHINE_MAX_ARGS + 1] = {};
+        if ((code_err = StackSegmentPopN(stk, values, number_of_args)) != STK_NO_ERROR)
+            return code_err;
+
+        // Results are pushed from the bottom one
+        for (size_t i = 0; i < number_of_results; i++)
+            values[i] = results[number_of_results - 1 - i];
+
+        return StackSegmentPushN(stk, values, number_of_results);
+    }
+
+    if (new_index > stk->capacity && (code_err = StackResizeUp(stk)) != STK_NO_ERROR)
+        return code_err;
+
+    stk_index_t new_capacity = StackShrunkCapacity(stk, new_index);
+    if (new_capacity != stk->capacity)
+        STACK_VERIFY_ALL(stk);
+
+    // Marks are cut as if operands were popped
+    stk->index = first;
+    StackMarksCut(stk);
+
+    // Operands are still in place, they are overwritten only after their hash is taken away
+    HASH_SET_UP(if (StackUsesHash(stk)) StackHashDrop(stk, first, first + (stk_index_t) number_of_args));
+
+    for (size_t i = 0; i < number_of_results; i++)
+        stk->data[new_index - 1 - (stk_index_t) i] = results[i];
+
+    HASH_SET_UP(if (StackUsesHash(stk)) stk->hash_data += StackCalcHashDelta(stk->data, first, new_index));
+
+    if (number_of_results < number_of_args)
+        memset(stk->data + new_index, 0, (number_of_args - number_of_results)*sizeof(StackElem_t));
+
+    stk->index = new_index;
+    STATS_SET_UP(StackStatAdd(&stk->stats.pops, number_of_args));
+    STATS_SET_UP(StackStatsPushed(stk, number_of_results));
+
+    StackShrinkAfterPop(stk, new_capacity);
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackCalcBinaryOp(StackBinaryOpKind op, StackElem_t lhs, StackElem_t rhs, StackElem_t* result)
+{
+    // Overflow of signed numbers is undefined, so they are added and multiplied as unsigned ones
+    unsigned long long unsigned_lhs = (unsigned long long) lhs;
+    unsigned long long unsigned_rhs = (unsigned long long) rhs;
+
+    switch (op)
+    {
+        case STK_OP_ADD:    *result = (StackElem_t) (unsigned_lhs + unsigned_rhs);  return STK_NO_ERROR;
+        case STK_OP_SUB:    *result = (StackElem_t) (unsigned_lhs - unsigned_rhs);  return STK_NO_ERROR;
+        case STK_OP_MUL:    *result = (StackElem_t) (unsigned_lhs * unsigned_rhs);  return STK_NO_ERROR;
+        case STK_OP_AND:    *result = lhs & rhs;                                    return STK_NO_ERROR;
+        case STK_OP_OR:     *result = lhs | rhs;                                    return STK_NO_ERROR;
+        case STK_OP_XOR:    *result = lhs ^ rhs;                                    return STK_NO_ERROR;
+        case STK_OP_LESS:   *result = lhs < rhs;                                    return STK_NO_ERROR;
+        case STK_OP_EQUAL:  *result = lhs == rhs;                                   return STK_NO_ERROR;
+        case STK_OP_MIN:    *result = lhs < rhs ? lhs : rhs;                        return STK_NO_ERROR;
+        case STK_OP_MAX:    *result = lhs < rhs ? rhs : lhs;                        return STK_NO_ERROR;
+        case STK_OP_DIV:
+        case STK_OP_MOD:
+            if (rhs == 0 || (lhs == LLONG_MIN && rhs == -1))
+                return STACK_BAD_OPERAND_ERR;
+
+            *result = op == STK_OP_DIV ? lhs / rhs : lhs % rhs;
+            return STK_NO_ERROR;
+        case STK_OP_SHL:
+        case STK_OP_SHR:
+            if (rhs < 0 || rhs > STK_ELEM_MAX_SHIFT)
+                return STACK_BAD_OPERAND_ERR;
+
+            *result = op == STK_OP_SHL ? (StackElem_t) (unsigned_lhs << rhs) : lhs >> rhs;
+            return STK_NO_ERROR;
+        default:
+            return STACK_BAD_OPERAND_ERR;
+    }
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! SNAPSHOT PART !!! <--------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackSerialize(size_t stk_enc_ptr, int fd)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_ALL(stk);
+
+    // Deep segmented stack is walked once if there is memory for all its segments, otherwise by windows
+    size_t window_capacity = stk->lower_size / STK_SEGMENT_CAPACITY;
+    StackElem_t** window = NULL;
+    if (window_capacity > STK_BLOCKS_WINDOW)
+        window = (StackElem_t**) stk->allocator.alloc(stk->allocator.ctx, window_capacity*sizeof(StackElem_t*));
+
+    stack_blocks_t blocks = {};
+    struct iovec block_iov = {};
+
+    stack_snapshot_header_t header = {};
+    header.magic = STK_SNAPSHOT_MAGIC;
+    header.version = STK_SNAPSHOT_VERSION;
+    header.elem_size = sizeof(StackElem_t);
+    header.number_of_elems = (int64_t) StackSize(stk);
+    header.capacity = (int64_t) (stk->lower_size + (size_t) stk->capacity);
+
+    // Positions of elements of segment are not their positions in stack, so its data hash is not used
+    bool hash_is_known = false;
+    #ifndef NHASH_MODE
+        if (StackUsesHash(stk) && stk->storage != STK_STORAGE_SEGMENTED)
+        {
+            header.hash_data = stk->hash_data;
+            hash_is_known = true;
+        }
+    #endif
+
+    if (!hash_is_known)
+    {
+        stack_hash_stream_t hash_stream = {};
+
+        StackBlocksBegin(stk, &blocks, window, window_capacity);
+        while (StackBlocksNext(&blocks, &block_iov))
+            StackHashStreamAdd(&hash_stream, (const StackElem_t*) block_iov.iov_base,
+                               (stk_index_t) (block_iov.iov_len / sizeof(StackElem_t)));
+
+        header.hash_data = StackHashStreamEnd(&hash_stream);
+    }
+
+    header.hash_header = StackSnapshotHeaderHash(&header);
+
+    struct iovec header_iov = {&header, sizeof(header)};
+    StackError code_err = StackWriteAll(fd, &header_iov, 1);
+
+    // Elements are gathered right from stack memory by chunks that are not larger than STK_SNAPSHOT_CHUNK_CAPACITY
+    struct iovec batch[STK_SNAPSHOT_IOV_COUNT] = {};
+    size_t batch_count = 0;
+    size_t batch_size = 0;
+    const size_t chunk_size = (size_t) STK_SNAPSHOT_CHUNK_CAPACITY*sizeof(StackElem_t);
+
+    StackBlocksBegin(stk, &blocks, window, window_capacity);
+    while (code_err == STK_NO_ERROR && StackBlocksNext(&blocks, &block_iov))
+    {
+        char* block = (char*) block_iov.iov_base;
+        size_t block_size = block_iov.iov_len;
+        bool is_last_block = blocks.next_block == blocks.number_of_blocks;
+
+        // Loop is entered for empty block too, so empty top block still writes the rest of batch
+        do
+        {
+            size_t piece_size = block_size < chunk_size - batch_size ? block_size : chunk_size - batch_size;
+            if (piece_size > 0)
+                batch[batch_count++] = {block, piece_size};
+            batch_size += piece_size;
+            block += piece_size;
+            block_size -= piece_size;
+
+            bool is_last = block_size == 0 && is_last_block;
+            if (batch_count == STK_SNAPSHOT_IOV_COUNT || batch_size == chunk_size || is_last)
+            {
+                struct iovec pieces[STK_SNAPSHOT_IOV_COUNT] = {};
+                memcpy(pieces, batch, batch_count*sizeof(struct iovec));
+
+                code_err = StackWriteAll(fd, pieces, batch_count);
+                for (size_t piece = 0; piece < batch_count; piece++)
+                    StackSnapshotChunkDone(stk, batch[piece].iov_base, batch[piece].iov_len);
+
+                batch_count = 0;
+                batch_size = 0;
+            }
+        } while (block_size > 0 && code_err == STK_NO_ERROR);
+    }
+
+    if (window != NULL)
+        stk->allocator.free(stk->allocator.ctx, window, window_capacity*sizeof(StackElem_t*));
+
+    if (code_err != STK_NO_ERROR)
+    {
+        stk->code_errors |= code_err;
+        STACK_HASH(stk);
+        return code_err;
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackDeserialize(size_t stk_enc_ptr, int fd)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    STACK_WRITE(stk);
+    STACK_VERIFY_ALL(stk);
+
+    stack_snapshot_header_t header = {};
+    ssize_t header_size = StackReadAll(fd, &header, sizeof(header));
+
+    StackError code_err = STK_NO_ERROR;
+    if (header_size < 0)
+        code_err = STACK_FILE_ERR;
+    else if ((size_t) header_size != sizeof(header) || header.magic != STK_SNAPSHOT_MAGIC ||
+             header.version != STK_SNAPSHOT_VERSION || header.elem_size != sizeof(StackElem_t) ||
+             header.hash_header != StackSnapshotHeaderHash(&header) ||
+             header.number_of_elems < 0 || header.capacity < header.number_of_elems)
+        code_err = STKSTRUCT_INFO_CORRUPT_ERR;
+    else if (header.number_of_elems > StackMaxCapacity(stk))
+        code_err = STACK_OVERFLOW_ERR;
+
+    if (code_err == STK_NO_ERROR)
+    {
+        StackClear(stk);
+        if ((code_err = StackSnapshotRead(stk, fd, &header)) != STK_NO_ERROR)
+        {
+            // Stack is left empty, its capacity is as small as its policy allows
+            StackClear(stk);
+            stk_index_t new_capacity = StackShrunkCapacity(stk, 0);
+            if (stk->storage != STK_STORAGE_SEGMENTED && new_capacity != stk->capacity)
+                StackRealloc(stk, new_capacity);
+        }
+    }
+
+    if (code_err != STK_NO_ERROR)
+    {
+        stk->code_errors |= code_err;
+        STACK_HASH(stk);
+        return code_err;
+    }
+
+    STATS_SET_UP(StackStatsPushed(stk, (size_t) header.number_of_elems));
+
+    STACK_HASH(stk);
+    STACK_VERIFY(stk);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackSnapshotRead(stack_t* stk, int fd, const stack_snapshot_header_t* header)
+{
+    stk_index_t number_of_elems = header->number_of_elems;
+
+    if (stk->storage != STK_STORAGE_SEGMENTED)
+    {
+        stk_index_t floor = StackCapacityFloor(stk);
+        stk_index_t new_capacity = header->capacity < StackMaxCapacity(stk) ? header->capacity : StackMaxCapacity(stk);
+
+        // Capacity of snapshot could be given by other growth policy that allows emptier stacks
+        if (number_of_elems < StackCalcShrinkIndex(stk, new_capacity))
+            new_capacity = number_of_elems;
+        if (new_capacity < floor)
+            new_capacity = floor;
+
+        StackError code_err = STK_NO_ERROR;
+        if (new_capacity != stk->capacity && (code_err = StackRealloc(stk, new_capacity)) != STK_NO_ERROR)
+            return code_err;
+    }
+
+    stack_hash_stream_t hash_stream = {};
+    while ((stk_index_t) StackSize(stk) < number_of_elems)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if (stk->index == stk->capacity && (code_err = StackSegmentUp(stk)) != STK_NO_ERROR)
+            return code_err;
+
+        stk_index_t chunk = number_of_elems - (stk_index_t) StackSize(stk);
+        if (chunk > stk->capacity - stk->index)
+            chunk = stk->capacity - stk->index;
+        if (chunk > STK_SNAPSHOT_CHUNK_CAPACITY)
+            chunk = STK_SNAPSHOT_CHUNK_CAPACITY;
+
+        StackElem_t* chunk_data = stk->data + stk->index;
+        size_t chunk_size = (size_t) chunk*sizeof(StackElem_t);
+        ssize_t read_size = StackReadAll(fd, chunk_data, chunk_size);
+        if (read_size < 0)
+            return STACK_FILE_ERR;
+
+        if ((size_t) read_size != chunk_size)
+        {
+            memset(chunk_data, 0, (size_t) read_size);
+            return STKDATA_INFO_CORRUPT_ERR;
+        }
+
+        StackHashStreamAdd(&hash_stream, chunk_data, chunk);
+        HASH_SET_UP(if (StackUsesHash(stk))
+                        stk->hash_data += StackCalcHashDelta(stk->data, stk->index, stk->index + chunk));
+
+        StackSnapshotChunkDone(stk, chunk_data, chunk_size);
+        stk->index += chunk;
+    }
+
+    return StackHashStreamEnd(&hash_stream) == header->hash_data ? STK_NO_ERROR : STKDATA_INFO_CORRUPT_ERR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackClear(stack_t* stk)
+{
+    StackScrubWait(stk);
+    memset(stk->data, 0, (size_t) stk->index*sizeof(StackElem_t));
+
+    // Lower segments are full, the bottom one is kept
+    while (StackHasLowerSegment(stk))
+    {
+        stack_segment_t* lower = stk->top_segment->prev;
+        stk->allocator.free(stk->allocator.ctx, stk->top_segment, sizeof(stack_segment_t));
+
+        stk->top_segment = lower;
+        stk->data = lower->data;
+        memset(stk->data, 0, STK_SEGMENT_CAPACITY*sizeof(StackElem_t));
+    }
+
+    stk->index = 0;
+    stk->lower_size = 0;
+    HASH_SET_UP(stk->hash_data = 0);
+    HASH_SET_UP(StackHashCheckRestart(stk));
+    StackMarksCut(stk);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackBlocksBegin(const stack_t* stk, stack_blocks_t* blocks, StackElem_t** window,
+                             size_t window_capacity)
+{
+    blocks->stk = stk;
+    blocks->next_block = 0;
+    blocks->window = window != NULL ? window : blocks->local_window;
+    blocks->window_capacity = window != NULL ? window_capacity : STK_BLOCKS_WINDOW;
+    blocks->window_first = 0;
+    blocks->window_count = 0;
+
+    if (stk->data == NULL)
+    {
+        blocks->number_of_blocks = 0;
+        return;
+    }
+
+    // Lower segments are full, so there are lower_size / STK_SEGMENT_CAPACITY of them unless links are corrupted
+    size_t max_lower = StackHasLowerSegment(stk) ? stk->lower_size / STK_SEGMENT_CAPACITY : 0;
+    size_t number_of_lower = 0;
+    for (const stack_segment_t* segment = max_lower > 0 ? stk->top_segment->prev : NULL;
+         segment != NULL && number_of_lower < max_lower; segment = segment->prev)
+        number_of_lower++;
+
+    blocks->number_of_blocks = number_of_lower + 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool StackBlocksNext(stack_blocks_t* blocks, struct iovec* block)
+{
+    const stack_t* stk = blocks->stk;
+    size_t block_idx = blocks->next_block;
+    if (block_idx >= blocks->number_of_blocks)
+        return false;
+
+    blocks->next_block++;
+
+    size_t number_of_lower = blocks->number_of_blocks - 1;
+    if (block_idx == number_of_lower)
+    {
+        stk_index_t readable_cells = StackReadableCells(stk);
+        stk_index_t size = stk->index < readable_cells ? stk->index : readable_cells;
+        *block = {stk->data, (size_t) (size > 0 ? size : 0)*sizeof(StackElem_t)};
+        return true;
+    }
+
+    if (block_idx >= blocks->window_first + blocks->window_count)
+    {
+        // Walk goes down to the last segment of window and fills the window from its end
+        size_t last_idx = block_idx + blocks->window_capacity < number_of_lower ?
+                          block_idx + blocks->window_capacity - 1 : number_of_lower - 1;
+
+        stack_segment_t* segment = stk->top_segment->prev;
+        for (size_t segment_idx = number_of_lower - 1; segment_idx > last_idx; segment_idx--)
+            segment = segment->prev;
+
+        for (size_t segment_idx = last_idx + 1; segment_idx > block_idx; segment_idx--)
+        {
+            blocks->window[segment_idx - 1 - block_idx] = segment->data;
+            segment = segment->prev;
+        }
+
+        blocks->window_first = block_idx;
+        blocks->window_count = last_idx + 1 - block_idx;
+    }
+
+    *block = {blocks->window[block_idx - blocks->window_first], STK_SEGMENT_CAPACITY*sizeof(StackElem_t)};
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static stk_index_t StackReadableCells(const stack_t* stk)
+{
+    if (stk->data == NULL || stk->capacity <= 0)
+        return 0;
+
+    // Heap block and guarded mapping are known only by capacity, other memory has its own size
+    size_t mapped_cells = (size_t) stk->capacity;
+    if (StackIsInline(stk))
+        mapped_cells = DEFAULT_STK_CAPACITY;
+    else if (stk->storage == STK_STORAGE_SEGMENTED)
+        mapped_cells = STK_SEGMENT_CAPACITY;
+    else if (stk->storage == STK_STORAGE_FILE || stk->storage == STK_STORAGE_VIRTUAL)
+    {
+        const char* map = stk->storage == STK_STORAGE_FILE ? stk->file_map : stk->vm_base;
+        size_t map_size = stk->storage == STK_STORAGE_FILE ? stk->file_size : stk->vm_committed_size;
+
+        // Data pointer that is out of mapping gives huge offset, so nothing is read
+        size_t data_offset = (size_t) ((uintptr_t) stk->data - (uintptr_t) map);
+        mapped_cells = map_size > data_offset ? (map_size - data_offset) / sizeof(StackElem_t) : 0;
+    }
+
+    return (size_t) stk->capacity < mapped_cells ? stk->capacity : (stk_index_t) mapped_cells;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long StackSnapshotHeaderHash(const stack_snapshot_header_t* header)
+{
+    return MyHashWith(HASH_ALGO_SCALAR, header, offsetof(stack_snapshot_header_t, hash_header));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackWriteAll(int fd, struct iovec* iov, size_t iov_count)
+{
+    while (iov_count > 0)
+    {
+        ssize_t written = writev(fd, iov, (int) iov_count);
+        if (written < 0)
         {
-            stk = (stack_t*) StackPtrXOR(*stk_enc_ptr);
-            StackDump(StackPtrXOR((size_t) stk), __FILE__, __LINE__);
-            return STACK_ALREADY_INITED_ERR;
+            if (errno == EINTR)
+                continue;
+
+            return STACK_FILE_ERR;
         }
 
-        stk->stk_name = stk_name;
-        stk->init_file = stk_init_file;
-        stk->init_line = stk_init_line;
-        stk->init_func = stk_init_func;
+        // Buffers that were written are skipped, the first one that wasn't written fully is moved
+        while (iov_count > 0 && (size_t) written >= iov->iov_len)
+        {
+            written -= (ssize_t) iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+
+        if (iov_count > 0)
+        {
+            iov->iov_base = (char*) iov->iov_base + written;
+            iov->iov_len -= (size_t) written;
+        }
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static ssize_t StackReadAll(int fd, void* buf, size_t size)
+{
+    size_t read_size = 0;
+    while (read_size < size)
+    {
+        ssize_t last_read_size = read(fd, (char*) buf + read_size, size - read_size);
+        if (last_read_size < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        if (last_read_size == 0)
+            break;
+
+        read_size += (size_t) last_read_size;
+    }
+
+    return (ssize_t) read_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackSnapshotChunkDone(const stack_t* stk, const void* chunk, size_t size)
+{
+    if (stk->storage != STK_STORAGE_FILE)
+        return;
+
+    // Pages of shared file mapping are kept by page cache, so they are read back (or written to disk) later
+    uintptr_t page_mask = (uintptr_t) sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t begin = ((uintptr_t) chunk + page_mask) & ~page_mask;
+    uintptr_t end = ((uintptr_t) chunk + size) & ~page_mask;
+    if (end > begin)
+        madvise((void*) begin, end - begin, MADV_DONTNEED);
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! STATISTICS PART !!! <------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackGetStats(size_t stk_enc_ptr, StackStats* stats)
+{
+    stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    #ifndef NSTATS_MODE
+        *stats = stk->stats;
+        stats->pushes += stk->inline_pushes;
+        stats->pops += stk->inline_pops;
+        stats->high_water_mark = stk->high_water_mark;
+        stats->number_of_stacks = 1;
+    #else
+        memset(stats, 0, sizeof(StackStats));
     #endif
 
-    #ifndef NCANARIES_MODE
-        stk->left_canary = stk->right_canary = STACK_CANARY_VALUE;
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackGetGlobalStats(StackStats* stats)
+{
+    memset(stats, 0, sizeof(StackStats));
+
+    #ifndef NSTATS_MODE
+        #define LOAD_STAT_(stk, field) __atomic_load_n(&(stk)->stats.field, __ATOMIC_RELAXED)
+
+        std::lock_guard<std::mutex> lock(live_stacks_mutex);
+
+        for (const stack_t* stk = live_stacks; stk != NULL; stk = stk->live_next)
+        {
+            stats->pushes            += LOAD_STAT_(stk, pushes) + __atomic_load_n(&stk->inline_pushes, __ATOMIC_RELAXED);
+            stats->pops              += LOAD_STAT_(stk, pops)   + __atomic_load_n(&stk->inline_pops,   __ATOMIC_RELAXED);
+            stats->resizes_up        += LOAD_STAT_(stk, resizes_up);
+            stats->resizes_down      += LOAD_STAT_(stk, resizes_down);
+            stats->bytes_reallocated += LOAD_STAT_(stk, bytes_reallocated);
+            stats->verify_cycles     += LOAD_STAT_(stk, verify_cycles);
+            stats->hash_cycles       += LOAD_STAT_(stk, hash_cycles);
+
+            for (int bit = 0; bit < STACK_ERROR_BITS; bit++)
+                stats->verify_failures[bit] += LOAD_STAT_(stk, verify_failures[bit]);
+
+            unsigned long long high_water_mark = __atomic_load_n(&stk->high_water_mark, __ATOMIC_RELAXED);
+            if (high_water_mark > stats->high_water_mark)
+                stats->high_water_mark = high_water_mark;
+
+            stats->number_of_stacks++;
+        }
+
+        #undef LOAD_STAT_
     #endif
 
-    #ifndef NCANARIES_MODE
-        char* new_data = (char*) calloc(DEFAULT_STK_CAPACITY*sizeof(StackElem_t) + SIZE_OF_CANARY*2, sizeof(char));
-        *((canary_t*) new_data) = DATA_CANARY_VALUE;
-        *((canary_t*) (new_data + DEFAULT_STK_CAPACITY*sizeof(StackElem_t) + SIZE_OF_CANARY)) = DATA_CANARY_VALUE;
-        stk->data = (StackElem_t*) (new_data + SIZE_OF_CANARY);
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void StackForgetAllocator(const void* allocator_ctx)
+{
+    {
+        std::lock_guard<std::mutex> lock(stk_handle_mutex);
+
+        // Structures are still in memory of allocator, so their allocators can be read
+        for (size_t slot_idx = 0; slot_idx < stk_handle_used; slot_idx++)
+        {
+            const StackHandleSlot* slot = &stk_handle_slots[slot_idx];
+            if ((slot->generation.load(std::memory_order_relaxed) & STACK_HANDLE_KIND_MASK) != STK_HANDLE_STACK)
+                continue;
+
+            const stack_t* stk = (const stack_t*) slot->object.load(std::memory_order_relaxed);
+            if (stk != NULL && stk->allocator.ctx == allocator_ctx)
+                StackHandleRelease(slot_idx);
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(scrub_stacks_mutex);
+
+        const stack_t* busy = NULL;
+        stack_t* stk = scrub_stacks;
+        while (stk != NULL)
+        {
+            stack_t* next = stk->scrub_next;
+            if (stk->allocator.ctx == allocator_ctx)
+            {
+                if (stk == scrub_target.load(std::memory_order_relaxed))
+                    busy = stk;
+                StackScrubUnlink(stk);
+            }
+
+            stk = next;
+        }
+
+        lock.unlock();
+
+        // Scrubber never comes to unlinked stacks, so only the one that it reads now is waited for
+        while (busy != NULL && scrub_target.load(std::memory_order_acquire) == busy)
+            sched_yield();
+    }
+
+    #ifndef NSTATS_MODE
+        std::lock_guard<std::mutex> lock(live_stacks_mutex);
+
+        // Allocator of stack never changes after init, so it is read safely while owners use their stacks
+        stack_t* stk = live_stacks;
+        while (stk != NULL)
+        {
+            stack_t* next = stk->live_next;
+            if (stk->allocator.ctx == allocator_ctx)
+            {
+                if (stk->live_prev != NULL)
+                    stk->live_prev->live_next = next;
+                else
+                    live_stacks = next;
+                if (next != NULL)
+                    next->live_prev = stk->live_prev;
+            }
+
+            stk = next;
+        }
     #else
-        stk->data = (StackElem_t*) calloc(DEFAULT_STK_CAPACITY, sizeof(StackElem_t));
+        (void) allocator_ctx;
     #endif
+}
 
-    stk->index = 0;
-    stk->capacity = DEFAULT_STK_CAPACITY;
+//----------------------------------------------------------------------------------------------------------------------
 
-    STACK_HASH(stk);
-    STACK_VERIFY(stk);
+#ifndef NSTATS_MODE
+    static void StackStatsCountFailure(stack_t* stk, StackError code_err)
+    {
+        for (int bit = 0; bit < STACK_ERROR_BITS; bit++)
+            if (((unsigned int) code_err >> bit) & 1u)
+                StackStatAdd(&stk->stats.verify_failures[bit], 1);
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static void StackStatsResized(stack_t* stk, bool grown, size_t new_block_size)
+    {
+        StackStatAdd(grown ? &stk->stats.resizes_up : &stk->stats.resizes_down, 1);
+        StackStatAdd(&stk->stats.bytes_reallocated, new_block_size);
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static void StackStatsRegister(stack_t* stk)
+    {
+        std::lock_guard<std::mutex> lock(live_stacks_mutex);
+
+        stk->live_prev = NULL;
+        stk->live_next = live_stacks;
+        if (live_stacks != NULL)
+            live_stacks->live_prev = stk;
+        live_stacks = stk;
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static void StackStatsUnregister(stack_t* stk)
+    {
+        std::lock_guard<std::mutex> lock(live_stacks_mutex);
+
+        if (stk->live_prev != NULL)
+            stk->live_prev->live_next = stk->live_next;
+        else
+            live_stacks = stk->live_next;
+        if (stk->live_next != NULL)
+            stk->live_next->live_prev = stk->live_prev;
+
+        stk->live_prev = stk->live_next = NULL;
+    }
+#endif
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! SCRUB PART !!! <-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackScrubConfig StackScrubDefaultConfig()
+{
+    StackScrubConfig config = {};
+    config.pass_interval_ms = DEFAULT_SCRUB_INTERVAL_MS;
+    config.cpu_budget       = DEFAULT_SCRUB_CPU_BUDGET;
+    config.clean_period     = DEFAULT_SCRUB_CLEAN_PERIOD;
+    config.on_failure       = NULL;
+    config.ctx              = NULL;
+    config.report_fd        = STDERR_FILENO;
+
+    config.dump_options.format = STK_DUMP_TEXT;
+    config.dump_options.top_k  = DEFAULT_SCRUB_DUMP_TOP_K;
+    config.dump_options.colors = false;
+
+    return config;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
 
-    *stk_enc_ptr = StackPtrXOR((size_t) stk);
+StackError StackScrubStart(const StackScrubConfig* config)
+{
+    std::lock_guard<std::mutex> control_lock(scrub_control_mutex);
+    if (scrub_thread_running)
+        return STACK_ALREADY_INITED_ERR;
+
+    scrub_thread_config = config != NULL ? *config : StackScrubDefaultConfig();
+    scrub_thread_stop.store(false);
 
+    if (pthread_create(&scrub_thread, NULL, StackScrubThread, &scrub_thread_config) != 0)
+        return OUT_OF_MEMORY_ERR;
+
+    scrub_thread_running = true;
     return STK_NO_ERROR;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-StackError StackPop(size_t stk_enc_ptr, StackElem_t* var)
+StackError StackScrubStop()
 {
-    stack_t* stk = (stack_t*) StackPtrXOR(stk_enc_ptr);
+    std::lock_guard<std::mutex> control_lock(scrub_control_mutex);
+    if (!scrub_thread_running)
+        return STK_NO_ERROR;
 
-    STACK_VERIFY(stk);
+    {
+        std::lock_guard<std::mutex> lock(scrub_thread_mutex);
+        scrub_thread_stop.store(true);
+    }
 
-    StackError code_err = STK_NO_ERROR;
-        if (stk->index == 0)
+    scrub_thread_wakeup.notify_all();
+    pthread_join(scrub_thread, NULL);
+    scrub_thread_running = false;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackScrubNow(const StackScrubConfig* config)
+{
+    const StackScrubConfig default_config = StackScrubDefaultConfig();
+    return StackScrubPass(config != NULL ? config : &default_config, false);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* StackScrubThread(void* config)
+{
+    const StackScrubConfig* scrub_config = (const StackScrubConfig*) config;
+
+    while (!scrub_thread_stop.load())
+    {
+        StackScrubPass(scrub_config, true);
+
+        std::unique_lock<std::mutex> lock(scrub_thread_mutex);
+        scrub_thread_wakeup.wait_for(lock, std::chrono::milliseconds(scrub_config->pass_interval_ms),
+                                     []{ return scrub_thread_stop.load(); });
+    }
+
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackScrubPass(const StackScrubConfig* config, bool is_background)
+{
+    std::lock_guard<std::mutex> pass_lock(scrub_pass_mutex);
+
+    stack_scrub_pass_t pass = {};
+    pass.config = config;
+    pass.is_background = is_background;
+    pass.slice_start = StackScrubClock();
+
+    // Lock of the list is not kept while stack is scrubbed, destruction of stack moves cursor past it
+    std::unique_lock<std::mutex> lock(scrub_stacks_mutex);
+    scrub_cursor = scrub_stacks;
+
+    while (scrub_cursor != NULL && !(is_background && scrub_thread_stop.load()))
+    {
+        stack_t* stk = scrub_cursor;
+        scrub_target.store(stk);
+        lock.unlock();
+
+        StackScrubStack(stk, &pass);
+
+        scrub_target.store(NULL, std::memory_order_release);
+        StackScrubNotify(&pass);
+
+        if (StackScrubClock() - pass.slice_start >= SCRUB_SLICE_TIME)
+            StackScrubRest(&pass);
+
+        lock.lock();
+        if (scrub_cursor == stk)
+            scrub_cursor = stk->scrub_next;
+    }
+
+    return (StackError) pass.found;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackScrubStack(stack_t* stk, stack_scrub_pass_t* pass)
+{
+    // Scrubber has set scrub_target before this load and owner makes sequence odd before it frees memory and
+    // then looks at scrub_target, so either stack is left here or its memory is not freed until scrubber leaves it
+    unsigned long long seq = __atomic_load_n(&stk->scrub_seq, __ATOMIC_SEQ_CST);
+    if ((seq & 1) != 0)
+        return;
+
+    stack_t snap;
+    memcpy((void*) &snap, stk, sizeof(stack_t));
+    if (!StackScrubUnchanged(stk, seq))
+        return;
+
+    bool is_clean = stk->scrub_is_seen && seq == stk->scrub_seen_seq;
+    bool is_left = false;
+    unsigned int code_err = StackScrubCheck(stk, &snap, seq, is_clean, pass, &is_left);
+    if (is_left || !StackScrubUnchanged(stk, seq))
+        return;
+
+    #ifndef NHASH_MODE
+        // Structure of changed stack can't be checked, its hash is compared on the next passes until it is changed
+        if (!is_clean)
+            stk->scrub_hash_struct = StackCalcStructHash(&snap);
+    #endif
+
+    stk->scrub_is_seen = true;
+    stk->scrub_seen_seq = seq;
+    pass->found |= code_err;
+
+    if (code_err != stk->scrub_reported)
+    {
+        stk->scrub_reported = code_err;
+        if (code_err != STK_NO_ERROR)
+            StackScrubWriteReport(pass, &snap, code_err);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned int StackScrubCheck(stack_t* stk, const stack_t* snap, unsigned long long seq, bool is_clean,
+                                    stack_scrub_pass_t* pass, bool* is_left)
+{
+    unsigned int code_err = STK_NO_ERROR;
+
+    #ifndef NCANARIES_MODE
+        if (snap->left_canary != STACK_CANARY_VALUE || snap->right_canary != STACK_CANARY_VALUE)
+            code_err |= STKSTRUCT_CANARY_CORRUPT_ERR;
+    #endif
+
+    #ifndef NHASH_MODE
+        if (is_clean && StackCalcStructHash(snap) != stk->scrub_hash_struct)
+            code_err |= STKSTRUCT_INFO_CORRUPT_ERR;
+    #endif
+
+    // Elements of stack with wrong bounds are not read
+    if (snap->data == NULL)
+        return code_err | NULL_STK_DATA_PTR_ERR;
+    if (snap->capacity < 0)
+        return code_err | NEG_STK_CAPACITY_ERR;
+    if (snap->index < 0)
+        return code_err | STACK_ANTIOVERFLOW_ERR;
+    if (snap->index > snap->capacity)
+        return code_err | STACK_OVERFLOW_ERR;
+
+    if (snap->index < StackCalcShrinkIndex(snap, snap->capacity) - 1)
+        code_err |= STACK_USES_MUCH_MEM_ERR;
+
+    #ifndef NCANARIES_MODE
+        if (!(snap->storage == STK_STORAGE_GUARDED && snap->data != stk->small_data) &&
+            (*((const canary_t*) ((const char*) snap->data - SIZE_OF_CANARY)) != DATA_CANARY_VALUE
+             || *((const canary_t*) (snap->data + snap->capacity)) != DATA_CANARY_VALUE))
+            code_err |= STKDATA_CANARY_CORRUPT_ERR;
+    #endif
+
+    #ifndef NHASH_MODE
+        bool is_rehashed = !is_clean || (pass->config->clean_period != 0 &&
+                                         ++stk->scrub_clean_passes >= pass->config->clean_period);
+        if (is_rehashed)
         {
-            stk->code_errors |= STACK_ANTIOVERFLOW_ERR;
-            STACK_HASH(stk);
+            stk->scrub_clean_passes = 0;
+            if (StackScrubHash(stk, snap->data, snap->index, seq, pass, is_left) != snap->hash_data)
+                code_err |= STKDATA_INFO_CORRUPT_ERR;
+        }
+    #else
+        (void) is_clean;
+        (void) pass;
+    #endif
 
-            #ifndef NDEBUG
-                StackDump(StackPtrXOR((size_t) stk), __FILE__, __LINE__);
-            #endif
+    // Number of lower segments is known, so corrupted links can't make the walk endless
+    const stack_segment_t* segment = snap->top_segment != NULL ? snap->top_segment->prev : NULL;
+    for (size_t i = snap->lower_size / STK_SEGMENT_CAPACITY; i > 0 && segment != NULL && !*is_left; i--)
+    {
+        #ifndef NCANARIES_MODE
+            if (segment->left_canary != DATA_CANARY_VALUE || segment->right_canary != DATA_CANARY_VALUE)
+                code_err |= STKDATA_CANARY_CORRUPT_ERR;
+        #endif
 
-            return STACK_ANTIOVERFLOW_ERR;
+        #ifndef NHASH_MODE
+            if (is_rehashed &&
+                StackScrubHash(stk, segment->data, STK_SEGMENT_CAPACITY, seq, pass, is_left) != segment->hash_data)
+                code_err |= STKDATA_INFO_CORRUPT_ERR;
+        #endif
+
+        if (!StackScrubUnchanged(stk, seq))
+            *is_left = true;
+
+        segment = segment->prev;
+    }
+
+    if (snap->top_segment != NULL && (segment != NULL || snap->lower_size % STK_SEGMENT_CAPACITY != 0))
+        code_err |= STKSTRUCT_INFO_CORRUPT_ERR;
+
+    return code_err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NHASH_MODE
+static unsigned long StackScrubHash(const stack_t* stk, const StackElem_t* data, stk_index_t number_of_elems,
+                                    unsigned long long seq, stack_scrub_pass_t* pass, bool* is_left)
+{
+    unsigned long calc_hash = 0;
+
+    for (stk_index_t first = 0; first < number_of_elems; first += SCRUB_CHUNK_CAPACITY)
+    {
+        stk_index_t chunk = number_of_elems - first < SCRUB_CHUNK_CAPACITY ? number_of_elems - first :
+                                                                             SCRUB_CHUNK_CAPACITY;
+        calc_hash += StackCalcHashDelta(data, first, first + chunk);
+
+        if (!StackScrubUnchanged(stk, seq) ||
+            (StackScrubClock() - pass->slice_start >= SCRUB_SLICE_TIME && !StackScrubPause(stk, seq, pass)))
+        {
+            *is_left = true;
+            break;
         }
+    }
 
-    if (stk->index == stk->capacity / RESIZE_COEF_DOWN && (size_t) stk->capacity > DEFAULT_STK_CAPACITY)
-        if ((code_err = StackResizeDown(stk)) != STK_NO_ERROR)
-            return code_err;
+    return calc_hash;
+}
 
-    --stk->index;
-    *var = stk->data[stk->index];
-    stk->data[stk->index] = 0;
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool StackScrubPause(const stack_t* stk, unsigned long long seq, stack_scrub_pass_t* pass)
+{
+    scrub_target.store(NULL, std::memory_order_release);
+    StackScrubRest(pass);
+
+    if (pass->is_background && scrub_thread_stop.load())
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(scrub_stacks_mutex);
+        if (scrub_cursor != stk)
+            return false;
+
+        scrub_target.store(stk);
+    }
+
+    // Memory that was read before the pause may be freed, so stack is scrubbed further only if it wasn't changed
+    return __atomic_load_n(&stk->scrub_seq, __ATOMIC_SEQ_CST) == seq;
+}
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackScrubRest(stack_scrub_pass_t* pass)
+{
+    double budget = pass->config->cpu_budget > 0 ? pass->config->cpu_budget : DEFAULT_SCRUB_CPU_BUDGET;
+    if (budget < 1)
+    {
+        double pause = (StackScrubClock() - pass->slice_start) * (1 - budget) / budget;
+
+        std::unique_lock<std::mutex> lock(scrub_thread_mutex);
+        scrub_thread_wakeup.wait_for(lock, std::chrono::duration<double>(pause),
+                                     [pass]{ return pass->is_background && scrub_thread_stop.load(); });
+    }
 
-    STACK_HASH(stk);
-    STACK_VERIFY(stk);
-    return STK_NO_ERROR;
+    pass->slice_start = StackScrubClock();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-StackError StackPush(size_t stk_enc_ptr, StackElem_t value)
+static void StackScrubWriteReport(stack_scrub_pass_t* pass, const stack_t* snap, unsigned int code_err)
 {
-    stack_t* stk = (stack_t*) StackPtrXOR(stk_enc_ptr);
+    pass->is_reported = true;
+    pass->report_handle = snap->handle;
+    pass->report_err = code_err;
 
-    STACK_VERIFY(stk);
+    pass->is_dumped = false;
 
-    StackError code_err = STK_NO_ERROR;
-    if (stk->index == stk->capacity)
-        if ((code_err = StackResizeUp(stk)) != STK_NO_ERROR)
-            return code_err;
+    if (pass->config->report_fd < 0)
+        return;
 
-    stk->data[stk->index] = value;
-    ++stk->index;
+    // Copy points to memory of stack, so dump is written while scrubber is still its scrub_target
+    // (dump goes through buffer on the thread stack, so it doesn't allocate)
+    stack_t dumped;
+    memcpy((void*) &dumped, snap, sizeof(stack_t));
+    dumped.code_errors |= code_err;
 
-    STACK_HASH(stk);
-    STACK_VERIFY(stk);
-    return STK_NO_ERROR;
+    pass->is_dumped = StackDumpWith(&dumped, pass->config->report_fd, &pass->config->dump_options, NULL, 0) ==
+                      STK_NO_ERROR;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-static size_t StackPtrXOR(size_t ptr_to_decode)
+static void StackScrubNotify(stack_scrub_pass_t* pass)
 {
-    return ptr_to_decode ^ key_for_ptr_dec;
+    if (!pass->is_reported)
+        return;
+
+    StackScrubReport report = {pass->report_handle, (StackError) pass->report_err, pass->is_dumped};
+
+    if (pass->config->on_failure != NULL)
+        pass->config->on_failure(&report, pass->config->ctx);
+    else if (!pass->is_dumped)
+        dprintf(STDERR_FILENO, "STACK ERROR: %u found by scrubber in stack 0x%lx\n",
+                pass->report_err, pass->report_handle);
+
+    pass->is_reported = false;
+    pass->is_dumped = false;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-static StackError StackResizeDown(stack_t* stk)
+static void StackScrubRegister(stack_t* stk)
 {
-    STACK_VERIFY(stk);
+    if (stk->protection != STK_PROTECT_SCRUBBED)
+        return;
 
-    stk->capacity /= RESIZE_COEF;
+    std::lock_guard<std::mutex> lock(scrub_stacks_mutex);
 
-    #ifndef NCANARIES_MODE
-        char* new_data = (char*) realloc((char*) stk->data - SIZE_OF_CANARY,
-                                        stk->capacity*sizeof(StackElem_t) + SIZE_OF_CANARY*2) + SIZE_OF_CANARY;
+    stk->scrub_prev = NULL;
+    stk->scrub_next = scrub_stacks;
+    if (scrub_stacks != NULL)
+        scrub_stacks->scrub_prev = stk;
+    scrub_stacks = stk;
+}
 
-        if (new_data == NULL)
-        {
-            stk->code_errors |= OUT_OF_MEMORY_ERR;
-            return OUT_OF_MEMORY_ERR;
-        }
+//----------------------------------------------------------------------------------------------------------------------
 
-        *((canary_t*) (new_data + stk->capacity*sizeof(StackElem_t))) = DATA_CANARY_VALUE;
-    #else
-        StackElem_t* new_data = (StackElem_t*) realloc(stk->data, stk->capacity*sizeof(StackElem_t));
+static void StackScrubUnregister(stack_t* stk)
+{
+    {
+        std::lock_guard<std::mutex> lock(scrub_stacks_mutex);
 
-        if (new_data == NULL)
-            return OUT_OF_MEMORY_ERR;
-    #endif
+        // Links are checked instead of protection level, so stack with corrupted one is still removed
+        if (stk->scrub_prev == NULL && scrub_stacks != stk)
+            return;
 
-    stk->data = (StackElem_t*) new_data;
+        StackScrubUnlink(stk);
+    }
 
-    STACK_HASH(stk);
-    STACK_VERIFY(stk);
-    return STK_NO_ERROR;
+    // Scrubber takes stacks only from the list, so it is waited for only if it reads this stack now
+    while (scrub_target.load(std::memory_order_acquire) == stk)
+        sched_yield();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
-static StackError StackResizeUp(stack_t* stk)
+static void StackScrubUnlink(stack_t* stk)
 {
-    STACK_VERIFY(stk);
-
-    stk->capacity *= RESIZE_COEF;
+    __atomic_store_n(&stk->scrub_seq, stk->scrub_seq | 1, __ATOMIC_SEQ_CST);
 
-    #ifndef NCANARIES_MODE
-        char* new_data = (char*) realloc((char*) stk->data - SIZE_OF_CANARY,
-                                        stk->capacity*sizeof(StackElem_t) + SIZE_OF_CANARY*2) + SIZE_OF_CANARY;
-
-        if (new_data == NULL)
-        {
-            stk->code_errors |= OUT_OF_MEMORY_ERR;
-            return OUT_OF_MEMORY_ERR;
-        }
+    if (scrub_cursor == stk)
+        scrub_cursor = stk->scrub_next;
 
-        *((canary_t*) (new_data + stk->capacity*sizeof(StackElem_t))) = DATA_CANARY_VALUE;
-    #else
-        StackElem_t* new_data = (StackElem_t*) realloc(stk->data, stk->capacity*sizeof(StackElem_t));
+    if (stk->scrub_prev != NULL)
+        stk->scrub_prev->scrub_next = stk->scrub_next;
+    else
+        scrub_stacks = stk->scrub_next;
+    if (stk->scrub_next != NULL)
+        stk->scrub_next->scrub_prev = stk->scrub_prev;
 
-        if (new_data == NULL)
-            return OUT_OF_MEMORY_ERR;
-    #endif
+    stk->scrub_prev = stk->scrub_next = NULL;
+}
 
-    memset(new_data + stk->index*sizeof(StackElem_t), 0, (stk->capacity - stk->index)*sizeof(StackElem_t));
+//----------------------------------------------------------------------------------------------------------------------
 
-    stk->data = (StackElem_t*) new_data;
+static void StackScrubWait(const stack_t* stk)
+{
+    if (stk->protection != STK_PROTECT_SCRUBBED)
+        return;
 
-    STACK_HASH(stk);
-    STACK_VERIFY(stk);
-    return STK_NO_ERROR;
+    // Sequence of stack was made odd before, so the fence orders it with the load of scrub_target
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (scrub_target.load(std::memory_order_acquire) == stk)
+        sched_yield();
 }
 
 
@@ -442,11 +4537,8 @@ static StackError StackResizeUp(stack_t* stk)
 
 static StackError StackVerifyCritical(stack_t* stk)
 {
-    if (stk == NULL || (size_t) stk == key_for_ptr_dec)
-    {
-        stk->code_errors |= NULL_STK_STRUCT_PTR_ERR;
+    if (stk == NULL)
         return NULL_STK_STRUCT_PTR_ERR;
-    }
 
     if (stk->data == NULL)
     {
@@ -482,14 +4574,93 @@ static StackError StackVerifyAll(stack_t* stk)
     if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
         return code_err;
 
-    #ifndef NDEBUG
-        if (stk->index < stk->capacity / RESIZE_COEF_DOWN - 1 && (size_t) stk->capacity > DEFAULT_STK_CAPACITY)
+    code_err = StackVerifyFast(stk);
+
+    #ifndef NHASH_MODE
+        if (StackCalcDataHash(stk->data, stk->index) != stk->hash_data)
+        {
+            stk->code_errors |= STKDATA_INFO_CORRUPT_ERR;
+            code_err = STKDATA_INFO_CORRUPT_ERR;
+        }
+    #endif
+
+    if (stk->top_segment != NULL)
+    {
+        StackError segment_err = STK_NO_ERROR;
+        for (const stack_segment_t* segment = stk->top_segment->prev; segment != NULL; segment = segment->prev)
+            if ((segment_err = StackVerifySegment(stk, segment)) != STK_NO_ERROR)
+                code_err = segment_err;
+    }
+
+    return code_err;
+}
+
+
+static StackError StackVerifyFast(stack_t* stk)
+{
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+        return code_err;
+
+    // Stack that has just been downsized keeps one element less than the bound
+    if (stk->index < StackCalcShrinkIndex(stk, stk->capacity) - 1)
+    {
+        stk->code_errors |= STACK_USES_MUCH_MEM_ERR;
+        code_err = STACK_USES_MUCH_MEM_ERR;
+    }
+
+    StackError canaries_err = STK_NO_ERROR;
+    if ((canaries_err = StackVerifyCanaries(stk)) != STK_NO_ERROR)
+        code_err = canaries_err;
+
+    #ifndef NHASH_MODE
+        unsigned long temp_hash_struct = stk->hash_struct;
+        STACK_HASH(stk);
+
+        if (temp_hash_struct != stk->hash_struct)
+        {
+            stk->code_errors |= STKSTRUCT_INFO_CORRUPT_ERR;
+            code_err = STKSTRUCT_INFO_CORRUPT_ERR;
+        }
+    #endif
+
+    return code_err;
+}
+
+
+static StackError StackVerifyDataStep(stack_t* stk)
+{
+    #ifndef NHASH_MODE
+        if (stk->checked_size + STK_HASH_CHUNK_CAPACITY <= stk->index)
+        {
+            stk->checked_hash += StackCalcChunksHash(stk->data + stk->checked_size, 1,
+                                                     stk->checked_size / STK_HASH_CHUNK_CAPACITY);
+            stk->checked_size += STK_HASH_CHUNK_CAPACITY;
+            return STK_NO_ERROR;
+        }
+
+        unsigned long calc_hash = stk->checked_hash + StackCalcElemsHash(stk->data + stk->checked_size,
+                                                                         stk->index - stk->checked_size,
+                                                                         stk->checked_size);
+        StackHashCheckRestart(stk);
+
+        if (calc_hash != stk->hash_data)
         {
-            stk->code_errors |= STACK_USES_MUCH_MEM_ERR;
-            code_err = STACK_USES_MUCH_MEM_ERR;
+            stk->code_errors |= STKDATA_INFO_CORRUPT_ERR;
+            return STKDATA_INFO_CORRUPT_ERR;
         }
+    #else
+        (void) stk;
     #endif
 
+    return STK_NO_ERROR;
+}
+
+
+static StackError StackVerifyCanaries(stack_t* stk)
+{
+    StackError code_err = STK_NO_ERROR;
+
     #ifndef NCANARIES_MODE
         if (stk->left_canary != STACK_CANARY_VALUE || stk->right_canary != STACK_CANARY_VALUE)
         {
@@ -497,35 +4668,112 @@ static StackError StackVerifyAll(stack_t* stk)
             code_err = STKSTRUCT_CANARY_CORRUPT_ERR;
         }
 
-        if (*((canary_t*) ((char*) stk->data - SIZE_OF_CANARY)) != DATA_CANARY_VALUE
-            || *((canary_t*) (stk->data + stk->capacity)) != DATA_CANARY_VALUE)
+        // Guarded data has no canaries: its guard pages fault at once
+        if (!(stk->storage == STK_STORAGE_GUARDED && !StackIsInline(stk)) &&
+            (*((canary_t*) ((char*) stk->data - SIZE_OF_CANARY)) != DATA_CANARY_VALUE
+             || *((canary_t*) (stk->data + stk->capacity)) != DATA_CANARY_VALUE))
         {
             stk->code_errors |= STKDATA_CANARY_CORRUPT_ERR;
             code_err = STKDATA_CANARY_CORRUPT_ERR;
         }
+    #else
+        (void) stk;
     #endif
 
-    #ifndef NHASH_MODE
-        unsigned long temp_hash_data = stk->hash_data, temp_hash_struct = stk->hash_struct;
-        STACK_HASH(stk);
+    return code_err;
+}
 
-        if (temp_hash_struct != stk->hash_struct)
+
+static StackError StackVerifySegment(stack_t* stk, const stack_segment_t* segment)
+{
+    StackError code_err = STK_NO_ERROR;
+
+    #ifndef NCANARIES_MODE
+        if (stk->protection >= STK_PROTECT_CANARIES &&
+            (segment->left_canary != DATA_CANARY_VALUE || segment->right_canary != DATA_CANARY_VALUE))
         {
-            stk->code_errors |= STKSTRUCT_INFO_CORRUPT_ERR;
-            code_err = STKSTRUCT_INFO_CORRUPT_ERR;
+            stk->code_errors |= STKDATA_CANARY_CORRUPT_ERR;
+            code_err = STKDATA_CANARY_CORRUPT_ERR;
         }
+    #endif
 
-        if (temp_hash_data != stk->hash_data)
+    #ifndef NHASH_MODE
+        if (StackVerifiesHash(stk) && StackCalcDataHash(segment->data, STK_SEGMENT_CAPACITY) != segment->hash_data)
         {
             stk->code_errors |= STKDATA_INFO_CORRUPT_ERR;
             code_err = STKDATA_INFO_CORRUPT_ERR;
         }
     #endif
 
+    (void) stk;
+    (void) segment;
     return code_err;
 }
 
 
+static StackError StackVerifyDeep(stack_t* stk)
+{
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+        return code_err;
+
+    switch (stk->protection)
+    {
+        case STK_PROTECT_NONE:      return STK_NO_ERROR;
+        case STK_PROTECT_CANARIES:
+        case STK_PROTECT_SCRUBBED:  return StackVerifyCanaries(stk);
+        case STK_PROTECT_SAMPLED:
+        case STK_PROTECT_FULL:
+        default:                    return StackVerifyAll(stk);
+    }
+}
+
+
+static StackError StackVerifyOp(stack_t* stk)
+{
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+        return code_err;
+
+    switch (stk->protection)
+    {
+        case STK_PROTECT_NONE:
+        case STK_PROTECT_SCRUBBED:  return STK_NO_ERROR;
+        case STK_PROTECT_CANARIES:  return StackVerifyCanaries(stk);
+        case STK_PROTECT_SAMPLED:
+            if (++stk->ops_since_verify < stk->verify_period)
+                return STK_NO_ERROR;
+
+            stk->ops_since_verify = 0;
+            return StackVerifyAll(stk);
+        case STK_PROTECT_FULL:
+        default:
+            if ((code_err = StackVerifyFast(stk)) != STK_NO_ERROR)
+                return code_err;
+
+            return StackVerifyDataStep(stk);
+    }
+}
+
+
+static StackError StackVerifyStep(stack_t* stk)
+{
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = StackVerifyCritical(stk)) != STK_NO_ERROR)
+        return code_err;
+
+    switch (stk->protection)
+    {
+        case STK_PROTECT_NONE:
+        case STK_PROTECT_SAMPLED:
+        case STK_PROTECT_SCRUBBED:  return STK_NO_ERROR;
+        case STK_PROTECT_CANARIES:  return StackVerifyCanaries(stk);
+        case STK_PROTECT_FULL:
+        default:                    return StackVerifyFast(stk);
+    }
+}
+
+
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 //----------------------------------------------------------------------------------------------------------------
 // ------> !!! INPUT/OUTPUT PART !!! <----------------------------------------------------------------------
@@ -533,49 +4781,283 @@ static StackError StackVerifyAll(stack_t* stk)
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
 
+StackError StackDumpTo(size_t stk_enc_ptr, int fd, const StackDumpOptions* options)
+{
+    const StackDumpOptions default_options = {STK_DUMP_TEXT, 0, false};
+
+    const stack_t* stk = StackFromHandle(stk_enc_ptr);
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    return StackDumpWith(stk, fd, options != NULL ? options : &default_options, NULL, 0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 #ifndef NDEBUG
     void StackDump(size_t stk_enc_ptr, const char* file_name, int line_number)
     {
-        stack_t* stk = (stack_t*) StackPtrXOR(stk_enc_ptr);
+        const stack_t* stk = StackFromHandle(stk_enc_ptr);
+        if (stk == NULL)
+        {
+            printf(RED "STACK ERROR: %u\n"
+                   "handle 0x%lx " BLU "at %s:%d" WHT " is not a handle of live stack\n\n",
+                   STACK_BAD_HANDLE_ERR, stk_enc_ptr, file_name, line_number);
+            return;
+        }
+
+        StackDumpStk(stk, file_name, line_number);
+    }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    static void StackDumpStk(const stack_t* stk, const char* file_name, int line_number)
+    {
+        const StackDumpOptions options = {STK_DUMP_TEXT, 0, true};
+
+        // Dump is written past stdio, so text that was printed before it must be written first
+        fflush(stdout);
+        StackDumpWith(stk, STDOUT_FILENO, &options, file_name, line_number);
+    }
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError StackDumpWith(const stack_t* stk, int fd, const StackDumpOptions* options,
+                                const char* file_name, int line_number)
+{
+    stack_dump_buf_t buf = {};
+    buf.fd = fd;
+    buf.options = options;
+    buf.is_first_run = true;
+
+    bool is_json = options->format == STK_DUMP_JSON;
+    bool colors = options->colors && !is_json;
+
+    #define DUMP_STR_(str)    StackDumpStr(&buf, (str))
+    #define DUMP_COLOR_(str)  StackDumpStr(&buf, colors ? (str) : "")
+
+    char handle_str[sizeof("0x") + 2*sizeof(size_t)] = {};
+    snprintf(handle_str, sizeof(handle_str), "0x%lx", stk->handle);
+
+    size_t size = stk->data != NULL ? StackSize(stk) : 0;
+    stk_index_t first_dumped = options->top_k != 0 && options->top_k < size ? (stk_index_t) (size - options->top_k) : 0;
+
+    if (is_json)
+    {
+        DUMP_STR_("{\"errors\":");      StackDumpNum(&buf, stk->code_errors);
+        DUMP_STR_(",\"handle\":");      StackDumpStr(&buf, handle_str, true);
+        DUMP_STR_(",\"file\":");        StackDumpStr(&buf, file_name, true);
+        DUMP_STR_(",\"line\":");        StackDumpNum(&buf, line_number);
+        #ifndef NDEBUG
+            DUMP_STR_(",\"name\":");        StackDumpStr(&buf, stk->stk_name, true);
+            DUMP_STR_(",\"born_file\":");   StackDumpStr(&buf, stk->init_file, true);
+            DUMP_STR_(",\"born_line\":");   StackDumpNum(&buf, stk->init_line);
+            DUMP_STR_(",\"born_func\":");   StackDumpStr(&buf, stk->init_func, true);
+        #endif
+        DUMP_STR_(",\"storage\":");     StackDumpNum(&buf, stk->storage);
+        DUMP_STR_(",\"protection\":");  StackDumpNum(&buf, stk->protection);
+        DUMP_STR_(",\"size\":");        StackDumpNum(&buf, (long long) size);
+        DUMP_STR_(",\"index\":");       StackDumpNum(&buf, stk->index);
+        DUMP_STR_(",\"capacity\":");    StackDumpNum(&buf, stk->capacity);
+        DUMP_STR_(",\"first\":");       StackDumpNum(&buf, first_dumped);
+        DUMP_STR_(",\"runs\":[");
+    }
+    else
+    {
+        DUMP_COLOR_(RED); DUMP_STR_("STACK ERROR: "); StackDumpNum(&buf, stk->code_errors);
+        #ifndef NDEBUG
+            DUMP_STR_("\nstack_t "); DUMP_COLOR_(MAG); DUMP_STR_(stk->stk_name);
+        #else
+            DUMP_STR_("\nstack_t"); DUMP_COLOR_(MAG);
+        #endif
+        DUMP_STR_(" ["); DUMP_STR_(handle_str); DUMP_STR_("]");
+        if (file_name != NULL)
+        {
+            DUMP_STR_(" "); DUMP_COLOR_(BLU); DUMP_STR_("at "); DUMP_STR_(file_name); DUMP_STR_(":");
+            StackDumpNum(&buf, line_number);
+        }
+        #ifndef NDEBUG
+            DUMP_STR_(" "); DUMP_COLOR_(YEL); DUMP_STR_("born at "); DUMP_STR_(stk->init_file); DUMP_STR_(":");
+            StackDumpNum(&buf, stk->init_line); DUMP_STR_(" ("); DUMP_STR_(stk->init_func); DUMP_STR_(")");
+        #endif
+        DUMP_STR_("\n"); DUMP_COLOR_(GRN);
+        DUMP_STR_("{\n\tindex    = "); StackDumpNum(&buf, stk->index);
+        DUMP_STR_("\n\tcapacity = "); StackDumpNum(&buf, stk->capacity);
+        DUMP_STR_("\n\n"); DUMP_COLOR_(MAG); DUMP_STR_("\tdata:\n"); DUMP_COLOR_(CYN); DUMP_STR_("\t{\n");
+    }
+
+    // Blocks below the first dumped element are skipped (every block but the top one is a full segment)
+    stack_blocks_t blocks = {};
+    StackBlocksBegin(stk, &blocks, NULL, 0);
+    if (blocks.number_of_blocks > 0 && (size_t) first_dumped / STK_SEGMENT_CAPACITY > 0)
+    {
+        size_t skipped = (size_t) first_dumped / STK_SEGMENT_CAPACITY;
+        blocks.next_block = skipped < blocks.number_of_blocks - 1 ? skipped : blocks.number_of_blocks - 1;
+    }
+
+    // Free cells of the top block are dumped with elements unless only the top elements are asked for
+    stk_index_t readable_cells = StackReadableCells(stk);
+    stk_index_t top_cells = options->top_k == 0 || stk->index > readable_cells ? readable_cells :
+                                                   stk->index > 0 ? stk->index : 0;
+    stk_index_t block_first = (stk_index_t) (blocks.next_block*STK_SEGMENT_CAPACITY);
+    stk_index_t run_first = -1;
+    StackElem_t run_value = 0;
+
+    struct iovec block_iov = {};
+    while (StackBlocksNext(&blocks, &block_iov))
+    {
+        const StackElem_t* block = (const StackElem_t*) block_iov.iov_base;
+        stk_index_t block_size = blocks.next_block == blocks.number_of_blocks ? top_cells : STK_SEGMENT_CAPACITY;
+        stk_index_t pos = first_dumped > block_first ? first_dumped - block_first : 0;
 
-        int idx_first_of_same = 0;
-        char index_string[MAX_TEMP_DUMP_STR_LEN] = {};
+        // Runs are found by word-wise comparison, so long runs of the same value cost almost nothing
+        while (pos < block_size)
+        {
+            if (run_first < 0 || block[pos] != run_value)
+            {
+                if (run_first >= 0)
+                    StackDumpRun(&buf, run_first, block_first + pos - 1, run_value);
 
-        #define PRINT_CELLS_VALUE_(idx)                                             \
-            {                                                                       \
-                if (idx_first_of_same == (idx))                                     \
-                    sprintf(index_string, "*[%d]", (idx));                          \
-                else                                                                \
-                    sprintf(index_string, "*[%d - %d]", idx_first_of_same, (idx));  \
-                printf("\t\t%-12s  =  %lld\n", index_string, stk->data[idx]);       \
-                idx_first_of_same = (idx + 1);                                      \
+                run_first = block_first + pos;
+                run_value = block[pos];
             }
 
+            pos += (stk_index_t) MyRunLength((const uint64_t*) block + pos, (size_t) (block_size - pos));
+        }
+
+        block_first += block_size;
+    }
+
+    if (run_first >= 0)
+        StackDumpRun(&buf, run_first, block_first - 1, run_value);
+
+    if (is_json)
+        DUMP_STR_("]}\n");
+    else
+    {
+        DUMP_STR_("\t}\n"); DUMP_COLOR_(GRN); DUMP_STR_("}"); DUMP_COLOR_(WHT); DUMP_STR_("\n\n");
+    }
+
+    #undef DUMP_STR_
+    #undef DUMP_COLOR_
 
-        printf(RED "STACK ERROR: %u\n", stk->code_errors);
-        printf("stack_t " MAG "%s [0x%lx] " BLU "at %s:%d " YEL "born at %s:%d (%s)\n",
-               stk->stk_name, stk_enc_ptr,
-               file_name, line_number,
-               stk->init_file, stk->init_line, stk->init_func);
-        printf(GRN "{\n"
-               "%-10s= %d\n"
-               "%-10s= %d\n"
-               "\n"
-               MAG "\tdata:\n"
-               CYN "\t{\n",
-               "\tindex", stk->index,
-               "\tcapacity", stk->capacity);
+    StackDumpFlush(&buf);
 
-        for (int i = 1; i < stk->capacity; i++)
+    return buf.failed ? STACK_FILE_ERR : STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackDumpRun(stack_dump_buf_t* buf, stk_index_t first, stk_index_t last, StackElem_t value)
+{
+    if (buf->options->format == STK_DUMP_JSON)
+    {
+        StackDumpStr(buf, buf->is_first_run ? "{\"from\":" : ",{\"from\":");
+        StackDumpNum(buf, first);
+        StackDumpStr(buf, ",\"to\":");
+        StackDumpNum(buf, last);
+        StackDumpStr(buf, ",\"value\":");
+        StackDumpNum(buf, value);
+        StackDumpStr(buf, "}");
+    }
+    else
+    {
+        size_t index_len = 0;
+        StackDumpStr(buf, "\t\t*[");
+        index_len += StackDumpNum(buf, first);
+        if (first != last)
         {
-            if (!IsEqual(stk->data[i], stk->data[i-1]))
-                PRINT_CELLS_VALUE_(i-1);
+            StackDumpStr(buf, " - ");
+            index_len += StackDumpNum(buf, last) + sizeof(" - ") - 1;
         }
-        PRINT_CELLS_VALUE_(stk->capacity-1);
+        StackDumpStr(buf, "]");
 
-        printf("\t}\n"
-            GRN "}" WHT "\n\n");
+        index_len += sizeof("*[]") - 1;
+        for (; index_len < STK_DUMP_INDEX_WIDTH; index_len++)
+            StackDumpStr(buf, " ");
 
-        #undef PRINT_CELLS_VALUE
+        StackDumpStr(buf, "  =  ");
+        StackDumpNum(buf, value);
+        StackDumpStr(buf, "\n");
     }
-#endif
+
+    buf->is_first_run = false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackDumpBytes(stack_dump_buf_t* buf, const char* str, size_t size)
+{
+    while (size > 0)
+    {
+        if (buf->size == STK_DUMP_BUF_SIZE)
+            StackDumpFlush(buf);
+
+        size_t piece_size = STK_DUMP_BUF_SIZE - buf->size < size ? STK_DUMP_BUF_SIZE - buf->size : size;
+        memcpy(buf->data + buf->size, str, piece_size);
+        buf->size += piece_size;
+        str += piece_size;
+        size -= piece_size;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackDumpStr(stack_dump_buf_t* buf, const char* str, bool is_json)
+{
+    if (!is_json)
+    {
+        StackDumpBytes(buf, str != NULL ? str : "(null)", strlen(str != NULL ? str : "(null)"));
+        return;
+    }
+
+    if (str == NULL)
+    {
+        StackDumpBytes(buf, "null", sizeof("null") - 1);
+        return;
+    }
+
+    StackDumpBytes(buf, "\"", 1);
+    for (; *str != '\0'; str++)
+    {
+        unsigned char symbol = (unsigned char) *str;
+        if (symbol == '"' || symbol == '\\')
+        {
+            StackDumpBytes(buf, "\\", 1);
+            StackDumpBytes(buf, str, 1);
+        }
+        else if (symbol < ' ')
+        {
+            char escaped[sizeof("\\u0000")] = {};
+            snprintf(escaped, sizeof(escaped), "\\u%04x", symbol);
+            StackDumpBytes(buf, escaped, sizeof(escaped) - 1);
+        }
+        else
+            StackDumpBytes(buf, str, 1);
+    }
+    StackDumpBytes(buf, "\"", 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t StackDumpNum(stack_dump_buf_t* buf, long long value)
+{
+    char digits[STK_NUM_TEXT_SIZE] = {};
+    size_t len = StackFormatNum(digits, value, 10);
+
+    StackDumpBytes(buf, digits, len);
+
+    return len;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void StackDumpFlush(stack_dump_buf_t* buf)
+{
+    struct iovec iov = {buf->data, buf->size};
+    if (!buf->failed && buf->size > 0 && StackWriteAll(buf->fd, &iov, 1) != STK_NO_ERROR)
+        buf->failed = true;
+
+    buf->size = 0;
+}
@@ -6,6 +6,10 @@
 #ifndef STACK_H
 #define STACK_H
 
+#include <stddef.h>
+
+#include <atomic>
+
 typedef long long int StackElem_t;
 
 #ifndef NDEBUG
@@ -14,12 +18,26 @@ typedef long long int StackElem_t;
 
     /// @brief Creates stack structure depending on debug mode
     #define CREATE_STACK(stk_enc_ptr) StackInit(stk_enc_ptr, #stk_enc_ptr, __FILE__, __LINE__, __PRETTY_FUNCTION__)
+
+    /// @brief Creates stack structure with given config depending on debug mode
+    #define CREATE_STACK_EX(stk_enc_ptr, config) \
+        StackInitEx(stk_enc_ptr, config, #stk_enc_ptr, __FILE__, __LINE__, __PRETTY_FUNCTION__)
+
+    /// @brief Creates (or opens) stack that is kept in file depending on debug mode
+    #define CREATE_STACK_FILE(stk_enc_ptr, path, config) \
+        StackInitFile(stk_enc_ptr, path, config, #stk_enc_ptr, __FILE__, __LINE__, __PRETTY_FUNCTION__)
 #else
     /// @brief Is replaced with it's arguements only in debug mode
     #define ON_DEBUG(...)
 
     /// @brief Creates stack structure depending on debug mode
     #define CREATE_STACK(stk_enc_ptr) StackInit(stk_enc_ptr)
+
+    /// @brief Creates stack structure with given config depending on debug mode
+    #define CREATE_STACK_EX(stk_enc_ptr, config) StackInitEx(stk_enc_ptr, config)
+
+    /// @brief Creates (or opens) stack that is kept in file depending on debug mode
+    #define CREATE_STACK_FILE(stk_enc_ptr, path, config) StackInitFile(stk_enc_ptr, path, config)
 #endif
 
 /// @brief Enumerated types of stack errors or 0 for "no error"-state
@@ -39,10 +57,171 @@ enum StackError
     STKDATA_CANARY_CORRUPT_ERR    =  1024u,
     STKSTRUCT_INFO_CORRUPT_ERR    =  2048u,
     STKDATA_INFO_CORRUPT_ERR      =  4096u,
+    STACK_FILE_ERR                =  8192u,
+    STACK_BAD_HANDLE_ERR          =  16384u,  ///< Handle is wrong or its stack was destructed
+    STACK_BAD_MARK_ERR            =  32768u,  ///< Mark is not of this stack or its depth was discarded
+    STACK_BAD_OPERAND_ERR         =  65536u,  ///< Operation of stack machine can't be done with its operands
+                                              ///< (division by zero, shift out of range), stack is not changed
+};
+
+/// @brief What is checked on every stack operation (features that are compiled out by
+///        NCANARIES_MODE or NHASH_MODE are not checked on any level)
+enum StackProtection
+{
+    STK_PROTECT_NONE      = 0,  ///< Only null pointers and index bounds
+    STK_PROTECT_CANARIES  = 1,  ///< Bounds and canaries of structure and data
+    STK_PROTECT_SAMPLED   = 2,  ///< Hashes are maintained, all stack is verified every verify_period operations
+    STK_PROTECT_FULL      = 3,  ///< Canaries and structure hash (it covers data hash) on every operation, every
+                                ///< operation rehashes 16 elements, so data hash is verified every size/16 + 1
+                                ///< operations (and on every resize)
+    STK_PROTECT_SCRUBBED  = 4,  ///< Operations only maintain data hash and mark stack as changed, canaries and
+                                ///< hashes are verified by background scrubber (see StackScrubStart)
+};
+
+/// @brief How elements of the stack are kept in memory
+enum StackStorage
+{
+    STK_STORAGE_CONTIGUOUS  = 0,  ///< One block that is reallocated on growth (elements are copied and rehashed)
+    STK_STORAGE_SEGMENTED   = 1,  ///< Linked fixed-size segments, existing elements are never moved (push and pop
+                                  ///< are O(1) in the worst case, growth policy and StackReserve are ignored)
+    STK_STORAGE_FILE        = 2,  ///< Memory-mapped file that keeps elements after the process exits (set by
+                                  ///< StackInitFile, can't be chosen in config)
+    STK_STORAGE_VIRTUAL     = 3,  ///< Address space for max_capacity elements is reserved on init, pages are
+                                  ///< committed as stack grows and given back to system as it shrinks
+                                  ///< (elements are never moved, huge pages are used where available)
+    STK_STORAGE_GUARDED     = 4,  ///< One block between PROT_NONE pages: access right out of bounds of capacity
+                                  ///< faults at once and is reported by SIGSEGV handler (only the first 1024
+                                  ///< live guarded stacks are reported, no data canaries, no per-operation cost, capacity is rounded to pages, elements are moved by
+                                  ///< mremap without copying). Data is not taken from allocator, so such stack
+                                  ///< must be destructed by StackDtor
+};
+
+/// @brief Set of memory functions (see stack_alloc.h)
+struct StackAllocator;
+
+/// @brief How capacity of the stack changes when it gets full or almost empty
+struct StackGrowthPolicy
+{
+    double growth_factor;     ///< Capacity is multiplied by it when stack is full (must be greater than 1)
+    double shrink_threshold;  ///< Capacity is divided by growth_factor when less than capacity / shrink_threshold
+                              ///< elements are left (not less than growth_factor, bigger values make less reallocs)
+    size_t min_capacity;      ///< Capacity is never less than it (stack is created with this capacity)
+    bool   shrink_disabled;   ///< Capacity never decreases by itself (only StackShrinkToFit makes it less)
 };
 
-/// @brief Sructure with stack info
-struct stack_t;
+/// @brief Settings of the stack that are chosen on its initialization
+struct StackConfig
+{
+    StackProtection       protection;     ///< What is checked on every operation
+    unsigned int          verify_period;  ///< Number of operations between full verifications (STK_PROTECT_SAMPLED)
+    const StackAllocator* allocator;      ///< Where structure and data are allocated (NULL for malloc), copied by StackInit
+    StackGrowthPolicy     growth;         ///< How capacity changes (default is doubling and halving at quarter)
+    StackStorage          storage;        ///< How elements are kept in memory
+    size_t                max_capacity;   ///< Number of elements that address space is reserved for
+                                          ///< (STK_STORAGE_VIRTUAL only, 0 for 2^32 elements)
+    bool                  keep_discarded; ///< StackRewind doesn't zero discarded elements (they stay in memory
+                                          ///< until overwritten, rewind of stack without hashes is O(1) then)
+};
+
+/// @brief Depth of stack that StackRewind truncates it back to (mark is valid while stack is not less than it)
+struct StackMarkToken
+{
+    size_t             depth;
+    size_t             slot;    ///< Place of mark in the stack
+    unsigned long long serial;  ///< Number of mark in the stack (slots of discarded marks are reused)
+};
+
+/// @brief Built-in operations of StackBinaryOp (lhs is the second element from the top, rhs is the top one)
+enum StackBinaryOpKind
+{
+    STK_OP_ADD    = 0,   ///< Integer operations wrap around on overflow
+    STK_OP_SUB    = 1,
+    STK_OP_MUL    = 2,
+    STK_OP_DIV    = 3,   ///< Rounds to zero (STACK_BAD_OPERAND_ERR for zero rhs or overflow)
+    STK_OP_MOD    = 4,   ///< Sign of result is the sign of lhs (STACK_BAD_OPERAND_ERR as for division)
+    STK_OP_AND    = 5,
+    STK_OP_OR     = 6,
+    STK_OP_XOR    = 7,
+    STK_OP_SHL    = 8,   ///< STACK_BAD_OPERAND_ERR for rhs out of [0, 63]
+    STK_OP_SHR    = 9,   ///< Arithmetic shift (STACK_BAD_OPERAND_ERR for rhs out of [0, 63])
+    STK_OP_LESS   = 10,  ///< 1 if lhs < rhs, 0 otherwise
+    STK_OP_EQUAL  = 11,  ///< 1 if lhs == rhs, 0 otherwise
+    STK_OP_MIN    = 12,
+    STK_OP_MAX    = 13,
+};
+
+/// @brief Binary operation of caller for StackBinaryOpFn (stack is not changed if it returns error)
+typedef StackError (*StackBinaryFunc)(StackElem_t lhs, StackElem_t rhs, StackElem_t* result, void* ctx);
+
+/// @brief Operation of caller for StackModifyTop (stack is not changed if it returns error)
+typedef StackError (*StackUnaryFunc)(StackElem_t value, StackElem_t* result, void* ctx);
+
+/// @brief Number of bits of StackError that verification failures are counted for
+const int STACK_ERROR_BITS = 17;
+
+/// @brief Counters of stack operations (they are always zero if statistics are compiled out by NSTATS_MODE)
+struct StackStats
+{
+    unsigned long long pushes;
+    unsigned long long pops;
+    unsigned long long resizes_up;
+    unsigned long long resizes_down;
+    unsigned long long bytes_reallocated;                  ///< Total size of data blocks (segments) given by resizes
+    unsigned long long high_water_mark;                    ///< Maximum number of elements (the biggest one for aggregate)
+    unsigned long long verify_failures[STACK_ERROR_BITS];  ///< Failed verifications by number of StackError bit
+    unsigned long long verify_cycles;                      ///< CPU ticks spent in verification (not counted for
+                                                           ///< STK_PROTECT_NONE, includes hashing done by it)
+    unsigned long long hash_cycles;                        ///< CPU ticks spent in recalculation of structure hash
+    unsigned long long number_of_stacks;                   ///< 1 for one stack, number of live stacks for aggregate
+};
+
+/// @brief Format of stack dump
+enum StackDumpFormat
+{
+    STK_DUMP_TEXT  = 0,  ///< Lines for people (the same as StackDump prints)
+    STK_DUMP_JSON  = 1,  ///< One JSON object per dump (for log pipelines)
+};
+
+/// @brief Settings of StackDumpTo
+struct StackDumpOptions
+{
+    StackDumpFormat format;
+    size_t          top_k;   ///< Number of the top elements that are dumped (0 for all elements and free cells)
+    bool            colors;  ///< Text is colored for terminal (STK_DUMP_TEXT only)
+};
+
+/// @brief Corruption that scrubber found in stack (its dump is already written to report_fd of config)
+struct StackScrubReport
+{
+    size_t      stk_enc_ptr;  ///< Handle of stack
+    StackError  code_err;     ///< Bits of errors that scrubber found
+    bool        is_dumped;    ///< Dump of stack with these errors was written to report_fd
+};
+
+/// @brief Function that scrubber calls when errors of stack change (it is called by scrubber thread)
+typedef void (*StackScrubCallback)(const StackScrubReport* report, void* ctx);
+
+/// @brief Settings of scrubber
+struct StackScrubConfig
+{
+    unsigned int       pass_interval_ms;  ///< Pause between passes over all stacks with STK_PROTECT_SCRUBBED
+    double             cpu_budget;        ///< Part of one CPU that scrubber takes at most, in (0, 1]
+                                          ///< (it sleeps after every millisecond of work to keep it)
+    unsigned int       clean_period;      ///< Elements of stacks that were not changed since the last pass are
+                                          ///< rehashed every clean_period passes (0 for never, their structure
+                                          ///< and canaries are verified on every pass)
+    StackScrubCallback on_failure;        ///< Is called after dump is written (NULL for none)
+    void*              ctx;               ///< Is given to on_failure
+    int                report_fd;         ///< Dump of stack with errors is written here by StackDumpTo right
+                                          ///< from stack memory (stderr by default, -1 for no dump)
+    StackDumpOptions   dump_options;      ///< Format of dump in report
+};
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets config that is used by StackInit (STK_PROTECT_FULL in debug mode, STK_PROTECT_NONE otherwise)
+    \return Default stack config
+    ----------------------------------------------------------------------------------------------------- */
+StackConfig StackDefaultConfig();
 
 /*! -----------------------------------------------------------------------------------------------------
     Destruct stack
@@ -58,6 +237,15 @@ StackError StackDtor      (size_t* stk_enc_ptr);
     ----------------------------------------------------------------------------------------------------- */
 StackError StackPop       (size_t stk_enc_ptr, StackElem_t* var);
 
+/*! -----------------------------------------------------------------------------------------------------
+    Extractes several values from stack at once (the stack is verified and rehashed once per call)
+    \param[in]   stk_enc_ptr      Encoded pointer to stack sructure
+    \param[out]  vars             Array where extracted values should be put (vars[0] is the top one)
+    \param[in]   number_of_elems  Number of values that should be extracted
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPopN      (size_t stk_enc_ptr, StackElem_t* vars, size_t number_of_elems);
+
 /*! -----------------------------------------------------------------------------------------------------
     Extractes value from stack
     \param[in]  stk_enc_ptr Encoded pointer to stack sructure
@@ -66,6 +254,195 @@ StackError StackPop       (size_t stk_enc_ptr, StackElem_t* var);
     ----------------------------------------------------------------------------------------------------- */
 StackError StackPush      (size_t stk_enc_ptr, StackElem_t value);
 
+/*! -----------------------------------------------------------------------------------------------------
+    Puts several values to stack at once (capacity grows once, the stack is verified and rehashed once per call)
+    \param[in]  stk_enc_ptr      Encoded pointer to stack sructure
+    \param[in]  values           Array of values that should be put to stack (values[0] is put first)
+    \param[in]  number_of_elems  Number of values
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPushN     (size_t stk_enc_ptr, const StackElem_t* values, size_t number_of_elems);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Makes capacity of stack at least given number of elements and keeps it so until StackShrinkToFit
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  capacity     Number of elements that should fit in stack without reallocations
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackReserve   (size_t stk_enc_ptr, size_t capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reduces capacity of stack to its size (or minimum capacity of its policy) and cancels StackReserve
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackShrinkToFit(size_t stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Marks current depth of stack (marks of the same depth are equal, number of live marks is
+    not more than size of stack)
+    \param[in]   stk_enc_ptr  Encoded pointer to stack sructure
+    \param[out]  token        Pointer to structure where mark should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackMark      (size_t stk_enc_ptr, StackMarkToken* token);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Discards all elements above the depth of mark at once: capacity is changed once, hash is updated
+    once, elements are zeroed unless keep_discarded is set in config (mark stays valid, marks that are
+    deeper than it become invalid)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  token        Mark given by StackMark
+    \return Type of stack error (STACK_BAD_MARK_ERR if stack was less than depth of mark after it
+            was given) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackRewind    (size_t stk_enc_ptr, const StackMarkToken* token);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Replaces two top elements of stack with result of built-in operation (lhs rhs -- lhs op rhs). Stack is
+    verified and rehashed once, element of lhs is rewritten in place, so capacity doesn't change back and forth
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  op           Operation
+    \return Type of stack error (STACK_BAD_OPERAND_ERR if operation can't be done, stack is not changed then)
+            or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackBinaryOp  (size_t stk_enc_ptr, StackBinaryOpKind op);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Replaces two top elements of stack with result of operation of caller as StackBinaryOp does
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  func         Operation
+    \param[in]  ctx          Is given to func
+    \return Type of stack error (error of func, stack is not changed then) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackBinaryOpFn(size_t stk_enc_ptr, StackBinaryFunc func, void* ctx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Replaces the top element of stack with result of operation of caller in place
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  func         Operation
+    \param[in]  ctx          Is given to func
+    \return Type of stack error (error of func, stack is not changed then) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackModifyTop (size_t stk_enc_ptr, StackUnaryFunc func, void* ctx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts copy of the top element to stack (a -- a a)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDup       (size_t stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts copy of the second element from the top to stack (a b -- a b a)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackOver      (size_t stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Exchanges two top elements of stack (a b -- b a)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackSwap      (size_t stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Moves the third element from the top to the top of stack (a b c -- b c a)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackRot       (size_t stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes size and hash of stack to its file and waits until the file is on disk (stack that was
+    not checkpointed after the last change may be found corrupted after a system crash)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \return Type of stack error or 0 for "no error"-state (nothing is done for stacks without file)
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackCheckpoint(size_t stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes binary snapshot of stack: versioned header (number of elements, capacity, hash of elements)
+    and elements from the bottom one. Elements are written by writev right from stack memory
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  fd           File descriptor (file, pipe or socket)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackSerialize  (size_t stk_enc_ptr, int fd);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Replaces elements of stack with ones from snapshot: capacity is changed once, elements are read
+    right into stack memory by chunks (chunks of file stack are given back to system, so snapshot
+    can be larger than RAM). Stack is left empty if snapshot is corrupted
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  fd           File descriptor (file, pipe or socket)
+    \return Type of stack error (STKSTRUCT_INFO_CORRUPT_ERR for wrong header, STKDATA_INFO_CORRUPT_ERR
+            for wrong or missing elements) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDeserialize(size_t stk_enc_ptr, int fd);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Writes stack info and runs of equal elements to file descriptor through big buffer
+    (works for corrupted stacks too, nothing is verified or allocated)
+    \param[in]  stk_enc_ptr  Encoded pointer to stack sructure
+    \param[in]  fd           File descriptor
+    \param[in]  options      Format and number of elements (NULL for text with all of them)
+    \return Type of stack error (STACK_FILE_ERR if dump was not written) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDumpTo(size_t stk_enc_ptr, int fd, const StackDumpOptions* options);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Copies statistics of stack (works for corrupted stacks too, nothing is verified)
+    \param[in]   stk_enc_ptr  Encoded pointer to stack sructure
+    \param[out]  stats        Pointer to structure where statistics should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackGetStats(size_t stk_enc_ptr, StackStats* stats);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Sums statistics of all live stacks of the process (can be called by any thread)
+    \param[out]  stats  Pointer to structure where statistics should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackGetGlobalStats(StackStats* stats);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Removes stacks that use allocator with given context from the list of live stacks and from scrubber
+    and frees their handles (is called by allocators that free stacks without StackDtor, see StackArenaDestroy)
+    \param[in]  allocator_ctx  Context of allocator
+    ----------------------------------------------------------------------------------------------------- */
+void StackForgetAllocator(const void* allocator_ctx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets default settings of scrubber (pass every 100 ms, 5% of CPU, dump of 16 top elements to stderr)
+    \return Default scrubber config
+    ----------------------------------------------------------------------------------------------------- */
+StackScrubConfig StackScrubDefaultConfig();
+
+/*! -----------------------------------------------------------------------------------------------------
+    Starts background thread that verifies canaries, structure and hashes of all stacks with
+    STK_PROTECT_SCRUBBED. Owners of stacks are never blocked by it: stack that is being changed is
+    left and scrubbed by the next pass (only free of memory that scrubber reads waits until it leaves it)
+    \param[in]  config  Settings of scrubber (NULL for default ones)
+    \return Type of stack error (STACK_ALREADY_INITED_ERR if scrubber runs) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackScrubStart(const StackScrubConfig* config);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Stops scrubber thread and waits for it (nothing is done if it doesn't run)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackScrubStop();
+
+/*! -----------------------------------------------------------------------------------------------------
+    Scrubs all stacks with STK_PROTECT_SCRUBBED once on calling thread (pass of scrubber thread
+    is finished first). Stacks that are being changed by other threads are skipped
+    \param[in]  config  Settings of scrubber (NULL for default ones, pass_interval_ms is ignored)
+    \return Bits of errors that were found in all stacks or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackScrubNow(const StackScrubConfig* config);
+
 #ifndef NDEBUG
     /*!
         Stack initializer
@@ -76,7 +453,27 @@ StackError StackPush      (size_t stk_enc_ptr, StackElem_t value);
                          int stk_init_line, const char* stk_init_func);
 
     /*!
-        Prints stack info (ONLY DEFINED IN DEBUG MODE)
+        Stack initializer with config
+        \param[in, out]  stk_enc_ptr  Encoded pointer to stack structure
+        \param[in]       config       Settings of the stack (NULL for default ones)
+        \return Type of stack error or 0 for "no error"-state
+        ----------------------------------------------------------------------------------------------------- */
+    StackError StackInitEx(size_t* stk_enc_ptr, const StackConfig* config, const char* stk_name,
+                           const char* stk_init_file, int stk_init_line, const char* stk_init_func);
+
+    /*!
+        Stack initializer that keeps elements in memory-mapped file (existing file is opened
+        without copying and verified, new one is created). File is locked until StackDtor
+        \param[in, out]  stk_enc_ptr  Encoded pointer to stack structure
+        \param[in]       path         Path to file
+        \param[in]       config       Settings of the stack (storage is ignored, NULL for default ones)
+        \return Type of stack error or 0 for "no error"-state
+        ----------------------------------------------------------------------------------------------------- */
+    StackError StackInitFile(size_t* stk_enc_ptr, const char* path, const StackConfig* config, const char* stk_name,
+                             const char* stk_init_file, int stk_init_line, const char* stk_init_func);
+
+    /*!
+        Prints stack info to stdout as StackDumpTo does (ONLY DEFINED IN DEBUG MODE)
         \param[in]  stk_enc_ptr  Encoded pointer to stack structure
         \param[in]  file_name    Name of file where function was called
         \param[in]  line_number  Number of line where function was called
@@ -89,6 +486,175 @@ StackError StackPush      (size_t stk_enc_ptr, StackElem_t value);
         \return Type of stack error or 0 for "no error"-state
         ----------------------------------------------------------------------------------------------------- */
     StackError StackInit(size_t* stk_enc_ptr);
+
+    /*! -----------------------------------------------------------------------------------------------------
+        Stack initializer with config
+        \param[in, out]  stk_enc_ptr  Encoded pointer to stack structure
+        \param[in]       config       Settings of the stack (NULL for default ones)
+        \return Type of stack error or 0 for "no error"-state
+        ----------------------------------------------------------------------------------------------------- */
+    StackError StackInitEx(size_t* stk_enc_ptr, const StackConfig* config);
+
+    /*! -----------------------------------------------------------------------------------------------------
+        Stack initializer that keeps elements in memory-mapped file (existing file is opened
+        without copying and verified, new one is created). File is locked until StackDtor
+        \param[in, out]  stk_enc_ptr  Encoded pointer to stack structure
+        \param[in]       path         Path to file
+        \param[in]       config       Settings of the stack (storage is ignored, NULL for default ones)
+        \return Type of stack error or 0 for "no error"-state
+        ----------------------------------------------------------------------------------------------------- */
+    StackError StackInitFile(size_t* stk_enc_ptr, const char* path, const StackConfig* config);
 #endif
 
+/// @brief Kinds of objects in handle table (handle of one kind is wrong for functions of another one)
+enum StackHandleKind
+{
+    STK_HANDLE_STACK      = 0,
+    STK_HANDLE_CONCURRENT = 1,
+    STK_HANDLE_DEQUE      = 2,
+    STK_HANDLE_ARRAY      = 3,
+    STK_HANDLE_PERSIST    = 4,
+};
+
+/// @brief Slot of handle table (handle is index of its slot with generation of the slot in high bits)
+struct StackHandleSlot
+{
+    std::atomic<void*>        object;      ///< Stack, deque, array etc. (NULL for free slot)
+    std::atomic<unsigned int> generation;  ///< Is changed when object is destructed, so its old handles become wrong
+                                           ///< (the lowest bits keep StackHandleKind of object)
+    unsigned int              next_free;   ///< Index of the next free slot + 1 (0 for the last one)
+};
+
+/// @brief Maximum number of live objects of all kinds
+const size_t STACK_MAX_HANDLES = (size_t) 1 << 20;
+
+/// @brief Handle bits that keep index of slot (generation is kept above them)
+const size_t STACK_HANDLE_INDEX_MASK = 0xFFFFFFFF;
+const int    STACK_HANDLE_GENERATION_SHIFT = 32;
+
+/// @brief Generation bits that keep StackHandleKind
+const unsigned int STACK_HANDLE_KIND_MASK = 0x7;
+
+/// @brief Handle table of all objects (one array, so lookups of many objects share cache lines)
+extern StackHandleSlot stk_handle_slots[STACK_MAX_HANDLES];
+
+/*! -----------------------------------------------------------------------------------------------------
+    Takes slot of handle table for object
+    \param[in]  object  Pointer to object
+    \param[in]  kind    Kind of object
+    \return Handle of object or 0 if the table is full
+    ----------------------------------------------------------------------------------------------------- */
+size_t StackHandleAlloc(void* object, StackHandleKind kind);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Frees slot of handle table, its generation is changed, so the handle becomes wrong
+    (wrong handle is ignored)
+    \param[in]  handle  Handle of object
+    ----------------------------------------------------------------------------------------------------- */
+void StackHandleFree(size_t handle);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds object by handle in O(1): memory of destructed object is never read
+    \param[in]  handle  Handle of object
+    \param[in]  kind    Kind that object must have
+    \return Pointer to object or NULL if handle is wrong, is of another kind or its object was destructed
+    ----------------------------------------------------------------------------------------------------- */
+inline void* StackHandleFind(size_t handle, StackHandleKind kind)
+{
+    size_t slot_idx = handle & STACK_HANDLE_INDEX_MASK;
+    if (__builtin_expect(slot_idx >= STACK_MAX_HANDLES, 0))
+        return NULL;
+
+    // Kind is put to generation of handle instead of its own, so one comparison checks both of them
+    unsigned int generation = ((unsigned int) (handle >> STACK_HANDLE_GENERATION_SHIFT) & ~STACK_HANDLE_KIND_MASK)
+                              | (unsigned int) kind;
+
+    const StackHandleSlot* slot = &stk_handle_slots[slot_idx];
+    if (__builtin_expect(slot->generation.load(std::memory_order_acquire) != generation, 0))
+        return NULL;
+
+    return slot->object.load(std::memory_order_relaxed);
+}
+
+/// @brief Beginning of stack structure (right after its left canary) that inline push and pop work with,
+///        the rest of structure is known only to stack.cpp
+struct StackFastView
+{
+    StackElem_t*       data;
+    long long          index;
+    long long          push_limit;       ///< Push is inline while index is less (0 if it never is)
+    long long          pop_limit;        ///< Pop is inline while index is greater (LLONG_MAX if it never is)
+    unsigned long long inline_pushes;    ///< Operations done by inline functions (they are added to StackGetStats)
+    unsigned long long inline_pops;
+    unsigned long long high_water_mark;  ///< Maximum number of elements of stack
+};
+
+#ifndef NCANARIES_MODE
+    /// @brief Offset of StackFastView in stack structure
+    const size_t STACK_FAST_VIEW_OFFSET = sizeof(unsigned long long);
+#else
+    /// @brief Offset of StackFastView in stack structure
+    const size_t STACK_FAST_VIEW_OFFSET = 0;
+#endif
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts value to stack without call if stack has STK_PROTECT_NONE, is not segmented and has free place
+    (otherwise StackPush is called, so results are the same)
+    \param[in]  stk_enc_ptr Encoded pointer to stack sructure
+    \param[in]  value       Value that should be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+inline StackError StackPushInline(size_t stk_enc_ptr, StackElem_t value)
+{
+    char* stk = (char*) StackHandleFind(stk_enc_ptr, STK_HANDLE_STACK);
+    if (__builtin_expect(stk == NULL, 0))
+        return StackPush(stk_enc_ptr, value);
+
+    StackFastView* view = (StackFastView*) (stk + STACK_FAST_VIEW_OFFSET);
+    if (__builtin_expect(view->index >= view->push_limit, 0))
+        return StackPush(stk_enc_ptr, value);
+
+    long long index = view->index;
+    view->data[index] = value;
+    view->index = index + 1;
+
+    #ifndef NSTATS_MODE
+        // Counters are read by StackGetGlobalStats of other threads
+        __atomic_store_n(&view->inline_pushes, view->inline_pushes + 1, __ATOMIC_RELAXED);
+        if ((unsigned long long) index >= view->high_water_mark)
+            __atomic_store_n(&view->high_water_mark, (unsigned long long) index + 1, __ATOMIC_RELAXED);
+    #endif
+
+    return STK_NO_ERROR;
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extractes value from stack without call if stack has STK_PROTECT_NONE, is not segmented and
+    doesn't need to be shrunk (otherwise StackPop is called, so results are the same)
+    \param[in]   stk_enc_ptr  Encoded pointer to stack sructure
+    \param[out]  var          Pointer to variable where extracted value should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+inline StackError StackPopInline(size_t stk_enc_ptr, StackElem_t* var)
+{
+    char* stk = (char*) StackHandleFind(stk_enc_ptr, STK_HANDLE_STACK);
+    if (__builtin_expect(stk == NULL, 0))
+        return StackPop(stk_enc_ptr, var);
+
+    StackFastView* view = (StackFastView*) (stk + STACK_FAST_VIEW_OFFSET);
+    if (__builtin_expect(view->index <= view->pop_limit, 0))
+        return StackPop(stk_enc_ptr, var);
+
+    long long index = view->index - 1;
+    *var = view->data[index];
+    view->data[index] = 0;
+    view->index = index;
+
+    #ifndef NSTATS_MODE
+        __atomic_store_n(&view->inline_pops, view->inline_pops + 1, __ATOMIC_RELAXED);
+    #endif
+
+    return STK_NO_ERROR;
+}
+
 #endif
@@ -0,0 +1,436 @@
+/*!
+    \file
+    Header-only stack of any element type with protection features chosen by template policy
+*/
+
+#ifndef STACK_TEMPLATE_H
+#define STACK_TEMPLATE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+#include <random>
+#include <type_traits>
+#include <utility>
+
+#include "stack.h"
+#include "stack_utils.h"
+
+/*! -----------------------------------------------------------------------------------------------------
+    Protection features of Stack (every disabled feature costs nothing)
+    \tparam  USE_CANARIES  Canaries around the structure and the data
+    \tparam  USE_HASH      Structure hash on every operation, data hash on every resize
+    \tparam  ENCODE_PTR    Pointer to data is stored XOR-ed with random key
+    ----------------------------------------------------------------------------------------------------- */
+template <bool USE_CANARIES, bool USE_HASH, bool ENCODE_PTR>
+struct StackPolicy
+{
+    static constexpr bool canaries   = USE_CANARIES;
+    static constexpr bool hash       = USE_HASH;
+    static constexpr bool encode_ptr = ENCODE_PTR;
+};
+
+/// @brief No checks at all (the same code as push/pop of plain array)
+typedef StackPolicy<false, false, false> StackPolicyNone;
+
+/// @brief Only canaries are checked
+typedef StackPolicy<true,  false, false> StackPolicyCanaries;
+
+/// @brief Everything that C stack does
+typedef StackPolicy<true,  true,  true>  StackPolicyFull;
+
+/*! -----------------------------------------------------------------------------------------------------
+    Stack of elements of type T (move-only types are supported, elements are moved on resize)
+    \tparam  T       Type of elements (must be trivially copyable if hash is used)
+    \tparam  Policy  Protection features (see StackPolicy)
+    ----------------------------------------------------------------------------------------------------- */
+template <typename T, typename Policy = StackPolicyFull>
+class Stack
+{
+    static_assert(!Policy::hash || std::is_trivially_copyable<T>::value,
+                  "Hash of stack can be used only with trivially copyable elements");
+
+    /// @brief Type of canaries on the stack sides
+    typedef uint64_t canary_t;
+
+    /// @brief Default number of elements that can be put to stack
+    static constexpr size_t DEFAULT_CAPACITY = 8;
+
+    /// @brief Coefficeint for upsizing stack
+    static constexpr size_t RESIZE_COEF      = 2;
+
+    /// @brief Coefficient that sets ratio of minimum and maximum number of elements (except default capacity)
+    static constexpr size_t RESIZE_COEF_DOWN = RESIZE_COEF * 2;
+
+    /// @brief Canary value for securing stack structure
+    static constexpr canary_t STACK_CANARY_VALUE = 0xBAD57ACCBAD57ACC;
+
+    /// @brief Canary value for securing stack elements
+    static constexpr canary_t DATA_CANARY_VALUE  = 0xBADDA7A0BADDA7A0;
+
+    /// @brief Alignment of data block
+    static constexpr size_t DATA_ALIGN = alignof(T) > alignof(canary_t) ? alignof(T) : alignof(canary_t);
+
+    /// @brief Offset of the first element from the beginning of data block
+    static constexpr size_t DATA_OFFSET = Policy::canaries ? DATA_ALIGN : 0;
+
+public:
+    Stack()
+    {
+        HashStruct();
+    }
+
+    Stack(const Stack&) = delete;
+    Stack& operator=(const Stack&) = delete;
+
+    Stack(Stack&& other) noexcept
+    {
+        Steal(other);
+    }
+
+    Stack& operator=(Stack&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            Steal(other);
+        }
+        return *this;
+    }
+
+    ~Stack()
+    {
+        Release();
+    }
+
+    /*!
+        Puts copy of value to stack
+        \param[in]  value  Value that should be put to stack
+        \return Type of stack error or 0 for "no error"-state
+    */
+    StackError Push(const T& value)
+    {
+        return Emplace(value);
+    }
+
+    /*!
+        Moves value to stack
+        \param[in]  value  Value that should be put to stack
+        \return Type of stack error or 0 for "no error"-state
+    */
+    StackError Push(T&& value)
+    {
+        return Emplace(std::move(value));
+    }
+
+    /*!
+        Constructs new element on the top of stack
+        \param[in]  args  Arguments of T constructor
+        \return Type of stack error or 0 for "no error"-state
+    */
+    template <typename... Args>
+    StackError Emplace(Args&&... args)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = VerifyOp()) != STK_NO_ERROR)
+            return code_err;
+
+        if (__builtin_expect(index_ == capacity_, 0))
+            if ((code_err = Resize(capacity_ == 0 ? DEFAULT_CAPACITY : capacity_ * RESIZE_COEF)) != STK_NO_ERROR)
+                return code_err;
+
+        T* data = Data();
+        new (data + index_) T(std::forward<Args>(args)...);
+
+        if constexpr (Policy::hash)
+            hash_data_ += HashElem(data[index_], index_);
+
+        ++index_;
+
+        HashStruct();
+        return STK_NO_ERROR;
+    }
+
+    /*!
+        Extractes value from stack
+        \param[out]  var  Pointer to variable where extracted value should be moved
+        \return Type of stack error or 0 for "no error"-state
+    */
+    StackError Pop(T* var)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = VerifyOp()) != STK_NO_ERROR)
+            return code_err;
+
+        if (__builtin_expect(index_ == 0, 0))
+        {
+            code_errors_ |= STACK_ANTIOVERFLOW_ERR;
+            HashStruct();
+            return STACK_ANTIOVERFLOW_ERR;
+        }
+
+        if (__builtin_expect(index_ == capacity_ / RESIZE_COEF_DOWN && capacity_ > DEFAULT_CAPACITY, 0))
+            if ((code_err = Resize(capacity_ / RESIZE_COEF)) != STK_NO_ERROR)
+                return code_err;
+
+        T* data = Data();
+        --index_;
+
+        if constexpr (Policy::hash)
+            hash_data_ -= HashElem(data[index_], index_);
+
+        *var = std::move(data[index_]);
+        data[index_].~T();
+
+        HashStruct();
+        return STK_NO_ERROR;
+    }
+
+    /*!
+        Verifies all stack including full recalculation of data hash
+        \return Type of stack error or 0 for "no error"-state
+    */
+    StackError Verify()
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = VerifyOp()) != STK_NO_ERROR)
+            return code_err;
+
+        if constexpr (Policy::hash)
+            if (CalcDataHash() != hash_data_)
+            {
+                code_errors_ |= STKDATA_INFO_CORRUPT_ERR;
+                return STKDATA_INFO_CORRUPT_ERR;
+            }
+
+        return STK_NO_ERROR;
+    }
+
+    /// @brief Number of elements in stack
+    size_t Size()       const { return index_; }
+
+    /// @brief Number of elements that can be put to stack without resize
+    size_t Capacity()   const { return capacity_; }
+
+    /// @brief All errors that have happened with this stack
+    unsigned int Errors() const { return code_errors_; }
+
+private:
+    canary_t left_canary_ = STACK_CANARY_VALUE;
+
+    unsigned long hash_struct_ = 0;
+    unsigned long hash_data_   = 0;
+
+    unsigned int code_errors_  = 0;
+    uintptr_t data_            = 0;
+    size_t index_              = 0;
+    size_t capacity_           = 0;
+
+    canary_t right_canary_ = STACK_CANARY_VALUE;
+
+    /// @brief Key to find real pointer using XOR
+    static uintptr_t PtrKey()
+    {
+        static const uintptr_t key = ((uintptr_t) std::random_device{}() << 32) | std::random_device{}();
+        return key;
+    }
+
+    T* Data() const
+    {
+        if constexpr (Policy::encode_ptr)
+            return data_ == 0 ? nullptr : (T*) (data_ ^ PtrKey());
+        else
+            return (T*) data_;
+    }
+
+    void SetData(T* data)
+    {
+        if constexpr (Policy::encode_ptr)
+            data_ = data == nullptr ? 0 : ((uintptr_t) data ^ PtrKey());
+        else
+            data_ = (uintptr_t) data;
+    }
+
+    /// @brief Offset of the right data canary from the first element
+    static size_t RightCanaryOffset(size_t capacity)
+    {
+        return (capacity * sizeof(T) + sizeof(canary_t) - 1) / sizeof(canary_t) * sizeof(canary_t);
+    }
+
+    static size_t BlockSize(size_t capacity)
+    {
+        if constexpr (Policy::canaries)
+            return DATA_OFFSET + RightCanaryOffset(capacity) + sizeof(canary_t);
+        else
+            return capacity * sizeof(T);
+    }
+
+    static canary_t* LeftDataCanary(T* data)
+    {
+        return (canary_t*) ((char*) data - sizeof(canary_t));
+    }
+
+    static canary_t* RightDataCanary(T* data, size_t capacity)
+    {
+        return (canary_t*) ((char*) data + RightCanaryOffset(capacity));
+    }
+
+    static unsigned long HashElem(const T& elem, size_t position)
+    {
+        if constexpr (sizeof(T) == sizeof(uint64_t))
+        {
+            uint64_t value = 0;
+            memcpy(&value, &elem, sizeof(value));
+            return MyHashElem(value, position);
+        }
+        else
+        {
+            unsigned char bytes[(sizeof(T) + 7) / 8 * 8] = {};
+            memcpy(bytes, &elem, sizeof(T));
+
+            unsigned long calc_hash = 0;
+            for (size_t i = 0; i < sizeof(bytes); i += sizeof(uint64_t))
+            {
+                uint64_t word = 0;
+                memcpy(&word, bytes + i, sizeof(word));
+                calc_hash = MyHashElem(word ^ calc_hash, position);
+            }
+            return calc_hash;
+        }
+    }
+
+    unsigned long CalcDataHash() const
+    {
+        const T* data = Data();
+        unsigned long calc_hash = 0;
+        for (size_t i = 0; i < index_; i++)
+            calc_hash += HashElem(data[i], i);
+        return calc_hash;
+    }
+
+    unsigned long CalcStructHash() const
+    {
+        unsigned long calc_hash = MyHashElem(data_, 0);
+        calc_hash = MyHashElem(calc_hash ^ index_,       1);
+        calc_hash = MyHashElem(calc_hash ^ capacity_,    2);
+        calc_hash = MyHashElem(calc_hash ^ code_errors_, 3);
+        calc_hash = MyHashElem(calc_hash ^ hash_data_,   4);
+        return calc_hash;
+    }
+
+    void HashStruct()
+    {
+        if constexpr (Policy::hash)
+            hash_struct_ = CalcStructHash();
+    }
+
+    StackError VerifyOp()
+    {
+        if constexpr (Policy::canaries)
+        {
+            if (left_canary_ != STACK_CANARY_VALUE || right_canary_ != STACK_CANARY_VALUE)
+            {
+                code_errors_ |= STKSTRUCT_CANARY_CORRUPT_ERR;
+                return STKSTRUCT_CANARY_CORRUPT_ERR;
+            }
+        }
+
+        if constexpr (Policy::hash)
+        {
+            if (CalcStructHash() != hash_struct_)
+            {
+                code_errors_ |= STKSTRUCT_INFO_CORRUPT_ERR;
+                return STKSTRUCT_INFO_CORRUPT_ERR;
+            }
+        }
+
+        if constexpr (Policy::canaries)
+        {
+            T* data = Data();
+            if (data != nullptr && (*LeftDataCanary(data)  != DATA_CANARY_VALUE ||
+                                    *RightDataCanary(data, capacity_) != DATA_CANARY_VALUE))
+            {
+                code_errors_ |= STKDATA_CANARY_CORRUPT_ERR;
+                return STKDATA_CANARY_CORRUPT_ERR;
+            }
+        }
+
+        return STK_NO_ERROR;
+    }
+
+    __attribute__((noinline))
+    StackError Resize(size_t new_capacity)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = Verify()) != STK_NO_ERROR)
+            return code_err;
+
+        char* new_block = (char*) ::operator new(BlockSize(new_capacity), std::align_val_t(DATA_ALIGN), std::nothrow);
+        if (new_block == nullptr)
+        {
+            code_errors_ |= OUT_OF_MEMORY_ERR;
+            HashStruct();
+            return OUT_OF_MEMORY_ERR;
+        }
+
+        T* new_data = (T*) (new_block + DATA_OFFSET);
+        if constexpr (Policy::canaries)
+        {
+            *LeftDataCanary(new_data) = DATA_CANARY_VALUE;
+            *RightDataCanary(new_data, new_capacity) = DATA_CANARY_VALUE;
+        }
+
+        T* old_data = Data();
+        for (size_t i = 0; i < index_; i++)
+        {
+            new (new_data + i) T(std::move(old_data[i]));
+            old_data[i].~T();
+        }
+
+        FreeBlock(old_data);
+        SetData(new_data);
+        capacity_ = new_capacity;
+
+        HashStruct();
+        return STK_NO_ERROR;
+    }
+
+    static void FreeBlock(T* data)
+    {
+        if (data != nullptr)
+            ::operator delete((char*) data - DATA_OFFSET, std::align_val_t(DATA_ALIGN));
+    }
+
+    void Release()
+    {
+        T* data = Data();
+        for (size_t i = 0; i < index_; i++)
+            data[i].~T();
+
+        FreeBlock(data);
+        SetData(nullptr);
+        index_ = capacity_ = 0;
+        hash_data_ = 0;
+        HashStruct();
+    }
+
+    void Steal(Stack& other)
+    {
+        T* data = other.Data();
+        code_errors_ = other.code_errors_;
+        index_       = other.index_;
+        capacity_    = other.capacity_;
+        hash_data_   = other.hash_data_;
+        SetData(data);
+
+        other.SetData(nullptr);
+        other.index_ = other.capacity_ = 0;
+        other.hash_data_ = 0;
+        other.HashStruct();
+
+        HashStruct();
+    }
+};
+
+#endif
@@ -0,0 +1,457 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "stack.h"
+#include "stack_alloc.h"
+
+/// @brief Binary logarithm of the smallest size class of pool
+static const int POOL_MIN_SHIFT = 4;
+
+/// @brief Binary logarithm of the biggest size class of pool (bigger blocks are taken from malloc)
+static const int POOL_MAX_SHIFT = 20;
+
+/// @brief Number of size classes of pool
+static const int POOL_NUMBER_OF_CLASSES = POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1;
+
+/// @brief Size class k holds blocks of (2^k + POOL_CLASS_EXTRA) bytes, so data blocks of stack
+///        (power-of-two capacity plus two canaries) fit without wasting half of the block
+static const size_t POOL_CLASS_EXTRA = 16;
+
+/// @brief Maximum number of bytes of one size class that thread keeps in its cache
+static const size_t POOL_THREAD_CACHE_BYTES = 256 * 1024;
+
+/// @brief Maximum number of blocks that are moved between thread cache and global list at once
+static const size_t POOL_TRANSFER_BATCH = 32;
+
+/// @brief Default size of arena chunk
+static const size_t ARENA_DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+/// @brief Alignment of blocks that arena gives
+static const size_t ARENA_ALIGN = 16;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Free block of pool (the first bytes of the block are used as a list node)
+struct PoolBlock
+{
+    PoolBlock* next;
+};
+
+/// @brief Global list of free blocks of one size class
+struct PoolClass
+{
+    std::mutex mutex;
+    PoolBlock* head;
+};
+
+/// @brief Free blocks that are cached by one thread
+struct PoolThreadCache
+{
+    PoolBlock* heads [POOL_NUMBER_OF_CLASSES];
+    size_t     counts[POOL_NUMBER_OF_CLASSES];
+
+    ~PoolThreadCache();
+};
+
+/// @brief Chunk of memory that arena takes from the system
+struct ArenaChunk
+{
+    ArenaChunk* prev;
+    size_t      size;
+    size_t      used;
+};
+
+/// @brief Arena with chunks of memory
+struct StackArena
+{
+    ArenaChunk* current;
+    size_t      chunk_size;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static PoolClass pool_classes[POOL_NUMBER_OF_CLASSES];
+
+static thread_local PoolThreadCache pool_thread_cache;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* MallocAlloc  (void* ctx, size_t size);
+static void* MallocRealloc(void* ctx, void* ptr, size_t old_size, size_t new_size);
+static void  MallocFree   (void* ctx, void* ptr, size_t size);
+
+static void* PoolAlloc    (void* ctx, size_t size);
+static void* PoolRealloc  (void* ctx, void* ptr, size_t old_size, size_t new_size);
+static void  PoolFree     (void* ctx, void* ptr, size_t size);
+
+static void* ArenaAlloc   (void* ctx, size_t size);
+static void* ArenaRealloc (void* ctx, void* ptr, size_t old_size, size_t new_size);
+static void  ArenaFree    (void* ctx, void* ptr, size_t size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds size class of pool for block
+    \param[in]  size  Size of block
+    \return Index of size class or -1 if block is too big for pool
+    ----------------------------------------------------------------------------------------------------- */
+static int PoolClassIndex(size_t size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Moves some blocks from thread cache to global list
+    \param[in]  class_idx        Index of size class
+    \param[in]  number_of_blocks Number of blocks that should be moved
+    ----------------------------------------------------------------------------------------------------- */
+static void  PoolFlush    (int class_idx, size_t number_of_blocks);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Rounds size up to arena alignment
+    \param[in]  size  Size of block
+    \return Rounded size
+    ----------------------------------------------------------------------------------------------------- */
+static size_t ArenaRound(size_t size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets pointer to the first byte of chunk that can be given away
+    \param[in]  chunk  Pointer to chunk
+    \return Pointer to memory of the chunk
+    ----------------------------------------------------------------------------------------------------- */
+static char* ArenaChunkData(ArenaChunk* chunk);
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! MALLOC PART !!! <----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+const StackAllocator* StackMallocAllocator()
+{
+    static const StackAllocator malloc_allocator = {MallocAlloc, MallocRealloc, MallocFree, NULL};
+    return &malloc_allocator;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* MallocAlloc(void* /* ctx */, size_t size)
+{
+    return malloc(size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* MallocRealloc(void* /* ctx */, void* ptr, size_t /* old_size */, size_t new_size)
+{
+    return realloc(ptr, new_size);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void MallocFree(void* /* ctx */, void* ptr, size_t /* size */)
+{
+    free(ptr);
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! POOL PART !!! <------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+const StackAllocator* StackPoolAllocator()
+{
+    static const StackAllocator pool_allocator = {PoolAlloc, PoolRealloc, PoolFree, NULL};
+    return &pool_allocator;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void StackPoolTrim()
+{
+    for (int class_idx = 0; class_idx < POOL_NUMBER_OF_CLASSES; class_idx++)
+    {
+        PoolBlock* head = NULL;
+        {
+            std::lock_guard<std::mutex> lock(pool_classes[class_idx].mutex);
+            head = pool_classes[class_idx].head;
+            pool_classes[class_idx].head = NULL;
+        }
+
+        while (head != NULL)
+        {
+            PoolBlock* next = head->next;
+            free(head);
+            head = next;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static int PoolClassIndex(size_t size)
+{
+    if (size <= ((size_t) 1 << POOL_MIN_SHIFT) + POOL_CLASS_EXTRA)
+        return 0;
+
+    int shift = 64 - __builtin_clzll(size - POOL_CLASS_EXTRA - 1);
+    if (shift > POOL_MAX_SHIFT)
+        return -1;
+
+    return shift - POOL_MIN_SHIFT;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* PoolAlloc(void* /* ctx */, size_t size)
+{
+    int class_idx = PoolClassIndex(size);
+    if (class_idx < 0)
+        return malloc(size);
+
+    PoolThreadCache* cache = &pool_thread_cache;
+    if (cache->heads[class_idx] == NULL)
+    {
+        // Refill the cache with one lock instead of locking on every allocation
+        PoolClass* pool_class = &pool_classes[class_idx];
+        std::lock_guard<std::mutex> lock(pool_class->mutex);
+
+        for (size_t i = 0; i < POOL_TRANSFER_BATCH && pool_class->head != NULL; i++)
+        {
+            PoolBlock* block = pool_class->head;
+            pool_class->head = block->next;
+
+            block->next = cache->heads[class_idx];
+            cache->heads[class_idx] = block;
+            ++cache->counts[class_idx];
+        }
+    }
+
+    PoolBlock* block = cache->heads[class_idx];
+    if (block == NULL)
+        return malloc(((size_t) 1 << (class_idx + POOL_MIN_SHIFT)) + POOL_CLASS_EXTRA);
+
+    cache->heads[class_idx] = block->next;
+    --cache->counts[class_idx];
+
+    return block;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* PoolRealloc(void* ctx, void* ptr, size_t old_size, size_t new_size)
+{
+    int old_class_idx = PoolClassIndex(old_size);
+    int new_class_idx = PoolClassIndex(new_size);
+
+    if (old_class_idx >= 0 && old_class_idx == new_class_idx)
+        return ptr;
+
+    if (old_class_idx < 0 && new_class_idx < 0)
+        return realloc(ptr, new_size);
+
+    void* new_ptr = PoolAlloc(ctx, new_size);
+    if (new_ptr == NULL)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    PoolFree(ctx, ptr, old_size);
+
+    return new_ptr;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void PoolFree(void* /* ctx */, void* ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+
+    int class_idx = PoolClassIndex(size);
+    if (class_idx < 0)
+    {
+        free(ptr);
+        return;
+    }
+
+    PoolThreadCache* cache = &pool_thread_cache;
+
+    PoolBlock* block = (PoolBlock*) ptr;
+    block->next = cache->heads[class_idx];
+    cache->heads[class_idx] = block;
+    ++cache->counts[class_idx];
+
+    size_t cache_limit = POOL_THREAD_CACHE_BYTES >> (class_idx + POOL_MIN_SHIFT);
+    if (cache->counts[class_idx] > (cache_limit > 0 ? cache_limit : 1))
+        PoolFlush(class_idx, cache->counts[class_idx] / 2 + 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void PoolFlush(int class_idx, size_t number_of_blocks)
+{
+    PoolThreadCache* cache = &pool_thread_cache;
+
+    PoolBlock* first = cache->heads[class_idx];
+    if (first == NULL)
+        return;
+
+    PoolBlock* last = first;
+    size_t moved = 1;
+    while (moved < number_of_blocks && last->next != NULL)
+    {
+        last = last->next;
+        ++moved;
+    }
+
+    cache->heads[class_idx] = last->next;
+    cache->counts[class_idx] -= moved;
+
+    PoolClass* pool_class = &pool_classes[class_idx];
+    std::lock_guard<std::mutex> lock(pool_class->mutex);
+
+    last->next = pool_class->head;
+    pool_class->head = first;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+PoolThreadCache::~PoolThreadCache()
+{
+    for (int class_idx = 0; class_idx < POOL_NUMBER_OF_CLASSES; class_idx++)
+        PoolFlush(class_idx, counts[class_idx]);
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! ARENA PART !!! <-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackArena* StackArenaCreate(size_t chunk_size)
+{
+    StackArena* arena = (StackArena*) calloc(1, sizeof(StackArena));
+    if (arena == NULL)
+        return NULL;
+
+    arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    return arena;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackAllocator StackArenaAllocator(StackArena* arena)
+{
+    StackAllocator arena_allocator = {ArenaAlloc, ArenaRealloc, ArenaFree, arena};
+    return arena_allocator;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void StackArenaDestroy(StackArena* arena)
+{
+    if (arena == NULL)
+        return;
+
+    // Stacks of arena are dropped without StackDtor, so they must not be counted as live ones
+    StackForgetAllocator(arena);
+
+    ArenaChunk* chunk = arena->current;
+    while (chunk != NULL)
+    {
+        ArenaChunk* prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    free(arena);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t ArenaRound(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static char* ArenaChunkData(ArenaChunk* chunk)
+{
+    return (char*) chunk + ArenaRound(sizeof(ArenaChunk));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* ArenaAlloc(void* ctx, size_t size)
+{
+    StackArena* arena = (StackArena*) ctx;
+    size = ArenaRound(size);
+
+    ArenaChunk* chunk = arena->current;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+
+        ArenaChunk* new_chunk = (ArenaChunk*) malloc(ArenaRound(sizeof(ArenaChunk)) + chunk_size);
+        if (new_chunk == NULL)
+            return NULL;
+
+        new_chunk->prev = chunk;
+        new_chunk->size = chunk_size;
+        new_chunk->used = 0;
+
+        arena->current = chunk = new_chunk;
+    }
+
+    void* ptr = ArenaChunkData(chunk) + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* ArenaRealloc(void* ctx, void* ptr, size_t old_size, size_t new_size)
+{
+    StackArena* arena = (StackArena*) ctx;
+    ArenaChunk* chunk = arena->current;
+
+    old_size = ArenaRound(old_size);
+    new_size = ArenaRound(new_size);
+
+    // The last block of the current chunk can grow (or shrink) in place
+    if (chunk != NULL && (char*) ptr + old_size == ArenaChunkData(chunk) + chunk->used
+                      && chunk->size - chunk->used + old_size >= new_size)
+    {
+        chunk->used = chunk->used - old_size + new_size;
+        return ptr;
+    }
+
+    if (new_size <= old_size)
+        return ptr;
+
+    void* new_ptr = ArenaAlloc(ctx, new_size);
+    if (new_ptr == NULL)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void ArenaFree(void* ctx, void* ptr, size_t size)
+{
+    StackArena* arena = (StackArena*) ctx;
+    ArenaChunk* chunk = arena->current;
+
+    size = ArenaRound(size);
+    if (chunk != NULL && (char*) ptr + size == ArenaChunkData(chunk) + chunk->used)
+        chunk->used -= size;
+}
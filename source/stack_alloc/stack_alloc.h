@@ -0,0 +1,63 @@
+/*!
+    \file
+    File with allocators that can be used by stacks (malloc, power-of-two pool and arena)
+*/
+
+#ifndef STACK_ALLOC_H
+#define STACK_ALLOC_H
+
+#include <stddef.h>
+
+/// @brief Set of functions that stack uses to get memory (sizes of blocks are always passed back to allocator)
+struct StackAllocator
+{
+    void* (*alloc)  (void* ctx, size_t size);                                    ///< Returns NULL if out of memory
+    void* (*realloc)(void* ctx, void* ptr, size_t old_size, size_t new_size);    ///< Returns NULL and keeps ptr if out of memory
+    void  (*free)   (void* ctx, void* ptr, size_t size);
+    void* ctx;                                                                   ///< Passed to every function
+};
+
+/// @brief Arena: memory of all stacks that use it is freed at once
+struct StackArena;
+
+/*!
+    Gets allocator that uses malloc, realloc and free (it is used by default)
+    \return Pointer to allocator
+*/
+const StackAllocator* StackMallocAllocator();
+
+/*!
+    Gets allocator with power-of-two size classes (the same as stack capacities are).
+    Every thread keeps a small cache of free blocks, so most operations don't lock anything.
+    Freed blocks are kept in pool until StackPoolTrim
+    \return Pointer to allocator
+*/
+const StackAllocator* StackPoolAllocator();
+
+/*!
+    Gives memory that is kept in global lists of pool back to the system
+    (caches of the threads are not touched)
+*/
+void StackPoolTrim();
+
+/*!
+    Creates arena
+    \param[in]  chunk_size  Size of memory chunks that arena takes from the system (0 for default one)
+    \return Pointer to arena or NULL if out of memory
+*/
+StackArena* StackArenaCreate(size_t chunk_size);
+
+/*!
+    Makes allocator that takes memory from arena
+    \param[in]  arena  Pointer to arena
+    \return Allocator (arena must outlive all stacks that use it)
+*/
+StackAllocator StackArenaAllocator(StackArena* arena);
+
+/*!
+    Frees all memory of arena at once. Stacks that used it must not be used (or destructed) after that
+    \param[in]  arena  Pointer to arena
+*/
+void StackArenaDestroy(StackArena* arena);
+
+#endif
@@ -0,0 +1,569 @@
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#include "stack_alloc.h"
+#include "stack_array.h"
+#include "stack_utils.h"
+
+/// @brief Type of canaries on the stack array sides
+typedef uint64_t canary_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Capacity of stacks of array that is created with zero minimum capacity
+static const long long DEFAULT_ARR_STK_CAPACITY = 1;
+
+/// @brief Maximum capacity of one stack of array
+static const long long MAX_ARR_STK_CAPACITY = (long long) 1 << 40;
+
+/// @brief Canary value for securing stack array structure
+static const canary_t ARR_CANARY_VALUE = 0xA77A7ACCA77A7ACC;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NCANARIES_MODE
+    /// @brief Sets up canaries in stack array structure or not depending on canaries mode
+    #define CANARIES_SET_UP(...) __VA_ARGS__
+#else
+    /// @brief Sets up canaries in stack array structure or not depending on canaries mode
+    #define CANARIES_SET_UP(...)
+#endif
+
+/// @brief Sructure with stack array info
+struct arr_t
+{
+    CANARIES_SET_UP(canary_t left_canary);
+
+    size_t number_of_stacks;
+
+    // Stack i keeps its elements in data[offset[i]], ..., data[offset[i] + index[i] - 1].
+    // All four arrays are parts of one block that is allocated right after the structure
+    long long*    index;
+    long long*    capacity;
+    size_t*       offset;
+    unsigned int* code_errors;
+
+    // Grown stack is moved to the end of used part, its old place is dropped until the block is repacked
+    StackElem_t* data;
+    size_t data_capacity;
+    size_t data_used;
+    size_t data_live;         ///< Sum of capacities of stacks
+
+    long long min_capacity;
+    double growth_factor;
+    StackAllocator allocator;
+
+    CANARIES_SET_UP(canary_t right_canary);
+};
+
+/// @brief Type of functions that extract value from every stack that is not empty
+typedef void (*ArrPopAllFunc_t)(arr_t* arr, StackElem_t* vars, unsigned char* popped, size_t first_stk);
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates size of block with indexes, capacities, offsets and errors of stacks
+    \param[in]  number_of_stacks  Number of stacks
+    \return Size of block in bytes
+    ----------------------------------------------------------------------------------------------------- */
+static inline size_t ArrInfoSize(size_t number_of_stacks)
+{
+    return number_of_stacks*(2*sizeof(long long) + sizeof(size_t) + sizeof(unsigned int));
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds stack array structure by its handle
+    \param[in]  arr_enc_ptr  Handle of stack array
+    \return Pointer to stack array structure or NULL if handle is wrong or array was destructed
+    ----------------------------------------------------------------------------------------------------- */
+static inline arr_t* StackArrayFromHandle(size_t arr_enc_ptr)
+{
+    return (arr_t*) StackHandleFind(arr_enc_ptr, STK_HANDLE_ARRAY);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates capacity of grown stack
+    \param[in]  arr       Pointer to stack array sructure
+    \param[in]  capacity  Capacity of stack
+    \return New capacity or 0 if stack can't be grown
+    ----------------------------------------------------------------------------------------------------- */
+static long long ArrGrownCapacity(const arr_t* arr, long long capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Moves stacks to new block of elements without dropped places, so at least min_free elements
+    can be given to stacks after it
+    \param[in, out]  arr       Pointer to stack array sructure
+    \param[in]       min_free  Number of elements that must be free
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError ArrRepack(arr_t* arr, size_t min_free);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Moves stack to the end of used part of block with new capacity (there must be enough free elements)
+    \param[in, out]  arr           Pointer to stack array sructure
+    \param[in]       stk_idx       Number of stack
+    \param[in]       new_capacity  New capacity of stack
+    ----------------------------------------------------------------------------------------------------- */
+static void ArrMove(arr_t* arr, size_t stk_idx, long long new_capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Grows one stack (block is repacked if it has no place for it)
+    \param[in, out]  arr      Pointer to stack array sructure
+    \param[in]       stk_idx  Number of stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError ArrGrow(arr_t* arr, size_t stk_idx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from every stack that is not empty starting from first_stk (scalar loop without branches)
+    \param[in, out]  arr        Pointer to stack array sructure
+    \param[out]      vars       Array where value of stack i is put to vars[i]
+    \param[out]      popped     Array of flags of stacks that were not empty (can be NULL)
+    \param[in]       first_stk  Number of the first stack
+    ----------------------------------------------------------------------------------------------------- */
+static void ArrPopAllScalar(arr_t* arr, StackElem_t* vars, unsigned char* popped, size_t first_stk);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from every stack that is not empty starting from first_stk (four stacks at once
+    by AVX2 gather, the rest of them by scalar loop)
+    \param[in, out]  arr        Pointer to stack array sructure
+    \param[out]      vars       Array where value of stack i is put to vars[i]
+    \param[out]      popped     Array of flags of stacks that were not empty (can be NULL)
+    \param[in]       first_stk  Number of the first stack
+    ----------------------------------------------------------------------------------------------------- */
+static void ArrPopAllAVX2(arr_t* arr, StackElem_t* vars, unsigned char* popped, size_t first_stk);
+
+/*!
+    Verifies pointer and canaries of stack array structure
+    \param[in]  arr  Pointer to stack array sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackArrayVerify(arr_t* arr);
+
+
+/// @brief Macro for verifying stack array
+#define STACK_ARRAY_VERIFY(arr)                                                  \
+    do {                                                                         \
+        StackError temp_code_err = STK_NO_ERROR;                                 \
+        if ((temp_code_err = StackArrayVerify(arr)) != STK_NO_ERROR)             \
+            return temp_code_err;                                                \
+    } while(0)
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! ARRAY PART !!! <-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackArrayInit(size_t* arr_enc_ptr, size_t number_of_stacks, const StackConfig* config)
+{
+    if (*arr_enc_ptr != 0)
+        return STACK_ALREADY_INITED_ERR;
+
+    StackConfig default_config = StackDefaultConfig();
+    if (config == NULL)
+        config = &default_config;
+
+    long long min_capacity = config->growth.min_capacity > 0 ? (long long) config->growth.min_capacity :
+                                                                DEFAULT_ARR_STK_CAPACITY;
+    if (min_capacity > MAX_ARR_STK_CAPACITY || number_of_stacks > (SIZE_MAX - sizeof(arr_t)) / ArrInfoSize(1) ||
+        (number_of_stacks > 0 && (size_t) min_capacity > SIZE_MAX / sizeof(StackElem_t) / number_of_stacks))
+        return STACK_OVERFLOW_ERR;
+
+    const StackAllocator allocator = config->allocator != NULL ? *config->allocator : *StackMallocAllocator();
+
+    arr_t* arr = (arr_t*) allocator.alloc(allocator.ctx, sizeof(arr_t) + ArrInfoSize(number_of_stacks));
+    if (arr == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    new (arr) arr_t();
+
+    #ifndef NCANARIES_MODE
+        arr->left_canary = arr->right_canary = ARR_CANARY_VALUE;
+    #endif
+
+    arr->allocator = allocator;
+    arr->number_of_stacks = number_of_stacks;
+    arr->min_capacity = min_capacity;
+    arr->growth_factor = config->growth.growth_factor > 1 ? config->growth.growth_factor : 2;
+
+    // Array without stacks has one element, so its data block is not empty and data pointer is not NULL
+    arr->data_capacity = number_of_stacks > 0 ? number_of_stacks*(size_t) min_capacity : 1;
+    arr->data = (StackElem_t*) allocator.alloc(allocator.ctx, arr->data_capacity*sizeof(StackElem_t));
+    if (arr->data == NULL)
+    {
+        allocator.free(allocator.ctx, arr, sizeof(arr_t) + ArrInfoSize(number_of_stacks));
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    char* info = (char*) (arr + 1);
+    arr->index       = (long long*)    info;
+    arr->capacity    = (long long*)    (info + number_of_stacks*sizeof(long long));
+    arr->offset      = (size_t*)       (info + number_of_stacks*2*sizeof(long long));
+    arr->code_errors = (unsigned int*) (info + number_of_stacks*(2*sizeof(long long) + sizeof(size_t)));
+
+    memset(arr->data, 0, arr->data_capacity*sizeof(StackElem_t));
+    for (size_t i = 0; i < number_of_stacks; i++)
+    {
+        arr->index[i] = 0;
+        arr->capacity[i] = min_capacity;
+        arr->offset[i] = i*(size_t) min_capacity;
+        arr->code_errors[i] = 0;
+    }
+
+    arr->data_used = arr->data_live = number_of_stacks*(size_t) min_capacity;
+
+    if ((*arr_enc_ptr = StackHandleAlloc(arr, STK_HANDLE_ARRAY)) == 0)
+    {
+        allocator.free(allocator.ctx, arr->data, arr->data_capacity*sizeof(StackElem_t));
+        allocator.free(allocator.ctx, arr, sizeof(arr_t) + ArrInfoSize(number_of_stacks));
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArrayDtor(size_t* arr_enc_ptr)
+{
+    arr_t* arr = StackArrayFromHandle(*arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    StackHandleFree(*arr_enc_ptr);
+
+    StackAllocator allocator = arr->allocator;
+    allocator.free(allocator.ctx, arr->data, arr->data_capacity*sizeof(StackElem_t));
+    allocator.free(allocator.ctx, arr, sizeof(arr_t) + ArrInfoSize(arr->number_of_stacks)); arr = NULL;
+
+    *arr_enc_ptr = 0;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArrayPush(size_t arr_enc_ptr, size_t stk_idx, StackElem_t value)
+{
+    arr_t* arr = StackArrayFromHandle(arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    if (stk_idx >= arr->number_of_stacks)
+        return STACK_BAD_HANDLE_ERR;
+
+    if (arr->index[stk_idx] == arr->capacity[stk_idx])
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = ArrGrow(arr, stk_idx)) != STK_NO_ERROR)
+        {
+            arr->code_errors[stk_idx] |= code_err;
+            return code_err;
+        }
+    }
+
+    arr->data[arr->offset[stk_idx] + (size_t) arr->index[stk_idx]++] = value;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArrayPop(size_t arr_enc_ptr, size_t stk_idx, StackElem_t* var)
+{
+    arr_t* arr = StackArrayFromHandle(arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    if (stk_idx >= arr->number_of_stacks)
+        return STACK_BAD_HANDLE_ERR;
+
+    if (arr->index[stk_idx] == 0)
+    {
+        arr->code_errors[stk_idx] |= STACK_ANTIOVERFLOW_ERR;
+        return STACK_ANTIOVERFLOW_ERR;
+    }
+
+    size_t pos = arr->offset[stk_idx] + (size_t) --arr->index[stk_idx];
+    *var = arr->data[pos];
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArrayPushAll(size_t arr_enc_ptr, const StackElem_t* values)
+{
+    arr_t* arr = StackArrayFromHandle(arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    const size_t number_of_stacks = arr->number_of_stacks;
+
+    // Full stacks are grown before the main loop: place for all of them is made by one repack
+    size_t grow_size = 0;
+    for (size_t i = 0; i < number_of_stacks; i++)
+        if (arr->index[i] == arr->capacity[i])
+            grow_size += (size_t) ArrGrownCapacity(arr, arr->capacity[i]);
+
+    StackError code_err = STK_NO_ERROR;
+    if (grow_size > 0 && arr->data_used + grow_size > arr->data_capacity)
+        code_err = ArrRepack(arr, grow_size);
+
+    for (size_t i = 0; i < number_of_stacks && grow_size > 0; i++)
+    {
+        if (arr->index[i] != arr->capacity[i])
+            continue;
+
+        long long new_capacity = ArrGrownCapacity(arr, arr->capacity[i]);
+        if (code_err == STK_NO_ERROR && new_capacity > 0)
+            ArrMove(arr, i, new_capacity);
+        else
+            arr->code_errors[i] |= new_capacity > 0 ? code_err : STACK_OVERFLOW_ERR;
+    }
+
+    // Stack that couldn't be grown writes its top element back, so the loop has no branches
+    StackElem_t*       __restrict data     = arr->data;
+    long long*         __restrict index    = arr->index;
+    const long long*   __restrict capacity = arr->capacity;
+    const size_t*      __restrict offset   = arr->offset;
+    const StackElem_t* __restrict new_values = values;
+
+    long long not_pushed = 0;
+    for (size_t i = 0; i < number_of_stacks; i++)
+    {
+        long long stk_index = index[i];
+        long long has_place = stk_index < capacity[i];
+        size_t pos = offset[i] + (size_t) (stk_index - 1 + has_place);
+
+        data[pos] = has_place ? new_values[i] : data[pos];
+        index[i] = stk_index + has_place;
+        not_pushed += 1 - has_place;
+    }
+
+    if (not_pushed == 0)
+        return STK_NO_ERROR;
+
+    return code_err != STK_NO_ERROR ? code_err : STACK_OVERFLOW_ERR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArrayPopAll(size_t arr_enc_ptr, StackElem_t* vars, unsigned char* popped)
+{
+    static const ArrPopAllFunc_t pop_all_func = MyHashAlgoSupported(HASH_ALGO_AVX2) ? ArrPopAllAVX2 : ArrPopAllScalar;
+
+    arr_t* arr = StackArrayFromHandle(arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    pop_all_func(arr, vars, popped, 0);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArraySize(size_t arr_enc_ptr, size_t stk_idx, size_t* size)
+{
+    arr_t* arr = StackArrayFromHandle(arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    if (stk_idx >= arr->number_of_stacks)
+        return STACK_BAD_HANDLE_ERR;
+
+    *size = (size_t) arr->index[stk_idx];
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackArrayErrors(size_t arr_enc_ptr, size_t stk_idx, unsigned int* code_errors)
+{
+    arr_t* arr = StackArrayFromHandle(arr_enc_ptr);
+
+    STACK_ARRAY_VERIFY(arr);
+
+    if (stk_idx >= arr->number_of_stacks)
+        return STACK_BAD_HANDLE_ERR;
+
+    *code_errors = arr->code_errors[stk_idx];
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static long long ArrGrownCapacity(const arr_t* arr, long long capacity)
+{
+    if (capacity >= MAX_ARR_STK_CAPACITY)
+        return 0;
+
+    // Small capacities with small factors must grow too
+    long long new_capacity = (long long) ((double) capacity * arr->growth_factor);
+    if (new_capacity <= capacity)
+        new_capacity = capacity + 1;
+
+    return new_capacity < MAX_ARR_STK_CAPACITY ? new_capacity : MAX_ARR_STK_CAPACITY;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError ArrRepack(arr_t* arr, size_t min_free)
+{
+    size_t new_data_capacity = 2*(arr->data_live + min_free);
+    if (new_data_capacity > SIZE_MAX / sizeof(StackElem_t))
+        return STACK_OVERFLOW_ERR;
+
+    StackElem_t* new_data = (StackElem_t*) arr->allocator.alloc(arr->allocator.ctx,
+                                                                new_data_capacity*sizeof(StackElem_t));
+    if (new_data == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    memset(new_data, 0, new_data_capacity*sizeof(StackElem_t));
+
+    size_t new_offset = 0;
+    for (size_t i = 0; i < arr->number_of_stacks; i++)
+    {
+        memcpy(new_data + new_offset, arr->data + arr->offset[i], (size_t) arr->index[i]*sizeof(StackElem_t));
+        arr->offset[i] = new_offset;
+        new_offset += (size_t) arr->capacity[i];
+    }
+
+    arr->allocator.free(arr->allocator.ctx, arr->data, arr->data_capacity*sizeof(StackElem_t));
+
+    arr->data = new_data;
+    arr->data_capacity = new_data_capacity;
+    arr->data_used = new_offset;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void ArrMove(arr_t* arr, size_t stk_idx, long long new_capacity)
+{
+    memcpy(arr->data + arr->data_used, arr->data + arr->offset[stk_idx],
+           (size_t) arr->index[stk_idx]*sizeof(StackElem_t));
+
+    arr->data_live += (size_t) (new_capacity - arr->capacity[stk_idx]);
+    arr->offset[stk_idx] = arr->data_used;
+    arr->capacity[stk_idx] = new_capacity;
+    arr->data_used += (size_t) new_capacity;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError ArrGrow(arr_t* arr, size_t stk_idx)
+{
+    long long new_capacity = ArrGrownCapacity(arr, arr->capacity[stk_idx]);
+    if (new_capacity == 0)
+        return STACK_OVERFLOW_ERR;
+
+    if (arr->data_used + (size_t) new_capacity > arr->data_capacity)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = ArrRepack(arr, (size_t) new_capacity)) != STK_NO_ERROR)
+            return code_err;
+    }
+
+    ArrMove(arr, stk_idx, new_capacity);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void ArrPopAllScalar(arr_t* arr, StackElem_t* vars, unsigned char* popped, size_t first_stk)
+{
+    const size_t number_of_stacks = arr->number_of_stacks;
+
+    // Empty stack reads its first place (capacity is never 0), so the loop has no branches
+    const StackElem_t* __restrict data   = arr->data;
+    long long*         __restrict index  = arr->index;
+    const size_t*      __restrict offset = arr->offset;
+    StackElem_t*       __restrict values = vars;
+
+    for (size_t i = first_stk; i < number_of_stacks; i++)
+    {
+        long long has_elems = index[i] > 0;
+        long long new_index = index[i] - has_elems;
+
+        StackElem_t value = data[offset[i] + (size_t) new_index];
+        values[i] = has_elems ? value : values[i];
+        index[i] = new_index;
+
+        if (popped != NULL)
+            popped[i] = (unsigned char) has_elems;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void ArrPopAllAVX2(arr_t* arr, StackElem_t* vars, unsigned char* popped, size_t first_stk)
+{
+    const size_t number_of_stacks = arr->number_of_stacks;
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = first_stk;
+
+    // Lane of empty stack has zero mask, so gather keeps its old value and doesn't read memory
+    for (; i + 4 <= number_of_stacks; i += 4)
+    {
+        __m256i stk_index = _mm256_loadu_si256((const __m256i*) (arr->index + i));
+        __m256i has_elems = _mm256_cmpgt_epi64(stk_index, zero);
+        __m256i new_index = _mm256_add_epi64(stk_index, has_elems);
+        __m256i pos       = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) (arr->offset + i)), new_index);
+
+        __m256i values = _mm256_mask_i64gather_epi64(_mm256_loadu_si256((const __m256i*) (vars + i)),
+                                                     arr->data, pos, has_elems, sizeof(StackElem_t));
+
+        _mm256_storeu_si256((__m256i*) (vars + i), values);
+        _mm256_storeu_si256((__m256i*) (arr->index + i), new_index);
+
+        if (popped != NULL)
+        {
+            int mask = _mm256_movemask_pd(_mm256_castsi256_pd(has_elems));
+            popped[i]     = (unsigned char) (mask & 1);
+            popped[i + 1] = (unsigned char) ((mask >> 1) & 1);
+            popped[i + 2] = (unsigned char) ((mask >> 2) & 1);
+            popped[i + 3] = (unsigned char) ((mask >> 3) & 1);
+        }
+    }
+
+    _mm256_zeroupper();
+
+    ArrPopAllScalar(arr, vars, popped, i);
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! VERIFY PART !!! <----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+static StackError StackArrayVerify(arr_t* arr)
+{
+    if (arr == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    #ifndef NCANARIES_MODE
+        if (arr->left_canary != ARR_CANARY_VALUE || arr->right_canary != ARR_CANARY_VALUE)
+            return STKSTRUCT_CANARY_CORRUPT_ERR;
+    #endif
+
+    if (arr->index == NULL || arr->data == NULL)
+        return NULL_STK_DATA_PTR_ERR;
+
+    return STK_NO_ERROR;
+}
@@ -0,0 +1,84 @@
+/*!
+    \file
+    File with array of many small stacks: their indexes, capacities and offsets are kept in separate arrays,
+    elements of all stacks are kept in one shared block
+*/
+
+#ifndef STACK_ARRAY_H
+#define STACK_ARRAY_H
+
+#include <stddef.h>
+
+#include "stack.h"
+
+/*! -----------------------------------------------------------------------------------------------------
+    Stack array initializer. Allocator, minimum capacity (capacity of every stack on init)
+    and growth factor are taken from config, stacks have no canaries or hashes of their own
+    \param[in, out]  arr_enc_ptr       Encoded pointer to stack array structure
+    \param[in]       number_of_stacks  Number of stacks (they are numbered from 0)
+    \param[in]       config            Settings of stacks (NULL for default ones)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayInit(size_t* arr_enc_ptr, size_t number_of_stacks, const StackConfig* config);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Destructs stack array with all its stacks
+    \param[in, out]  arr_enc_ptr  Encoded pointer to stack array structure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayDtor(size_t* arr_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts value to one stack
+    \param[in]  arr_enc_ptr  Encoded pointer to stack array structure
+    \param[in]  stk_idx      Number of stack
+    \param[in]  value        Value that should be put to stack
+    \return Type of stack error (STACK_BAD_HANDLE_ERR for wrong number of stack) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayPush(size_t arr_enc_ptr, size_t stk_idx, StackElem_t value);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from one stack
+    \param[in]   arr_enc_ptr  Encoded pointer to stack array structure
+    \param[in]   stk_idx      Number of stack
+    \param[out]  var          Pointer to variable where extracted value should be put
+    \return Type of stack error (STACK_ANTIOVERFLOW_ERR if stack is empty) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayPop(size_t arr_enc_ptr, size_t stk_idx, StackElem_t* var);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts values[i] to stack i for every stack. Stacks are grown before the main loop, so it has no branches
+    \param[in]  arr_enc_ptr  Encoded pointer to stack array structure
+    \param[in]  values       Array of values (one for every stack)
+    \return Errors of all stacks (bits of stacks that failed are set in their errors) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayPushAll(size_t arr_enc_ptr, const StackElem_t* values);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from every stack that is not empty (without branches, stacks are never shrunk by it)
+    \param[in]   arr_enc_ptr  Encoded pointer to stack array structure
+    \param[out]  vars         Array where value of stack i is put to vars[i] (it is kept for empty stacks)
+    \param[out]  popped       Array where 1 is put for stacks that were not empty, 0 for others (can be NULL)
+    \return Type of stack error or 0 for "no error"-state (empty stacks are not errors)
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayPopAll(size_t arr_enc_ptr, StackElem_t* vars, unsigned char* popped);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets number of elements of one stack
+    \param[in]   arr_enc_ptr  Encoded pointer to stack array structure
+    \param[in]   stk_idx      Number of stack
+    \param[out]  size         Pointer to variable where number of elements should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArraySize(size_t arr_enc_ptr, size_t stk_idx, size_t* size);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets errors that happened to one stack (the same bits as StackError)
+    \param[in]   arr_enc_ptr  Encoded pointer to stack array structure
+    \param[in]   stk_idx      Number of stack
+    \param[out]  code_errors  Pointer to variable where errors should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackArrayErrors(size_t arr_enc_ptr, size_t stk_idx, unsigned int* code_errors);
+
+#endif
@@ -0,0 +1,462 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+#include "stack_concurrent.h"
+
+/// @brief Type of canaries on the stack sides
+typedef uint64_t canary_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Size of cache line (fields that are changed by different threads are kept in different lines)
+static const size_t CACHE_LINE_SIZE = 64;
+
+/// @brief Index of node that means "no node" (end of list or empty slot)
+static const uint32_t NULL_NODE = UINT32_MAX;
+
+/// @brief Binary logarithm of number of nodes in the first chunk (every next chunk is twice as big)
+static const int FIRST_CHUNK_BITS = 6;
+
+/// @brief Maximum number of chunks of nodes
+static const int MAX_CHUNKS = 26;
+
+/// @brief Maximum number of nodes in all chunks (fits 32-bit index together with NULL_NODE)
+static const uint64_t MAX_NODES = ((1ull << MAX_CHUNKS) - 1) << FIRST_CHUNK_BITS;
+
+/// @brief Number of slots where push and pop can meet without touching the head
+static const size_t ELIMINATION_SIZE = 8;
+
+/// @brief Number of iterations push waits for pop in elimination slot
+static const int ELIMINATION_SPINS = 256;
+
+/// @brief Canary value for securing concurrent stack structure
+static const canary_t CONC_STACK_CANARY_VALUE = 0xC0C57ACCC0C57ACC;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NCANARIES_MODE
+    /// @brief Sets up canaries in stack structure or not depending on canaries mode
+    #define CANARIES_SET_UP(...) __VA_ARGS__
+#else
+    /// @brief Sets up canaries in stack structure or not depending on canaries mode
+    #define CANARIES_SET_UP(...)
+#endif
+
+/// @brief Element of concurrent stack (nodes are found by their 32-bit index)
+struct conc_node_t
+{
+    StackElem_t value;
+    std::atomic<uint32_t> next;
+};
+
+/// @brief Slot of elimination array (index of node that push offers and tag), one per cache line
+struct alignas(CACHE_LINE_SIZE) conc_slot_t
+{
+    std::atomic<uint64_t> offer;
+};
+
+/// @brief Sructure with concurrent stack info
+struct conc_stack_t
+{
+    CANARIES_SET_UP(canary_t left_canary);
+
+    // Heads keep index of the first node in low half and tag that is changed on every CAS in high half,
+    // so a node that was popped and pushed again while a thread was waiting does not confuse it (ABA)
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> free_head;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> nodes_used;
+    std::atomic<conc_node_t*> chunks[MAX_CHUNKS];
+
+    conc_slot_t elimination[ELIMINATION_SIZE];
+
+    CANARIES_SET_UP(canary_t right_canary);
+};
+
+/// @brief Seed of generator of elimination slots (every thread has its own)
+static thread_local uint32_t elimination_seed = 0;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Makes value of head or slot from node index and tag
+    \param[in]  node_idx  Index of node
+    \param[in]  tag       Tag of value
+    \return Packed value
+    ----------------------------------------------------------------------------------------------------- */
+static inline uint64_t ConcPack(uint32_t node_idx, uint32_t tag)
+{
+    return ((uint64_t) tag << 32) | node_idx;
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets node index from value of head or slot
+    \param[in]  packed  Packed value
+    \return Index of node
+    ----------------------------------------------------------------------------------------------------- */
+static inline uint32_t ConcIdx(uint64_t packed)
+{
+    return (uint32_t) packed;
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets tag from value of head or slot
+    \param[in]  packed  Packed value
+    \return Tag
+    ----------------------------------------------------------------------------------------------------- */
+static inline uint32_t ConcTag(uint64_t packed)
+{
+    return (uint32_t) (packed >> 32);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates number of chunk where node is kept
+    \param[in]  node_idx  Index of node
+    \return Number of chunk
+    ----------------------------------------------------------------------------------------------------- */
+static inline int ConcChunkOf(uint64_t node_idx)
+{
+    return 63 - __builtin_clzll((node_idx >> FIRST_CHUNK_BITS) + 1);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates index of the first node of chunk
+    \param[in]  chunk  Number of chunk
+    \return Index of the first node
+    ----------------------------------------------------------------------------------------------------- */
+static inline uint64_t ConcChunkStart(int chunk)
+{
+    return ((1ull << chunk) - 1) << FIRST_CHUNK_BITS;
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds node by its index (chunks are never freed until destruction, so any index
+    that was ever read from the stack gives valid node)
+    \param[in]  stk       Pointer to concurrent stack sructure
+    \param[in]  node_idx  Index of node
+    \return Pointer to node
+    ----------------------------------------------------------------------------------------------------- */
+static inline conc_node_t* ConcNode(conc_stack_t* stk, uint32_t node_idx)
+{
+    int chunk = ConcChunkOf(node_idx);
+    return stk->chunks[chunk].load(std::memory_order_acquire) + (node_idx - ConcChunkStart(chunk));
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds concurrent stack structure by its handle
+    \param[in]  stk_enc_ptr  Handle of concurrent stack
+    \return Pointer to concurrent stack structure or NULL if handle is wrong or stack was destructed
+    ----------------------------------------------------------------------------------------------------- */
+static inline conc_stack_t* StackConcFromHandle(size_t stk_enc_ptr)
+{
+    return (conc_stack_t*) StackHandleFind(stk_enc_ptr, STK_HANDLE_CONCURRENT);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Takes node from free list or from the end of chunks
+    \param[in, out]  stk       Pointer to concurrent stack sructure
+    \param[out]      node_idx  Index of node
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError ConcNodeAlloc(conc_stack_t* stk, uint32_t* node_idx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts node to free list
+    \param[in, out]  stk       Pointer to concurrent stack sructure
+    \param[in]       node_idx  Index of node
+    ----------------------------------------------------------------------------------------------------- */
+static void ConcNodeFree(conc_stack_t* stk, uint32_t node_idx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Offers node to pops in random elimination slot and waits a bit
+    \param[in, out]  stk       Pointer to concurrent stack sructure
+    \param[in]       node_idx  Index of node with value
+    \return True (if node was taken by pop), false (if node should be pushed to stack again)
+    ----------------------------------------------------------------------------------------------------- */
+static bool ConcEliminatePush(conc_stack_t* stk, uint32_t node_idx);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Takes node that is offered by push in random elimination slot
+    \param[in, out]  stk  Pointer to concurrent stack sructure
+    \param[out]      var  Pointer to variable where value of node should be put
+    \return True (if value was taken), false (if slot was empty)
+    ----------------------------------------------------------------------------------------------------- */
+static bool ConcEliminatePop(conc_stack_t* stk, StackElem_t* var);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Chooses random elimination slot
+    \return Number of slot
+    ----------------------------------------------------------------------------------------------------- */
+static size_t ConcRandomSlot();
+
+/*!
+    Verifies pointer and canaries of concurrent stack structure
+    \param[in]  stk  Pointer to concurrent stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackConcVerify(conc_stack_t* stk);
+
+
+/// @brief Macro for verifying concurrent stack
+#define STACK_CONC_VERIFY(stk)                                                   \
+    do {                                                                         \
+        StackError temp_code_err = STK_NO_ERROR;                                 \
+        if ((temp_code_err = StackConcVerify(stk)) != STK_NO_ERROR)              \
+            return temp_code_err;                                                \
+    } while(0)
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! STACK PART !!! <-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackConcInit(size_t* stk_enc_ptr)
+{
+    if (*stk_enc_ptr != 0)
+        return STACK_ALREADY_INITED_ERR;
+
+    conc_stack_t* stk = new (std::nothrow) conc_stack_t();
+    if (stk == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    #ifndef NCANARIES_MODE
+        stk->left_canary = stk->right_canary = CONC_STACK_CANARY_VALUE;
+    #endif
+
+    stk->head.store(ConcPack(NULL_NODE, 0), std::memory_order_relaxed);
+    stk->free_head.store(ConcPack(NULL_NODE, 0), std::memory_order_relaxed);
+    for (size_t i = 0; i < ELIMINATION_SIZE; i++)
+        stk->elimination[i].offer.store(ConcPack(NULL_NODE, 0), std::memory_order_relaxed);
+
+    if ((*stk_enc_ptr = StackHandleAlloc(stk, STK_HANDLE_CONCURRENT)) == 0)
+    {
+        delete stk;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackConcDtor(size_t* stk_enc_ptr)
+{
+    conc_stack_t* stk = StackConcFromHandle(*stk_enc_ptr);
+
+    STACK_CONC_VERIFY(stk);
+
+    for (int chunk = 0; chunk < MAX_CHUNKS; chunk++)
+        free(stk->chunks[chunk].load(std::memory_order_relaxed));
+
+    StackHandleFree(*stk_enc_ptr);
+    delete stk; stk = NULL;
+
+    *stk_enc_ptr = 0;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackConcPush(size_t stk_enc_ptr, StackElem_t value)
+{
+    conc_stack_t* stk = StackConcFromHandle(stk_enc_ptr);
+
+    STACK_CONC_VERIFY(stk);
+
+    uint32_t node_idx = NULL_NODE;
+    StackError code_err = STK_NO_ERROR;
+    if ((code_err = ConcNodeAlloc(stk, &node_idx)) != STK_NO_ERROR)
+        return code_err;
+
+    conc_node_t* node = ConcNode(stk, node_idx);
+    node->value = value;
+
+    uint64_t old_head = stk->head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        node->next.store(ConcIdx(old_head), std::memory_order_relaxed);
+        if (stk->head.compare_exchange_weak(old_head, ConcPack(node_idx, ConcTag(old_head) + 1),
+                                            std::memory_order_release, std::memory_order_relaxed))
+            return STK_NO_ERROR;
+
+        if (ConcEliminatePush(stk, node_idx))
+            return STK_NO_ERROR;
+
+        old_head = stk->head.load(std::memory_order_relaxed);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackConcPop(size_t stk_enc_ptr, StackElem_t* var)
+{
+    conc_stack_t* stk = StackConcFromHandle(stk_enc_ptr);
+
+    STACK_CONC_VERIFY(stk);
+
+    uint64_t old_head = stk->head.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint32_t top_idx = ConcIdx(old_head);
+        if (top_idx == NULL_NODE)
+            return STACK_ANTIOVERFLOW_ERR;
+
+        // Node may be popped and reused by another thread right now, then its next is wrong,
+        // but tag of the head is changed too and CAS fails
+        conc_node_t* top = ConcNode(stk, top_idx);
+        uint32_t next_idx = top->next.load(std::memory_order_relaxed);
+
+        if (stk->head.compare_exchange_weak(old_head, ConcPack(next_idx, ConcTag(old_head) + 1),
+                                            std::memory_order_acquire, std::memory_order_acquire))
+        {
+            *var = top->value;
+            ConcNodeFree(stk, top_idx);
+            return STK_NO_ERROR;
+        }
+
+        if (ConcEliminatePop(stk, var))
+            return STK_NO_ERROR;
+
+        old_head = stk->head.load(std::memory_order_acquire);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError ConcNodeAlloc(conc_stack_t* stk, uint32_t* node_idx)
+{
+    uint64_t old_free = stk->free_head.load(std::memory_order_acquire);
+    while (ConcIdx(old_free) != NULL_NODE)
+    {
+        uint32_t next_idx = ConcNode(stk, ConcIdx(old_free))->next.load(std::memory_order_relaxed);
+        if (stk->free_head.compare_exchange_weak(old_free, ConcPack(next_idx, ConcTag(old_free) + 1),
+                                                 std::memory_order_acquire, std::memory_order_acquire))
+        {
+            *node_idx = ConcIdx(old_free);
+            return STK_NO_ERROR;
+        }
+    }
+
+    uint64_t new_idx = stk->nodes_used.fetch_add(1, std::memory_order_relaxed);
+    if (new_idx >= MAX_NODES)
+        return STACK_OVERFLOW_ERR;
+
+    int chunk = ConcChunkOf(new_idx);
+    if (stk->chunks[chunk].load(std::memory_order_acquire) == NULL)
+    {
+        conc_node_t* new_chunk = (conc_node_t*) calloc((size_t) 1 << (chunk + FIRST_CHUNK_BITS), sizeof(conc_node_t));
+        if (new_chunk == NULL)
+            return OUT_OF_MEMORY_ERR;
+
+        // Other thread could take a node of the same chunk at the same time
+        conc_node_t* no_chunk = NULL;
+        if (!stk->chunks[chunk].compare_exchange_strong(no_chunk, new_chunk, std::memory_order_acq_rel))
+            free(new_chunk);
+    }
+
+    *node_idx = (uint32_t) new_idx;
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void ConcNodeFree(conc_stack_t* stk, uint32_t node_idx)
+{
+    conc_node_t* node = ConcNode(stk, node_idx);
+
+    uint64_t old_free = stk->free_head.load(std::memory_order_relaxed);
+    do
+        node->next.store(ConcIdx(old_free), std::memory_order_relaxed);
+    while (!stk->free_head.compare_exchange_weak(old_free, ConcPack(node_idx, ConcTag(old_free) + 1),
+                                                 std::memory_order_release, std::memory_order_relaxed));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool ConcEliminatePush(conc_stack_t* stk, uint32_t node_idx)
+{
+    std::atomic<uint64_t>& slot = stk->elimination[ConcRandomSlot()].offer;
+
+    uint64_t empty = slot.load(std::memory_order_relaxed);
+    if (ConcIdx(empty) != NULL_NODE)
+        return false;
+
+    uint64_t offer = ConcPack(node_idx, ConcTag(empty) + 1);
+    if (!slot.compare_exchange_strong(empty, offer, std::memory_order_release, std::memory_order_relaxed))
+        return false;
+
+    for (int i = 0; i < ELIMINATION_SPINS; i++)
+    {
+        if (slot.load(std::memory_order_relaxed) != offer)
+            return true;
+
+        __builtin_ia32_pause();
+    }
+
+    // Pop can take the node right before it is taken back
+    return !slot.compare_exchange_strong(offer, ConcPack(NULL_NODE, ConcTag(offer) + 1),
+                                         std::memory_order_relaxed, std::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool ConcEliminatePop(conc_stack_t* stk, StackElem_t* var)
+{
+    std::atomic<uint64_t>& slot = stk->elimination[ConcRandomSlot()].offer;
+
+    uint64_t offer = slot.load(std::memory_order_acquire);
+    if (ConcIdx(offer) == NULL_NODE)
+        return false;
+
+    if (!slot.compare_exchange_strong(offer, ConcPack(NULL_NODE, ConcTag(offer) + 1),
+                                      std::memory_order_acquire, std::memory_order_relaxed))
+        return false;
+
+    *var = ConcNode(stk, ConcIdx(offer))->value;
+    ConcNodeFree(stk, ConcIdx(offer));
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t ConcRandomSlot()
+{
+    uint32_t seed = elimination_seed;
+    if (seed == 0)
+        seed = (uint32_t) (uintptr_t) &elimination_seed | 1;
+
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    elimination_seed = seed;
+
+    return seed % ELIMINATION_SIZE;
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! VERIFY PART !!! <----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+static StackError StackConcVerify(conc_stack_t* stk)
+{
+    if (stk == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    #ifndef NCANARIES_MODE
+        if (stk->left_canary != CONC_STACK_CANARY_VALUE || stk->right_canary != CONC_STACK_CANARY_VALUE)
+            return STKSTRUCT_CANARY_CORRUPT_ERR;
+    #endif
+
+    return STK_NO_ERROR;
+}
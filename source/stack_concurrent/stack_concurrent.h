@@ -0,0 +1,44 @@
+/*!
+    \file
+    File with lock-free stack that can be used by several threads at once
+*/
+
+#ifndef STACK_CONCURRENT_H
+#define STACK_CONCURRENT_H
+
+#include <stddef.h>
+
+#include "stack.h"
+
+/*! -----------------------------------------------------------------------------------------------------
+    Concurrent stack initializer (Treiber stack with elimination array, nodes are reused but never
+    freed until StackConcDtor, so pointers read by other threads always stay valid)
+    \param[in, out]  stk_enc_ptr  Encoded pointer to concurrent stack structure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackConcInit(size_t* stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Destructs concurrent stack (must not be called while other threads use it)
+    \param[in, out]  stk_enc_ptr  Encoded pointer to concurrent stack structure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackConcDtor(size_t* stk_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts value to concurrent stack (lock-free, can be called by any number of threads)
+    \param[in]  stk_enc_ptr  Encoded pointer to concurrent stack structure
+    \param[in]  value        Value that should be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackConcPush(size_t stk_enc_ptr, StackElem_t value);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from concurrent stack (lock-free, can be called by any number of threads)
+    \param[in]   stk_enc_ptr  Encoded pointer to concurrent stack structure
+    \param[out]  var          Pointer to variable where extracted value should be put
+    \return Type of stack error (STACK_ANTIOVERFLOW_ERR if stack is empty) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackConcPop (size_t stk_enc_ptr, StackElem_t* var);
+
+#endif
@@ -0,0 +1,346 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+#include "stack_alloc.h"
+#include "stack_deque.h"
+
+/// @brief Type of canaries on the deque sides
+typedef uint64_t canary_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Size of cache line (top and bottom are kept in different lines)
+static const size_t CACHE_LINE_SIZE = 64;
+
+/// @brief Capacity of deque that is created with too small minimum capacity
+static const size_t DEFAULT_DEQ_CAPACITY = 64;
+
+/// @brief Canary value for securing deque structure
+static const canary_t DEQ_CANARY_VALUE = 0xDE9757ACDE9757AC;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NCANARIES_MODE
+    /// @brief Sets up canaries in deque structure or not depending on canaries mode
+    #define CANARIES_SET_UP(...) __VA_ARGS__
+#else
+    /// @brief Sets up canaries in deque structure or not depending on canaries mode
+    #define CANARIES_SET_UP(...)
+#endif
+
+/// @brief Ring buffer of deque (capacity is a power of two, element i is kept in data[i & mask])
+struct deq_buffer_t
+{
+    size_t capacity;
+    size_t mask;
+    deq_buffer_t* retired_prev;
+    std::atomic<StackElem_t> data[1];
+};
+
+/// @brief Sructure with deque info
+struct deq_t
+{
+    CANARIES_SET_UP(canary_t left_canary);
+
+    // Elements are in [bottom, top): the owner works with top, thieves take bottom
+    alignas(CACHE_LINE_SIZE) std::atomic<long long> top;
+    alignas(CACHE_LINE_SIZE) std::atomic<long long> bottom;
+    alignas(CACHE_LINE_SIZE) std::atomic<deq_buffer_t*> buffer;
+
+    // Thieves can still read old buffers, so they are freed only by destructor
+    deq_buffer_t* retired;
+    size_t growth_shift;
+    StackAllocator allocator;
+
+    CANARIES_SET_UP(canary_t right_canary);
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates size of ring buffer
+    \param[in]  capacity  Number of elements
+    \return Size of buffer in bytes
+    ----------------------------------------------------------------------------------------------------- */
+static inline size_t DeqBufferSize(size_t capacity)
+{
+    return offsetof(deq_buffer_t, data) + capacity*sizeof(std::atomic<StackElem_t>);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds deque structure by its handle
+    \param[in]  deq_enc_ptr  Handle of deque
+    \return Pointer to deque structure or NULL if handle is wrong or deque was destructed
+    ----------------------------------------------------------------------------------------------------- */
+static inline deq_t* StackDequeFromHandle(size_t deq_enc_ptr)
+{
+    return (deq_t*) StackHandleFind(deq_enc_ptr, STK_HANDLE_DEQUE);
+}
+
+/*! -----------------------------------------------------------------------------------------------------
+    Allocates ring buffer
+    \param[in]  deq       Pointer to deque sructure
+    \param[in]  capacity  Number of elements (power of two)
+    \return Pointer to buffer or NULL if out of memory
+    ----------------------------------------------------------------------------------------------------- */
+static deq_buffer_t* DeqBufferAlloc(deq_t* deq, size_t capacity);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Copies elements to bigger buffer (ONLY FOR THE OWNER THREAD), old buffer is retired
+    \param[in, out]  deq     Pointer to deque sructure
+    \param[in]       top     Top index of deque
+    \param[in]       bottom  Bottom index of deque
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError DeqGrow(deq_t* deq, long long top, long long bottom);
+
+/*!
+    Verifies pointer and canaries of deque structure
+    \param[in]  deq  Pointer to deque sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackDequeVerify(deq_t* deq);
+
+
+/// @brief Macro for verifying deque
+#define STACK_DEQUE_VERIFY(deq)                                                  \
+    do {                                                                         \
+        StackError temp_code_err = STK_NO_ERROR;                                 \
+        if ((temp_code_err = StackDequeVerify(deq)) != STK_NO_ERROR)             \
+            return temp_code_err;                                                \
+    } while(0)
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! DEQUE PART !!! <-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackDequeInit(size_t* deq_enc_ptr, const StackConfig* config)
+{
+    if (*deq_enc_ptr != 0)
+        return STACK_ALREADY_INITED_ERR;
+
+    StackConfig default_config = StackDefaultConfig();
+    if (config == NULL)
+        config = &default_config;
+
+    deq_t* deq = new (std::nothrow) deq_t();
+    if (deq == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    #ifndef NCANARIES_MODE
+        deq->left_canary = deq->right_canary = DEQ_CANARY_VALUE;
+    #endif
+
+    deq->allocator = config->allocator != NULL ? *config->allocator : *StackMallocAllocator();
+
+    // Indices are masked, so capacity is multiplied by the power of two that is the nearest to growth factor
+    deq->growth_shift = 1;
+    while (deq->growth_shift < 8 && (double) (2ull << deq->growth_shift) <= config->growth.growth_factor * 1.5)
+        deq->growth_shift++;
+
+    size_t capacity = DEFAULT_DEQ_CAPACITY;
+    while (capacity < config->growth.min_capacity && capacity < ((size_t) 1 << 60))
+        capacity *= 2;
+
+    deq_buffer_t* buffer = DeqBufferAlloc(deq, capacity);
+    if (buffer == NULL)
+    {
+        delete deq;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    deq->buffer.store(buffer, std::memory_order_relaxed);
+
+    if ((*deq_enc_ptr = StackHandleAlloc(deq, STK_HANDLE_DEQUE)) == 0)
+    {
+        deq->allocator.free(deq->allocator.ctx, buffer, DeqBufferSize(buffer->capacity));
+        delete deq;
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackDequeDtor(size_t* deq_enc_ptr)
+{
+    deq_t* deq = StackDequeFromHandle(*deq_enc_ptr);
+
+    STACK_DEQUE_VERIFY(deq);
+
+    deq_buffer_t* buffer = deq->buffer.load(std::memory_order_relaxed);
+    deq->allocator.free(deq->allocator.ctx, buffer, DeqBufferSize(buffer->capacity));
+
+    while (deq->retired != NULL)
+    {
+        deq_buffer_t* prev = deq->retired->retired_prev;
+        deq->allocator.free(deq->allocator.ctx, deq->retired, DeqBufferSize(deq->retired->capacity));
+        deq->retired = prev;
+    }
+
+    StackHandleFree(*deq_enc_ptr);
+    delete deq; deq = NULL;
+
+    *deq_enc_ptr = 0;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackDequePush(size_t deq_enc_ptr, StackElem_t value)
+{
+    deq_t* deq = StackDequeFromHandle(deq_enc_ptr);
+
+    STACK_DEQUE_VERIFY(deq);
+
+    long long top = deq->top.load(std::memory_order_relaxed);
+    long long bottom = deq->bottom.load(std::memory_order_acquire);
+    deq_buffer_t* buffer = deq->buffer.load(std::memory_order_relaxed);
+
+    if (top - bottom >= (long long) buffer->capacity)
+    {
+        StackError code_err = STK_NO_ERROR;
+        if ((code_err = DeqGrow(deq, top, bottom)) != STK_NO_ERROR)
+            return code_err;
+
+        buffer = deq->buffer.load(std::memory_order_relaxed);
+    }
+
+    buffer->data[top & buffer->mask].store(value, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    deq->top.store(top + 1, std::memory_order_relaxed);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackDequePop(size_t deq_enc_ptr, StackElem_t* var)
+{
+    deq_t* deq = StackDequeFromHandle(deq_enc_ptr);
+
+    STACK_DEQUE_VERIFY(deq);
+
+    long long top = deq->top.load(std::memory_order_relaxed) - 1;
+    deq_buffer_t* buffer = deq->buffer.load(std::memory_order_relaxed);
+
+    // Top is moved before bottom is read, so thieves and the owner can't take the same element
+    // (except the last one, which is taken by CAS)
+    deq->top.store(top, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long bottom = deq->bottom.load(std::memory_order_relaxed);
+
+    if (bottom > top)
+    {
+        deq->top.store(top + 1, std::memory_order_relaxed);
+        return STACK_ANTIOVERFLOW_ERR;
+    }
+
+    StackElem_t value = buffer->data[top & buffer->mask].load(std::memory_order_relaxed);
+    if (bottom == top)
+    {
+        bool taken = deq->bottom.compare_exchange_strong(bottom, bottom + 1, std::memory_order_seq_cst,
+                                                         std::memory_order_relaxed);
+        deq->top.store(top + 1, std::memory_order_relaxed);
+
+        if (!taken)
+            return STACK_ANTIOVERFLOW_ERR;
+    }
+
+    *var = value;
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackDequeSteal(size_t deq_enc_ptr, StackElem_t* var)
+{
+    deq_t* deq = StackDequeFromHandle(deq_enc_ptr);
+
+    STACK_DEQUE_VERIFY(deq);
+
+    long long bottom = deq->bottom.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long top = deq->top.load(std::memory_order_acquire);
+
+    if (bottom >= top)
+        return STACK_ANTIOVERFLOW_ERR;
+
+    deq_buffer_t* buffer = deq->buffer.load(std::memory_order_acquire);
+    StackElem_t value = buffer->data[bottom & buffer->mask].load(std::memory_order_relaxed);
+
+    if (!deq->bottom.compare_exchange_strong(bottom, bottom + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+        return STACK_ANTIOVERFLOW_ERR;
+
+    *var = value;
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static deq_buffer_t* DeqBufferAlloc(deq_t* deq, size_t capacity)
+{
+    deq_buffer_t* buffer = (deq_buffer_t*) deq->allocator.alloc(deq->allocator.ctx, DeqBufferSize(capacity));
+    if (buffer == NULL)
+        return NULL;
+
+    memset((void*) buffer, 0, DeqBufferSize(capacity));
+    buffer->capacity = capacity;
+    buffer->mask = capacity - 1;
+
+    return buffer;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError DeqGrow(deq_t* deq, long long top, long long bottom)
+{
+    deq_buffer_t* old_buffer = deq->buffer.load(std::memory_order_relaxed);
+    if (old_buffer->capacity > (SIZE_MAX >> (deq->growth_shift + 4)))
+        return STACK_OVERFLOW_ERR;
+
+    deq_buffer_t* new_buffer = DeqBufferAlloc(deq, old_buffer->capacity << deq->growth_shift);
+    if (new_buffer == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    for (long long i = bottom; i < top; i++)
+        new_buffer->data[i & new_buffer->mask].store(old_buffer->data[i & old_buffer->mask].load(
+                                                         std::memory_order_relaxed), std::memory_order_relaxed);
+
+    old_buffer->retired_prev = deq->retired;
+    deq->retired = old_buffer;
+    deq->buffer.store(new_buffer, std::memory_order_release);
+
+    return STK_NO_ERROR;
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! VERIFY PART !!! <----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+static StackError StackDequeVerify(deq_t* deq)
+{
+    if (deq == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    #ifndef NCANARIES_MODE
+        if (deq->left_canary != DEQ_CANARY_VALUE || deq->right_canary != DEQ_CANARY_VALUE)
+            return STKSTRUCT_CANARY_CORRUPT_ERR;
+    #endif
+
+    return STK_NO_ERROR;
+}
@@ -0,0 +1,54 @@
+/*!
+    \file
+    File with work-stealing deque: the owner thread uses it as a stack, other threads steal the oldest elements
+*/
+
+#ifndef STACK_DEQUE_H
+#define STACK_DEQUE_H
+
+#include <stddef.h>
+
+#include "stack.h"
+
+/*! -----------------------------------------------------------------------------------------------------
+    Work-stealing deque initializer (Chase-Lev deque). Allocator, minimum capacity and growth factor
+    are taken from config (growth factor is rounded to a power of two, deque never shrinks)
+    \param[in, out]  deq_enc_ptr  Encoded pointer to deque structure
+    \param[in]       config       Settings of the deque (NULL for default ones)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDequeInit (size_t* deq_enc_ptr, const StackConfig* config);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Destructs deque (must not be called while other threads use it)
+    \param[in, out]  deq_enc_ptr  Encoded pointer to deque structure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDequeDtor (size_t* deq_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts value to the top of deque (ONLY FOR THE OWNER THREAD)
+    \param[in]  deq_enc_ptr  Encoded pointer to deque structure
+    \param[in]  value        Value that should be put to deque
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDequePush (size_t deq_enc_ptr, StackElem_t value);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from the top of deque (ONLY FOR THE OWNER THREAD)
+    \param[in]   deq_enc_ptr  Encoded pointer to deque structure
+    \param[out]  var          Pointer to variable where extracted value should be put
+    \return Type of stack error (STACK_ANTIOVERFLOW_ERR if deque is empty) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDequePop  (size_t deq_enc_ptr, StackElem_t* var);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from the bottom of deque (any thread, one CAS)
+    \param[in]   deq_enc_ptr  Encoded pointer to deque structure
+    \param[out]  var          Pointer to variable where extracted value should be put
+    \return Type of stack error or 0 for "no error"-state (STACK_ANTIOVERFLOW_ERR if deque is empty
+            or the element was taken by other thread, so the thief should try another deque)
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackDequeSteal(size_t deq_enc_ptr, StackElem_t* var);
+
+#endif
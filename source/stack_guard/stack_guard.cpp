@@ -0,0 +1,236 @@
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "stack_guard.h"
+
+/// @brief Maximum number of owners that SIGSEGV handler knows about
+static const int GUARD_MAX_OWNERS = 1024;
+
+/// @brief Maximum length of report of one fault
+static const size_t GUARD_MAX_REPORT_LEN = 1024;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Owner of guarded blocks that SIGSEGV handler can ask about fault
+struct GuardOwner
+{
+    std::atomic<const void*>        owner;     ///< NULL for free slot
+    std::atomic<StackGuardReporter> reporter;  ///< Is set after owner, so handler skips slots that are being filled
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static GuardOwner guard_owners[GUARD_MAX_OWNERS];
+
+/// @brief Handler that was set before ours (it is called after the report)
+static struct sigaction guard_old_action;
+
+static std::once_flag guard_handler_once;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Installs SIGSEGV handler and saves the previous one
+    ----------------------------------------------------------------------------------------------------- */
+static void GuardInstallHandler();
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reports fault on guard page (if it is one) and passes signal to the previous handler
+    \param[in]  sig       Number of signal
+    \param[in]  info      Information about signal (address of fault)
+    \param[in]  ucontext  Context of interrupted thread
+    ----------------------------------------------------------------------------------------------------- */
+static void GuardHandler(int sig, siginfo_t* info, void* ucontext);
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! MAPPING PART !!! <---------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+size_t StackGuardPageSize()
+{
+    static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t StackGuardRoundSize(size_t size)
+{
+    size_t page_size = StackGuardPageSize();
+    if (size == 0)
+        return page_size;
+
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void* StackGuardMap(size_t size)
+{
+    size_t page_size = StackGuardPageSize();
+
+    char* map = (char*) mmap(NULL, size + 2*page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (mprotect(map + page_size, size, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(map, size + 2*page_size);
+        return NULL;
+    }
+
+    return map + page_size;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void* StackGuardRemap(void* block, size_t old_size, size_t new_size)
+{
+    size_t page_size = StackGuardPageSize();
+    char* old_block = (char*) block;
+
+    if (new_size == old_size)
+        return block;
+
+    if (new_size < old_size)
+    {
+        // The first freed page becomes right guard, the rest of them and the old guard are unmapped
+        madvise(old_block + new_size, page_size, MADV_DONTNEED);
+        if (mprotect(old_block + new_size, page_size, PROT_NONE) != 0)
+            return NULL;
+        munmap(old_block + new_size + page_size, old_size - new_size);
+
+        return block;
+    }
+
+    #ifdef MREMAP_FIXED
+        // Pages of block are moved into the middle of new reserved range, so elements are never copied
+        char* map = (char*) mmap(NULL, new_size + 2*page_size, PROT_NONE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED)
+            return NULL;
+
+        if (mremap(old_block, old_size, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, map + page_size) == MAP_FAILED)
+        {
+            munmap(map, new_size + 2*page_size);
+            return NULL;
+        }
+
+        munmap(old_block - page_size, page_size);
+        munmap(old_block + old_size,  page_size);
+
+        return map + page_size;
+    #else
+        char* new_block = (char*) StackGuardMap(new_size);
+        if (new_block == NULL)
+            return NULL;
+
+        memcpy(new_block, old_block, old_size);
+        StackGuardUnmap(old_block, old_size);
+
+        return new_block;
+    #endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void StackGuardUnmap(void* block, size_t size)
+{
+    size_t page_size = StackGuardPageSize();
+    munmap((char*) block - page_size, size + 2*page_size);
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! HANDLER PART !!! <---------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+bool StackGuardRegister(const void* owner, StackGuardReporter reporter)
+{
+    std::call_once(guard_handler_once, GuardInstallHandler);
+
+    for (int i = 0; i < GUARD_MAX_OWNERS; i++)
+    {
+        const void* no_owner = NULL;
+        if (guard_owners[i].owner.load(std::memory_order_relaxed) == NULL &&
+            guard_owners[i].owner.compare_exchange_strong(no_owner, owner, std::memory_order_acq_rel))
+        {
+            guard_owners[i].reporter.store(reporter, std::memory_order_release);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void StackGuardUnregister(const void* owner)
+{
+    for (int i = 0; i < GUARD_MAX_OWNERS; i++)
+    {
+        if (guard_owners[i].owner.load(std::memory_order_relaxed) == owner)
+        {
+            guard_owners[i].reporter.store(NULL, std::memory_order_release);
+            guard_owners[i].owner.store(NULL, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void GuardInstallHandler()
+{
+    struct sigaction action = {};
+    action.sa_sigaction = GuardHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, &guard_old_action);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void GuardHandler(int sig, siginfo_t* info, void* ucontext)
+{
+    char report[GUARD_MAX_REPORT_LEN] = {};
+
+    for (int i = 0; i < GUARD_MAX_OWNERS; i++)
+    {
+        StackGuardReporter reporter = guard_owners[i].reporter.load(std::memory_order_acquire);
+        const void* owner = guard_owners[i].owner.load(std::memory_order_acquire);
+        if (reporter == NULL || owner == NULL)
+            continue;
+
+        size_t report_len = reporter(owner, info->si_addr, report, sizeof(report));
+        if (report_len > 0)
+        {
+            ssize_t written = write(STDERR_FILENO, report, report_len < sizeof(report) ? report_len : sizeof(report));
+            (void) written;
+            break;
+        }
+    }
+
+    if (guard_old_action.sa_flags & SA_SIGINFO)
+        guard_old_action.sa_sigaction(sig, info, ucontext);
+    else if (guard_old_action.sa_handler != SIG_DFL && guard_old_action.sa_handler != SIG_IGN)
+        guard_old_action.sa_handler(sig);
+    else
+    {
+        // Faulting instruction is executed again after return and the default action ends the process
+        signal(sig, SIG_DFL);
+    }
+}
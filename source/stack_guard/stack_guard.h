@@ -0,0 +1,68 @@
+/*!
+    \file
+    File with memory blocks that lie between PROT_NONE guard pages and SIGSEGV handler that reports faults on them
+*/
+
+#ifndef STACK_GUARD_H
+#define STACK_GUARD_H
+
+#include <stddef.h>
+
+/// @brief Writes description of owner of guarded block to buffer if fault address is on guard pages of its block
+///        (it is called from SIGSEGV handler, so it must not allocate or lock anything). Returns length of text
+///        or 0 if fault is not on its guard pages
+typedef size_t (*StackGuardReporter)(const void* owner, const void* fault_addr, char* buf, size_t buf_size);
+
+/*!
+    Gets size of memory page (guard pages have this size)
+    \return Size of page
+*/
+size_t StackGuardPageSize();
+
+/*!
+    Rounds size of guarded block up to whole pages
+    \param[in]  size  Size of block
+    \return Rounded size (at least one page)
+*/
+size_t StackGuardRoundSize(size_t size);
+
+/*!
+    Maps zeroed block between two PROT_NONE pages, so any access right before or right after it faults
+    \param[in]  size  Size of block (rounded by StackGuardRoundSize)
+    \return Pointer to the first byte of block or NULL if out of memory
+*/
+void* StackGuardMap(size_t size);
+
+/*!
+    Changes size of guarded block keeping its contents (pages are moved by mremap without copying,
+    new bytes are zeroed, the block is shrunk in place)
+    \param[in]  block     Pointer to the first byte of block
+    \param[in]  old_size  Size of block (rounded)
+    \param[in]  new_size  New size of block (rounded)
+    \return Pointer to the first byte of new block or NULL (block is kept) if out of memory
+*/
+void* StackGuardRemap(void* block, size_t old_size, size_t new_size);
+
+/*!
+    Unmaps guarded block with its guard pages
+    \param[in]  block  Pointer to the first byte of block
+    \param[in]  size   Size of block (rounded)
+*/
+void StackGuardUnmap(void* block, size_t size);
+
+/*!
+    Adds owner of guarded blocks to the list that SIGSEGV handler asks about faults (handler is installed
+    by the first call, the previous handler is called after the report)
+    \param[in]  owner     Pointer that is passed to reporter
+    \param[in]  reporter  Function that describes owner
+    \return True if owner was added, false if the list is full (blocks still fault, but without report)
+*/
+bool StackGuardRegister(const void* owner, StackGuardReporter reporter);
+
+/*!
+    Removes owner from the list of SIGSEGV handler
+    \param[in]  owner  Pointer that was passed to StackGuardRegister
+*/
+void StackGuardUnregister(const void* owner);
+
+#endif
@@ -0,0 +1,352 @@
+#include <stdint.h>
+
+#include <atomic>
+#include <new>
+
+#include "stack_alloc.h"
+#include "stack_persist.h"
+#include "stack_utils.h"
+
+/// @brief Type of canaries on the persistent stack and node sides
+typedef uint64_t canary_t;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/// @brief Canary value for securing persistent stack structure
+static const canary_t PST_CANARY_VALUE  = 0x9E575ACC9E575ACC;
+
+/// @brief Canary value for securing nodes of persistent stack
+static const canary_t NODE_CANARY_VALUE = 0x90DE5ACC90DE5ACC;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#ifndef NCANARIES_MODE
+    /// @brief Sets up canaries in persistent stack structures or not depending on canaries mode
+    #define CANARIES_SET_UP(...) __VA_ARGS__
+#else
+    /// @brief Sets up canaries in persistent stack structures or not depending on canaries mode
+    #define CANARIES_SET_UP(...)
+#endif
+
+#ifndef NHASH_MODE
+    /// @brief Sets up hash in node or not depending on hash mode
+    #define HASH_SET_UP(...) __VA_ARGS__
+#else
+    /// @brief Sets up hash in node or not depending on hash mode
+    #define HASH_SET_UP(...)
+#endif
+
+/// @brief Node with one element (it is never changed after push, so it can be shared by forks)
+struct pst_node_t
+{
+    CANARIES_SET_UP(canary_t left_canary);
+
+    pst_node_t* next;
+    std::atomic<size_t> refs;     ///< Number of forks and nodes that point to it
+    StackElem_t value;
+    size_t size;                  ///< Number of elements from this node to the bottom
+    HASH_SET_UP(unsigned long hash);
+
+    CANARIES_SET_UP(canary_t right_canary);
+};
+
+/// @brief Sructure with persistent stack info
+struct pst_t
+{
+    CANARIES_SET_UP(canary_t left_canary);
+
+    pst_node_t* top;
+    StackProtection protection;
+    StackAllocator allocator;
+
+    CANARIES_SET_UP(canary_t right_canary);
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Finds persistent stack structure by its handle
+    \param[in]  pst_enc_ptr  Handle of persistent stack
+    \return Pointer to persistent stack structure or NULL if handle is wrong or stack was destructed
+    ----------------------------------------------------------------------------------------------------- */
+static inline pst_t* StackPersistFromHandle(size_t pst_enc_ptr)
+{
+    return (pst_t*) StackHandleFind(pst_enc_ptr, STK_HANDLE_PERSIST);
+}
+
+#ifndef NHASH_MODE
+/*! -----------------------------------------------------------------------------------------------------
+    Calculates hash of node (it covers value, size and hash of the node below)
+    \param[in]  node  Pointer to node
+    \return Hash of node
+    ----------------------------------------------------------------------------------------------------- */
+static inline unsigned long PstNodeHash(const pst_node_t* node)
+{
+    unsigned long next_hash = node->next != NULL ? node->next->hash : 0;
+    return MyHashElem((unsigned long long) node->value ^ next_hash, node->size);
+}
+#endif
+
+/*! -----------------------------------------------------------------------------------------------------
+    Allocates persistent stack structure by allocator and takes handle for it
+    (reference to top node is taken only if stack is created)
+    \param[out]  pst_enc_ptr  Handle of persistent stack
+    \param[in]   allocator    Allocator of stack and its nodes
+    \param[in]   protection   Protection level of stack
+    \param[in]   top          Pointer to top node (can be NULL)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+static StackError PstCreate(size_t* pst_enc_ptr, const StackAllocator* allocator, StackProtection protection,
+                            pst_node_t* top);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Drops one reference to node: node that has no references is freed together with the nodes
+    that are left without references after it
+    \param[in]  pst   Pointer to persistent stack sructure (its allocator is used)
+    \param[in]  node  Pointer to node (can be NULL)
+    ----------------------------------------------------------------------------------------------------- */
+static void PstNodeRelease(const pst_t* pst, pst_node_t* node);
+
+/*!
+    Verifies pointer and canaries of persistent stack structure and canaries and hash of its top node
+    as protection level requires
+    \param[in]  pst  Pointer to persistent stack sructure
+    \return Type of stack error or 0 for "no error"-state
+*/
+static StackError StackPersistVerify(pst_t* pst);
+
+
+/// @brief Macro for verifying persistent stack
+#define STACK_PERSIST_VERIFY(pst)                                                \
+    do {                                                                         \
+        StackError temp_code_err = STK_NO_ERROR;                                 \
+        if ((temp_code_err = StackPersistVerify(pst)) != STK_NO_ERROR)           \
+            return temp_code_err;                                                \
+    } while(0)
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! PERSISTENT STACK PART !!! <------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+StackError StackPersistInit(size_t* pst_enc_ptr, const StackConfig* config)
+{
+    if (*pst_enc_ptr != 0)
+        return STACK_ALREADY_INITED_ERR;
+
+    StackConfig default_config = StackDefaultConfig();
+    if (config == NULL)
+        config = &default_config;
+
+    return PstCreate(pst_enc_ptr, config->allocator != NULL ? config->allocator : StackMallocAllocator(),
+                     config->protection, NULL);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPersistDtor(size_t* pst_enc_ptr)
+{
+    pst_t* pst = StackPersistFromHandle(*pst_enc_ptr);
+
+    STACK_PERSIST_VERIFY(pst);
+
+    PstNodeRelease(pst, pst->top);
+
+    StackHandleFree(*pst_enc_ptr);
+
+    StackAllocator allocator = pst->allocator;
+    allocator.free(allocator.ctx, pst, sizeof(pst_t)); pst = NULL;
+
+    *pst_enc_ptr = 0;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackFork(size_t pst_enc_ptr, size_t* fork_enc_ptr)
+{
+    pst_t* pst = StackPersistFromHandle(pst_enc_ptr);
+
+    STACK_PERSIST_VERIFY(pst);
+
+    if (*fork_enc_ptr != 0)
+        return STACK_ALREADY_INITED_ERR;
+
+    return PstCreate(fork_enc_ptr, &pst->allocator, pst->protection, pst->top);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPersistPush(size_t pst_enc_ptr, StackElem_t value)
+{
+    pst_t* pst = StackPersistFromHandle(pst_enc_ptr);
+
+    STACK_PERSIST_VERIFY(pst);
+
+    pst_node_t* node = (pst_node_t*) pst->allocator.alloc(pst->allocator.ctx, sizeof(pst_node_t));
+    if (node == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    #ifndef NCANARIES_MODE
+        node->left_canary = node->right_canary = NODE_CANARY_VALUE;
+    #endif
+
+    // Reference of stack to the old top node becomes reference of the new node
+    node->next = pst->top;
+    new (&node->refs) std::atomic<size_t>(1);
+    node->value = value;
+    node->size = pst->top != NULL ? pst->top->size + 1 : 1;
+
+    #ifndef NHASH_MODE
+        node->hash = PstNodeHash(node);
+    #endif
+
+    pst->top = node;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPersistPop(size_t pst_enc_ptr, StackElem_t* var)
+{
+    pst_t* pst = StackPersistFromHandle(pst_enc_ptr);
+
+    STACK_PERSIST_VERIFY(pst);
+
+    pst_node_t* node = pst->top;
+    if (node == NULL)
+        return STACK_ANTIOVERFLOW_ERR;
+
+    *var = node->value;
+    pst->top = node->next;
+
+    // No other fork can get the node that only this stack points to, so its reference to the next node
+    // is taken by the stack without touching counters
+    if (node->refs.load(std::memory_order_acquire) == 1)
+    {
+        pst->allocator.free(pst->allocator.ctx, node, sizeof(pst_node_t));
+        return STK_NO_ERROR;
+    }
+
+    if (pst->top != NULL)
+        pst->top->refs.fetch_add(1, std::memory_order_relaxed);
+
+    PstNodeRelease(pst, node);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPersistTop(size_t pst_enc_ptr, StackElem_t* var)
+{
+    pst_t* pst = StackPersistFromHandle(pst_enc_ptr);
+
+    STACK_PERSIST_VERIFY(pst);
+
+    if (pst->top == NULL)
+        return STACK_ANTIOVERFLOW_ERR;
+
+    *var = pst->top->value;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+StackError StackPersistSize(size_t pst_enc_ptr, size_t* size)
+{
+    pst_t* pst = StackPersistFromHandle(pst_enc_ptr);
+
+    STACK_PERSIST_VERIFY(pst);
+
+    *size = pst->top != NULL ? pst->top->size : 0;
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static StackError PstCreate(size_t* pst_enc_ptr, const StackAllocator* allocator, StackProtection protection,
+                            pst_node_t* top)
+{
+    pst_t* pst = (pst_t*) allocator->alloc(allocator->ctx, sizeof(pst_t));
+    if (pst == NULL)
+        return OUT_OF_MEMORY_ERR;
+
+    new (pst) pst_t();
+
+    #ifndef NCANARIES_MODE
+        pst->left_canary = pst->right_canary = PST_CANARY_VALUE;
+    #endif
+
+    pst->top = top;
+    pst->protection = protection;
+    pst->allocator = *allocator;
+
+    if ((*pst_enc_ptr = StackHandleAlloc(pst, STK_HANDLE_PERSIST)) == 0)
+    {
+        pst->allocator.free(pst->allocator.ctx, pst, sizeof(pst_t));
+        return OUT_OF_MEMORY_ERR;
+    }
+
+    if (top != NULL)
+        top->refs.fetch_add(1, std::memory_order_relaxed);
+
+    return STK_NO_ERROR;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void PstNodeRelease(const pst_t* pst, pst_node_t* node)
+{
+    while (node != NULL && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        pst_node_t* next = node->next;
+        pst->allocator.free(pst->allocator.ctx, node, sizeof(pst_node_t));
+        node = next;
+    }
+}
+
+
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+//----------------------------------------------------------------------------------------------------------------
+// ------> !!! VERIFY PART !!! <----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+
+static StackError StackPersistVerify(pst_t* pst)
+{
+    if (pst == NULL)
+        return STACK_BAD_HANDLE_ERR;
+
+    #ifndef NCANARIES_MODE
+        if (pst->left_canary != PST_CANARY_VALUE || pst->right_canary != PST_CANARY_VALUE)
+            return STKSTRUCT_CANARY_CORRUPT_ERR;
+    #endif
+
+    const pst_node_t* top = pst->top;
+    if (top == NULL || pst->protection == STK_PROTECT_NONE)
+        return STK_NO_ERROR;
+
+    #ifndef NCANARIES_MODE
+        if (top->left_canary != NODE_CANARY_VALUE || top->right_canary != NODE_CANARY_VALUE)
+            return STKDATA_CANARY_CORRUPT_ERR;
+    #endif
+
+    // Nodes below the top one were checked when they were on top (the same nodes of other forks are not
+    // checked again), and their hashes are covered by hash of the top one
+    #ifndef NHASH_MODE
+        if (pst->protection >= STK_PROTECT_SAMPLED &&
+            (top->hash != PstNodeHash(top) || (top->next != NULL && top->next->size + 1 != top->size)))
+            return STKDATA_INFO_CORRUPT_ERR;
+    #endif
+
+    return STK_NO_ERROR;
+}
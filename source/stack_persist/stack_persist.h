@@ -0,0 +1,71 @@
+/*!
+    \file
+    File with persistent stack: it is a list of immutable reference-counted nodes, so its forks share
+    all elements that were pushed before the fork
+*/
+
+#ifndef STACK_PERSIST_H
+#define STACK_PERSIST_H
+
+#include <stddef.h>
+
+#include "stack.h"
+
+/*! -----------------------------------------------------------------------------------------------------
+    Persistent stack initializer. Allocator and protection level are taken from config (nodes have
+    canaries and hashes of their own, hash of node covers hash of the node below it)
+    \param[in, out]  pst_enc_ptr  Encoded pointer to persistent stack structure
+    \param[in]       config       Settings of stack (NULL for default ones)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPersistInit(size_t* pst_enc_ptr, const StackConfig* config);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Destructs persistent stack (nodes that are shared with other forks are kept for them)
+    \param[in, out]  pst_enc_ptr  Encoded pointer to persistent stack structure
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPersistDtor(size_t* pst_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Creates new stack with the same elements in O(1): both stacks share the nodes and can be changed
+    independently after it (forks can be used by different threads)
+    \param[in]       pst_enc_ptr   Encoded pointer to persistent stack structure
+    \param[in, out]  fork_enc_ptr  Encoded pointer where new stack is put (it must be 0)
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackFork(size_t pst_enc_ptr, size_t* fork_enc_ptr);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Puts value to persistent stack (other forks don't see it)
+    \param[in]  pst_enc_ptr  Encoded pointer to persistent stack structure
+    \param[in]  value        Value that should be put to stack
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPersistPush(size_t pst_enc_ptr, StackElem_t value);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Extracts value from persistent stack (node is freed if no other fork has it)
+    \param[in]   pst_enc_ptr  Encoded pointer to persistent stack structure
+    \param[out]  var          Pointer to variable where extracted value should be put
+    \return Type of stack error (STACK_ANTIOVERFLOW_ERR if stack is empty) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPersistPop(size_t pst_enc_ptr, StackElem_t* var);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets the top element of persistent stack without extracting it
+    \param[in]   pst_enc_ptr  Encoded pointer to persistent stack structure
+    \param[out]  var          Pointer to variable where the top value should be put
+    \return Type of stack error (STACK_ANTIOVERFLOW_ERR if stack is empty) or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPersistTop(size_t pst_enc_ptr, StackElem_t* var);
+
+/*! -----------------------------------------------------------------------------------------------------
+    Gets number of elements of persistent stack
+    \param[in]   pst_enc_ptr  Encoded pointer to persistent stack structure
+    \param[out]  size         Pointer to variable where number of elements should be put
+    \return Type of stack error or 0 for "no error"-state
+    ----------------------------------------------------------------------------------------------------- */
+StackError StackPersistSize(size_t pst_enc_ptr, size_t* size);
+
+#endif
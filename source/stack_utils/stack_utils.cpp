@@ -1,6 +1,8 @@
+#include <immintrin.h>
 #include <limits.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "stack_utils.h"
 
@@ -22,6 +24,24 @@ static const int           HASH_SHIFT_COEF = 5;
 /// @brief Start value of temporary hash
 static const unsigned long START_HASH      = 5381;
 
+/// @brief Primes that are used by block hash algorithms
+static const uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t HASH_PRIME_3 = 0x165667B19E3779F9ull;
+static const uint64_t HASH_PRIME_4 = 0x85EBCA77C2B2AE63ull;
+
+/// @brief Size of block that is hashed by one iteration of scalar algorithm
+static const size_t SCALAR_BLOCK_SIZE = 32;
+
+/// @brief Size of block that is hashed by one iteration of CRC32C and AVX2 algorithms
+static const size_t WIDE_BLOCK_SIZE   = 64;
+
+/// @brief Type of hash algorithm implementation
+typedef unsigned long (*HashFunc_t)(const void* ptr, size_t number_of_bytes);
+
+/// @brief Type of run length implementation
+typedef size_t (*RunFunc_t)(const uint64_t* words, size_t number_of_words);
+
 //----------------------------------------------------------------------------------------------------------------------
 
 bool IsEqual(double num1, double num2)
@@ -47,12 +67,95 @@ long long unsigned int MyGetRandom64()
 
 //----------------------------------------------------------------------------------------------------------------------
 
-unsigned long MyHash(void* ptr, int number_of_bytes)
+/*! -----------------------------------------------------------------------------------------------------
+    Reads 8 bytes from any address
+    \param[in]  ptr  Pointer to the first byte
+    \return 8 bytes as a number
+    ----------------------------------------------------------------------------------------------------- */
+static inline uint64_t HashRead64(const unsigned char* ptr)
+{
+    uint64_t word = 0;
+    memcpy(&word, ptr, sizeof(word));
+    return word;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Reads less than 8 bytes (zero-padded)
+    \param[in]  ptr              Pointer to the first byte
+    \param[in]  number_of_bytes  Number of bytes (< 8)
+    \return Bytes as a number
+    ----------------------------------------------------------------------------------------------------- */
+static inline uint64_t HashReadTail(const unsigned char* ptr, size_t number_of_bytes)
 {
-    char* char_ptr = (char*) ptr;
+    uint64_t word = 0;
+    memcpy(&word, ptr, number_of_bytes);
+    return word;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t HashRotl(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t HashRound(uint64_t acc, uint64_t word)
+{
+    return HashRotl(acc + word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static inline uint64_t HashAvalanche(uint64_t calc_hash)
+{
+    calc_hash ^= calc_hash >> 33;
+    calc_hash *= HASH_PRIME_2;
+    calc_hash ^= calc_hash >> 29;
+    calc_hash *= HASH_PRIME_3;
+    calc_hash ^= calc_hash >> 32;
+    return calc_hash;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/*! -----------------------------------------------------------------------------------------------------
+    Hashes the bytes that are left after the block loop (8 bytes per step)
+    \param[in]  calc_hash        Hash of the blocks
+    \param[in]  ptr              Pointer to the first byte that was not hashed
+    \param[in]  number_of_bytes  Number of bytes left
+    \return Final hash
+    ----------------------------------------------------------------------------------------------------- */
+static uint64_t HashTail(uint64_t calc_hash, const unsigned char* ptr, size_t number_of_bytes)
+{
+    while (number_of_bytes >= sizeof(uint64_t))
+    {
+        calc_hash ^= HashRound(0, HashRead64(ptr));
+        calc_hash  = HashRotl(calc_hash, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+        ptr += sizeof(uint64_t);
+        number_of_bytes -= sizeof(uint64_t);
+    }
+
+    if (number_of_bytes > 0)
+    {
+        calc_hash ^= HashReadTail(ptr, number_of_bytes) * HASH_PRIME_1;
+        calc_hash  = HashRotl(calc_hash, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+    }
+
+    return HashAvalanche(calc_hash);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long HashDJB2(const void* ptr, size_t number_of_bytes)
+{
+    const unsigned char* char_ptr = (const unsigned char*) ptr;
     unsigned long calc_hash = START_HASH;
 
-    for (int i = 0; i < number_of_bytes; i++)
+    for (size_t i = 0; i < number_of_bytes; i++)
     {
         calc_hash = ((calc_hash << HASH_SHIFT_COEF) + calc_hash) + *char_ptr;
         ++char_ptr;
@@ -60,3 +163,226 @@ unsigned long MyHash(void* ptr, int number_of_bytes)
 
     return calc_hash;
 }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static unsigned long HashScalar(const void* ptr, size_t number_of_bytes)
+{
+    const unsigned char* byte_ptr = (const unsigned char*) ptr;
+    size_t bytes_left = number_of_bytes;
+
+    uint64_t calc_hash = HASH_PRIME_4 + number_of_bytes;
+
+    if (bytes_left >= SCALAR_BLOCK_SIZE)
+    {
+        uint64_t acc1 = START_HASH + HASH_PRIME_1 + HASH_PRIME_2;
+        uint64_t acc2 = START_HASH + HASH_PRIME_2;
+        uint64_t acc3 = START_HASH;
+        uint64_t acc4 = START_HASH - HASH_PRIME_1;
+
+        // Four independent lanes, so multiplications of the different lanes are done in parallel
+        for (; bytes_left >= SCALAR_BLOCK_SIZE; bytes_left -= SCALAR_BLOCK_SIZE, byte_ptr += SCALAR_BLOCK_SIZE)
+        {
+            acc1 = HashRound(acc1, HashRead64(byte_ptr));
+            acc2 = HashRound(acc2, HashRead64(byte_ptr + 8));
+            acc3 = HashRound(acc3, HashRead64(byte_ptr + 16));
+            acc4 = HashRound(acc4, HashRead64(byte_ptr + 24));
+        }
+
+        calc_hash += HashRotl(acc1, 1) + HashRotl(acc2, 7) + HashRotl(acc3, 12) + HashRotl(acc4, 18);
+    }
+
+    return HashTail(calc_hash, byte_ptr, bytes_left);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+__attribute__((target("sse4.2")))
+static unsigned long HashCRC32C(const void* ptr, size_t number_of_bytes)
+{
+    const unsigned char* byte_ptr = (const unsigned char*) ptr;
+    size_t bytes_left = number_of_bytes;
+
+    uint64_t calc_hash = HASH_PRIME_3 + number_of_bytes;
+
+    if (bytes_left >= WIDE_BLOCK_SIZE)
+    {
+        uint64_t crc1 = START_HASH, crc2 = HASH_PRIME_1, crc3 = HASH_PRIME_2, crc4 = HASH_PRIME_3;
+
+        // crc32 has latency 3 and throughput 1, so four streams keep the unit busy
+        for (; bytes_left >= WIDE_BLOCK_SIZE; bytes_left -= WIDE_BLOCK_SIZE, byte_ptr += WIDE_BLOCK_SIZE)
+        {
+            crc1 = _mm_crc32_u64(crc1, HashRead64(byte_ptr));
+            crc2 = _mm_crc32_u64(crc2, HashRead64(byte_ptr + 8));
+            crc3 = _mm_crc32_u64(crc3, HashRead64(byte_ptr + 16));
+            crc4 = _mm_crc32_u64(crc4, HashRead64(byte_ptr + 24));
+            crc1 = _mm_crc32_u64(crc1, HashRead64(byte_ptr + 32));
+            crc2 = _mm_crc32_u64(crc2, HashRead64(byte_ptr + 40));
+            crc3 = _mm_crc32_u64(crc3, HashRead64(byte_ptr + 48));
+            crc4 = _mm_crc32_u64(crc4, HashRead64(byte_ptr + 56));
+        }
+
+        calc_hash += HashRound(crc1 | (crc2 << 32), HASH_PRIME_4) ^ HashRound(crc3 | (crc4 << 32), HASH_PRIME_1);
+    }
+
+    return HashTail(calc_hash, byte_ptr, bytes_left);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static unsigned long HashAVX2(const void* ptr, size_t number_of_bytes)
+{
+    const unsigned char* byte_ptr = (const unsigned char*) ptr;
+    size_t bytes_left = number_of_bytes;
+
+    uint64_t calc_hash = HASH_PRIME_2 + number_of_bytes;
+
+    if (bytes_left >= WIDE_BLOCK_SIZE)
+    {
+        const __m256i key1 = _mm256_set_epi64x(HASH_PRIME_1, HASH_PRIME_2, HASH_PRIME_3, HASH_PRIME_4);
+        const __m256i key2 = _mm256_set_epi64x(HASH_PRIME_4, HASH_PRIME_3, HASH_PRIME_2, HASH_PRIME_1);
+
+        __m256i acc1 = _mm256_set1_epi64x(START_HASH);
+        __m256i acc2 = _mm256_set1_epi64x(HASH_PRIME_1);
+
+        // 32x32->64 multiplication of the data mixed with key, plus the data itself so that nothing is lost
+        for (; bytes_left >= WIDE_BLOCK_SIZE; bytes_left -= WIDE_BLOCK_SIZE, byte_ptr += WIDE_BLOCK_SIZE)
+        {
+            __m256i block1 = _mm256_loadu_si256((const __m256i*) byte_ptr);
+            __m256i block2 = _mm256_loadu_si256((const __m256i*) (byte_ptr + 32));
+
+            __m256i keyed1 = _mm256_xor_si256(block1, key1);
+            __m256i keyed2 = _mm256_xor_si256(block2, key2);
+
+            acc1 = _mm256_add_epi64(acc1, _mm256_shuffle_epi32(block1, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc2 = _mm256_add_epi64(acc2, _mm256_shuffle_epi32(block2, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc1 = _mm256_add_epi64(acc1, _mm256_mul_epu32(keyed1, _mm256_srli_epi64(keyed1, 32)));
+            acc2 = _mm256_add_epi64(acc2, _mm256_mul_epu32(keyed2, _mm256_srli_epi64(keyed2, 32)));
+        }
+
+        uint64_t lanes[8] = {};
+        _mm256_storeu_si256((__m256i*) lanes,       acc1);
+        _mm256_storeu_si256((__m256i*) (lanes + 4), acc2);
+
+        // Compiler doesn't do it before tail call of HashTail, and dirty upper halves slow down SSE code of the caller
+        _mm256_zeroupper();
+
+        for (int i = 0; i < 8; i++)
+            calc_hash = HashRound(calc_hash, lanes[i]);
+    }
+
+    return HashTail(calc_hash, byte_ptr, bytes_left);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static HashFunc_t HashFuncByAlgo(HashAlgo algo)
+{
+    switch (algo)
+    {
+        case HASH_ALGO_DJB2:    return HashDJB2;
+        case HASH_ALGO_SCALAR:  return HashScalar;
+        case HASH_ALGO_CRC32C:  return HashCRC32C;
+        case HASH_ALGO_AVX2:    return HashAVX2;
+        default:                return HashScalar;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+bool MyHashAlgoSupported(HashAlgo algo)
+{
+    switch (algo)
+    {
+        case HASH_ALGO_DJB2:
+        case HASH_ALGO_SCALAR:  return true;
+        case HASH_ALGO_CRC32C:  return __builtin_cpu_supports("sse4.2");
+        case HASH_ALGO_AVX2:    return __builtin_cpu_supports("avx2");
+        default:                return false;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+HashAlgo MyHashAlgo()
+{
+    #ifdef DJB2_HASH_MODE
+        return HASH_ALGO_DJB2;
+    #else
+        static const HashAlgo best_algo = MyHashAlgoSupported(HASH_ALGO_AVX2)   ? HASH_ALGO_AVX2   :
+                                          MyHashAlgoSupported(HASH_ALGO_CRC32C) ? HASH_ALGO_CRC32C :
+                                                                                  HASH_ALGO_SCALAR;
+        return best_algo;
+    #endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+unsigned long MyHash(const void* ptr, size_t number_of_bytes)
+{
+    static const HashFunc_t hash_func = HashFuncByAlgo(MyHashAlgo());
+
+    return hash_func(ptr, number_of_bytes);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+unsigned long MyHashWith(HashAlgo algo, const void* ptr, size_t number_of_bytes)
+{
+    return HashFuncByAlgo(algo)(ptr, number_of_bytes);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static size_t RunLengthScalar(const uint64_t* words, size_t number_of_words)
+{
+    const uint64_t first = words[0];
+    size_t i = 1;
+
+    // Differences of four words are joined, so there is one branch per four of them
+    for (; i + 4 <= number_of_words; i += 4)
+        if (((words[i] ^ first) | (words[i + 1] ^ first) | (words[i + 2] ^ first) | (words[i + 3] ^ first)) != 0)
+            break;
+
+    while (i < number_of_words && words[i] == first)
+        i++;
+
+    return i;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static size_t RunLengthAVX2(const uint64_t* words, size_t number_of_words)
+{
+    const __m256i first = _mm256_set1_epi64x((long long) words[0]);
+    size_t i = 1;
+
+    for (; i + 8 <= number_of_words; i += 8)
+    {
+        __m256i equal1 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (words + i)),     first);
+        __m256i equal2 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (words + i + 4)), first);
+        if ((unsigned) _mm256_movemask_epi8(_mm256_and_si256(equal1, equal2)) != 0xFFFFFFFFu)
+            break;
+    }
+
+    _mm256_zeroupper();
+
+    while (i < number_of_words && words[i] == words[0])
+        i++;
+
+    return i;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+size_t MyRunLength(const uint64_t* words, size_t number_of_words)
+{
+    static const RunFunc_t run_func = MyHashAlgoSupported(HASH_ALGO_AVX2) ? RunLengthAVX2 : RunLengthScalar;
+
+    if (number_of_words == 0)
+        return 0;
+
+    return run_func(words, number_of_words);
+}
@@ -6,6 +6,7 @@
 #ifndef STACK_UTILS_H
 #define STACK_UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define BLK "\033[0;30m"
@@ -31,12 +32,70 @@ bool IsEqual(double num1, double num2);
 */
 long long unsigned int MyGetRandom64();
 
+/// @brief Hash algorithms that can be used by MyHash
+enum HashAlgo
+{
+    HASH_ALGO_DJB2    = 0,  ///< Byte-wise DJB2 (old one)
+    HASH_ALGO_SCALAR  = 1,  ///< Four 64-bit lanes over 32-byte blocks, works everywhere
+    HASH_ALGO_CRC32C  = 2,  ///< Four CRC32C streams over 64-byte blocks (needs SSE4.2)
+    HASH_ALGO_AVX2    = 3,  ///< Two 256-bit accumulators over 64-byte blocks (needs AVX2)
+};
+
 /*!
-    Hashes info using DJB2 algorithm
+    Hashes info using algorithm that was chosen for this build:
+    DJB2 if DJB2_HASH_MODE is defined, otherwise the fastest one that current CPU supports
     \param[in]  ptr              Pointer to the first byte
     \param[in]  number_of_bytes  Number of bytes that should be hashed
     \return Hash <number_of_butes> elements with the first one on <ptr>
 */
-unsigned long MyHash(void* ptr, int number_of_bytes);
+unsigned long MyHash(const void* ptr, size_t number_of_bytes);
+
+/*!
+    Hashes info using given algorithm
+    \param[in]  algo             Algorithm that should be used (must be supported by CPU)
+    \param[in]  ptr              Pointer to the first byte
+    \param[in]  number_of_bytes  Number of bytes that should be hashed
+    \return Hash <number_of_butes> elements with the first one on <ptr>
+*/
+unsigned long MyHashWith(HashAlgo algo, const void* ptr, size_t number_of_bytes);
+
+/*!
+    Checks whether current CPU can run hash algorithm
+    \param[in]  algo  Algorithm to check
+    \return True (if algorithm is supported), false (otherwise)
+*/
+bool MyHashAlgoSupported(HashAlgo algo);
+
+/*!
+    Gets algorithm that is used by MyHash
+    \return Algorithm that was chosen for this build and CPU
+*/
+HashAlgo MyHashAlgo();
+
+/*!
+    Counts words from the first one that are equal to it (AVX2 is used if current CPU supports it)
+    \param[in]  words            Pointer to the first word
+    \param[in]  number_of_words  Number of words
+    \return Length of run of equal words (0 only for empty array)
+*/
+size_t MyRunLength(const uint64_t* words, size_t number_of_words);
+
+/*!
+    Hashes one element together with its position. Hash of an array is the sum of these values,
+    so it can be updated in O(1) when an element is added to (or removed from) the end
+    \param[in]  value     Element that should be hashed
+    \param[in]  position  Index of the element
+    \return Hash of the element on the position
+*/
+inline unsigned long MyHashElem(unsigned long long value, unsigned long long position)
+{
+    unsigned long long calc_hash = value + (position + 1) * 0x9E3779B97F4A7C15ull;
+
+    calc_hash = (calc_hash ^ (calc_hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    calc_hash = (calc_hash ^ (calc_hash >> 27)) * 0x94D049BB133111EBull;
+    calc_hash =  calc_hash ^ (calc_hash >> 31);
+
+    return (unsigned long) calc_hash;
+}
 
 #endif